@@ -0,0 +1,702 @@
+/**
+ * sa_place: A standalone command-line placer built on the Rig-SA kernel.
+ *
+ * Reads a placement problem from a file, produces an initial placement, anneals
+ * it and writes out the chip each vertex was placed on. See usage() for the
+ * command-line options and the problem and placement file formats.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <string.h>
+#include <math.h>
+#include <signal.h>
+
+#include "sa.h"
+
+// Cost-delta standard deviation at infinite temperature is multiplied by this
+// to produce the default initial temperature (as in Rig's Python kernel
+// driver).
+#define SA_PLACE_INITIAL_TEMPERATURE_RATIO 20.0
+
+// The acceptance rate the distance limit is adjusted to maintain.
+#define SA_PLACE_TARGET_ACCEPT_RATE 0.44
+
+static void usage(const char *name) {
+	fprintf(stderr,
+		"Usage: %s [options] PROBLEM [PLACEMENTS]\n"
+		"\n"
+		"Place the vertices described in the PROBLEM file and write the\n"
+		"chip each vertex is placed on to PLACEMENTS (default: stdout).\n"
+		"\n"
+		"Options:\n"
+		"  -s SEED      Random number seed (default: 0).\n"
+		"  -q           Use quadratic (rather than constructive) initial placement.\n"
+		"  -m MODEL     Cost model: hpwl (default), clique, star or hex_star.\n"
+		"  -n STEPS     Steps per temperature (default: 10 per movable vertex).\n"
+		"  -t TEMP      Initial temperature (default: chosen automatically by\n"
+		"               annealing at infinite temperature).\n"
+		"  -a ALPHA     Cooling factor applied after each temperature (default: 0.95).\n"
+		"  -e EFFORT    Stop once the standard deviation of cost changes falls\n"
+		"               below EFFORT times the mean net cost (default: 0.001).\n"
+		"  -l LEVELS    Anneal using the multilevel scheme with up to LEVELS levels,\n"
+		"               STEPS steps per level, instead of the schedule above\n"
+		"               (default: 1, disabled).\n"
+		"  -T SECONDS   Stop annealing after SECONDS seconds (default: no limit,\n"
+		"               ignored with -l). Annealing may also be stopped early by\n"
+		"               SIGINT (e.g. Ctrl+C): the placement reached is written.\n"
+		"  -F FANOUT    Freeze nets with at least FANOUT vertices: moves ignore\n"
+		"               their cost, which is only recomputed periodically\n"
+		"               (default: 0, disabled).\n"
+		"  -v           Print progress to stderr.\n"
+		"\n"
+		"Problem file format (one item per line, '#' starts a comment):\n"
+		"  machine WIDTH HEIGHT WRAP NUM_RESOURCES\n"
+		"      Must appear first. WRAP is 1 for a torus and 0 otherwise.\n"
+		"  chips R0 R1 ...\n"
+		"      Resources available on every chip (default: all zero).\n"
+		"  chip X Y R0 R1 ...\n"
+		"      Resources available on a specific chip (negative if dead).\n"
+		"  vertex R0 R1 ... [fixed X Y]\n"
+		"      A vertex consuming the given resources, optionally fixed to a\n"
+		"      chip. Vertices are numbered from 0 in the order given.\n"
+		"  net WEIGHT V0 V1 ...\n"
+		"      A net connecting the numbered vertices, V0 being its source.\n"
+		"\n"
+		"Placement file format: one 'VERTEX X Y' line per vertex.\n",
+		name);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Problem file parsing
+////////////////////////////////////////////////////////////////////////////////
+
+// A problem file split into lines (with comments removed).
+typedef struct problem_file {
+	char *text;
+	char **lines;
+	size_t num_lines;
+	const char *filename;
+} problem_file_t;
+
+/**
+ * Read a problem file into memory, splitting it into NUL-terminated lines.
+ *
+ * @returns False if the file couldn't be read.
+ */
+static int read_problem_file(const char *filename, problem_file_t *file) {
+	FILE *f;
+	long length;
+	size_t i;
+	char *c;
+	
+	file->filename = filename;
+	file->text = NULL;
+	file->lines = NULL;
+	file->num_lines = 0;
+	
+	f = fopen(filename, "rb");
+	if (f == NULL)
+		return 0;
+	
+	if (fseek(f, 0, SEEK_END) != 0 || (length = ftell(f)) < 0 ||
+	    fseek(f, 0, SEEK_SET) != 0 ||
+	    (file->text = malloc(length + 1)) == NULL ||
+	    fread(file->text, 1, length, f) != (size_t)length) {
+		fclose(f);
+		return 0;
+	}
+	fclose(f);
+	file->text[length] = '\0';
+	
+	// Split into lines and strip comments
+	file->num_lines = 1;
+	for (c = file->text; *c; c++)
+		if (*c == '\n')
+			file->num_lines++;
+	file->lines = malloc(file->num_lines * sizeof(char *));
+	if (file->lines == NULL)
+		return 0;
+	
+	file->lines[0] = file->text;
+	i = 1;
+	for (c = file->text; *c; c++) {
+		if (*c == '\n') {
+			*c = '\0';
+			file->lines[i++] = c + 1;
+		}
+	}
+	for (i = 0; i < file->num_lines; i++)
+		if ((c = strchr(file->lines[i], '#')) != NULL)
+			*c = '\0';
+	
+	return 1;
+}
+
+static void free_problem_file(problem_file_t *file) {
+	free(file->text);
+	free(file->lines);
+}
+
+/**
+ * Skip whitespace, returning a pointer to the start of the next token (or the
+ * end of the line).
+ */
+static const char *skip_space(const char *c) {
+	while (*c == ' ' || *c == '\t' || *c == '\r')
+		c++;
+	return c;
+}
+
+/**
+ * If the next token on a line is the given keyword, skip over it.
+ */
+static int accept_keyword(const char **c, const char *keyword) {
+	size_t length = strlen(keyword);
+	const char *start = skip_space(*c);
+	
+	if (strncmp(start, keyword, length) == 0 &&
+	    (start[length] == '\0' || start[length] == ' ' ||
+	     start[length] == '\t' || start[length] == '\r')) {
+		*c = start + length;
+		return 1;
+	} else {
+		return 0;
+	}
+}
+
+/**
+ * Parse an integer token, advancing past it.
+ */
+static int parse_long(const char **c, long *value) {
+	char *end;
+	*value = strtol(*c, &end, 10);
+	if (end == *c)
+		return 0;
+	*c = end;
+	return 1;
+}
+
+static int parse_double(const char **c, double *value) {
+	char *end;
+	*value = strtod(*c, &end);
+	if (end == *c)
+		return 0;
+	*c = end;
+	return 1;
+}
+
+/**
+ * Is there nothing but whitespace left on the line?
+ */
+static int at_end(const char *c) {
+	return *skip_space(c) == '\0';
+}
+
+static void parse_error(const problem_file_t *file, size_t line,
+                        const char *message) {
+	fprintf(stderr, "%s:%lu: %s\n", file->filename,
+	        (unsigned long)(line + 1), message);
+}
+
+/**
+ * Build an SA state from a problem file. Vertices are created in the order
+ * given in the file except that the fixed vertices are moved to the end (as
+ * required by sa_new()). The index of each file vertex in state->vertices is
+ * written to *vertex_indices (an array allocated by this function).
+ *
+ * @returns The new state or NULL on error (having printed a message).
+ */
+static sa_state_t *parse_problem(const problem_file_t *file,
+                                 size_t **vertex_indices) {
+	size_t i, j, r;
+	size_t num_vertices = 0;
+	size_t num_fixed = 0;
+	size_t num_nets = 0;
+	size_t num_movable = 0;
+	size_t num_pins;
+	size_t machine_line = 0;
+	long width = 0, height = 0, wrap = 0, num_resources = 0;
+	long x, y, value;
+	double weight;
+	const char *c;
+	const char *pins;
+	int ok = 1;
+	int have_machine = 0;
+	size_t *num_vertex_nets = NULL;
+	int *resources = NULL;
+	sa_state_t *state = NULL;
+	sa_vertex_t *vertex;
+	sa_net_t *net;
+	
+	*vertex_indices = NULL;
+	
+	// First pass: find the machine and count the vertices and nets
+	for (i = 0; i < file->num_lines && ok; i++) {
+		c = file->lines[i];
+		if (at_end(c)) {
+			continue;
+		} else if (accept_keyword(&c, "machine")) {
+			if (have_machine || !parse_long(&c, &width) || !parse_long(&c, &height) ||
+			    !parse_long(&c, &wrap) || !parse_long(&c, &num_resources) ||
+			    !at_end(c) || width < 1 || height < 1 || width * height < 2 ||
+			    num_resources < 1) {
+				parse_error(file, i, "invalid machine definition");
+				ok = 0;
+			}
+			have_machine = 1;
+			machine_line = i;
+		} else if (!have_machine) {
+			parse_error(file, i, "the machine must be defined first");
+			ok = 0;
+		} else if (accept_keyword(&c, "vertex")) {
+			num_vertices++;
+			for (r = 0; r < (size_t)num_resources; r++)
+				ok = ok && parse_long(&c, &value);
+			if (ok && accept_keyword(&c, "fixed")) {
+				ok = parse_long(&c, &x) && parse_long(&c, &y) &&
+				     x >= 0 && x < width && y >= 0 && y < height;
+				num_fixed++;
+			}
+			if (!ok || !at_end(c)) {
+				parse_error(file, i, "invalid vertex definition");
+				ok = 0;
+			}
+		} else if (accept_keyword(&c, "net")) {
+			num_nets++;
+		} else if (!accept_keyword(&c, "chips") && !accept_keyword(&c, "chip")) {
+			parse_error(file, i, "unrecognised line");
+			ok = 0;
+		}
+	}
+	if (ok && !have_machine) {
+		fprintf(stderr, "%s: no machine defined\n", file->filename);
+		ok = 0;
+	}
+	num_movable = num_vertices - num_fixed;
+	if (ok && num_movable == 0) {
+		fprintf(stderr, "%s: no movable vertices defined\n", file->filename);
+		ok = 0;
+	}
+	
+	// Second pass: check the nets and count the nets of each vertex
+	if (ok) {
+		num_vertex_nets = calloc(num_vertices, sizeof(size_t));
+		*vertex_indices = malloc(num_vertices * sizeof(size_t));
+		resources = malloc(num_resources * sizeof(int));
+		if (num_vertex_nets == NULL || *vertex_indices == NULL || resources == NULL) {
+			fprintf(stderr, "out of memory\n");
+			ok = 0;
+		}
+	}
+	for (i = 0; i < file->num_lines && ok; i++) {
+		c = file->lines[i];
+		if (!accept_keyword(&c, "net"))
+			continue;
+		if (!parse_double(&c, &weight)) {
+			parse_error(file, i, "invalid net weight");
+			ok = 0;
+		}
+		while (ok && !at_end(c)) {
+			if (!parse_long(&c, &value) || value < 0 || (size_t)value >= num_vertices) {
+				parse_error(file, i, "invalid vertex number in net");
+				ok = 0;
+			} else {
+				num_vertex_nets[value]++;
+			}
+		}
+	}
+	
+	// Number the vertices: movable vertices first, then fixed ones
+	if (ok) {
+		j = 0;
+		for (i = 0; i < file->num_lines; i++) {
+			c = file->lines[i];
+			if (!accept_keyword(&c, "vertex"))
+				continue;
+			for (r = 0; r < (size_t)num_resources; r++)
+				parse_long(&c, &value);
+			(*vertex_indices)[j++] = accept_keyword(&c, "fixed") ? 0 : 1;
+		}
+		x = 0;
+		y = (long)num_movable;
+		for (j = 0; j < num_vertices; j++)
+			(*vertex_indices)[j] = (*vertex_indices)[j] ? (size_t)(x++) : (size_t)(y++);
+		
+		state = sa_new(width, height, num_resources, num_vertices, num_nets);
+		if (state == NULL) {
+			fprintf(stderr, "out of memory\n");
+			ok = 0;
+		}
+	}
+	
+	// Third pass: build the state
+	if (ok) {
+		state->has_wrap_around_links = wrap != 0;
+		state->num_movable_vertices = num_movable;
+		for (i = 0; i < num_vertices; i++)
+			state->vertices[i] = NULL;
+		for (i = 0; i < num_nets; i++)
+			state->nets[i] = NULL;
+		for (x = 0; x < width; x++)
+			for (y = 0; y < height; y++)
+				for (r = 0; r < (size_t)num_resources; r++)
+					sa_set_chip_resources(state, x, y, r, 0);
+	}
+	for (i = machine_line + 1, j = 0; ok && i < file->num_lines; i++) {
+		c = file->lines[i];
+		if (accept_keyword(&c, "chips")) {
+			for (r = 0; r < (size_t)num_resources && ok; r++)
+				ok = parse_long(&c, &value) && ((resources[r] = (int)value), 1);
+			if (!ok || !at_end(c)) {
+				parse_error(file, i, "invalid chips definition");
+				ok = 0;
+			}
+			for (x = 0; x < width && ok; x++)
+				for (y = 0; y < height; y++)
+					for (r = 0; r < (size_t)num_resources; r++)
+						sa_set_chip_resources(state, x, y, r, resources[r]);
+		} else if (accept_keyword(&c, "chip")) {
+			ok = parse_long(&c, &x) && parse_long(&c, &y) &&
+			     x >= 0 && x < width && y >= 0 && y < height;
+			for (r = 0; r < (size_t)num_resources && ok; r++)
+				ok = parse_long(&c, &value) && ((resources[r] = (int)value), 1);
+			if (!ok || !at_end(c)) {
+				parse_error(file, i, "invalid chip definition");
+				ok = 0;
+			} else {
+				for (r = 0; r < (size_t)num_resources; r++)
+					sa_set_chip_resources(state, x, y, r, resources[r]);
+			}
+		} else if (accept_keyword(&c, "vertex")) {
+			vertex = sa_new_vertex(state, num_vertex_nets[j]);
+			if (vertex == NULL) {
+				fprintf(stderr, "out of memory\n");
+				ok = 0;
+				break;
+			}
+			vertex->index = (*vertex_indices)[j];
+			state->vertices[(*vertex_indices)[j++]] = vertex;
+			for (r = 0; r < (size_t)num_resources; r++) {
+				parse_long(&c, &value);
+				vertex->vertex_resources[r] = (int)value;
+			}
+		}
+	}
+	
+	// Add the nets
+	for (i = 0, j = 0; ok && i < file->num_lines; i++) {
+		c = file->lines[i];
+		if (!accept_keyword(&c, "net"))
+			continue;
+		parse_double(&c, &weight);
+		
+		num_pins = 0;
+		for (pins = c; !at_end(pins); num_pins++)
+			parse_long(&pins, &value);
+		
+		net = sa_new_net(state, num_pins);
+		if (net == NULL) {
+			fprintf(stderr, "out of memory\n");
+			ok = 0;
+			break;
+		}
+		net->index = j;
+		state->nets[j++] = net;
+		net->weight = weight;
+		while (!at_end(c)) {
+			parse_long(&c, &value);
+			sa_add_vertex_to_net(state, net,
+			                     state->vertices[(*vertex_indices)[value]]);
+		}
+	}
+	
+	// Place the fixed vertices
+	for (i = 0, j = 0; ok && i < file->num_lines; i++) {
+		c = file->lines[i];
+		if (!accept_keyword(&c, "vertex"))
+			continue;
+		for (r = 0; r < (size_t)num_resources; r++)
+			parse_long(&c, &value);
+		if (accept_keyword(&c, "fixed")) {
+			parse_long(&c, &x);
+			parse_long(&c, &y);
+			vertex = state->vertices[(*vertex_indices)[j]];
+			sa_add_vertex_to_chip(state, vertex, x, y, 0);
+			if (!sa_positive_resources(state, sa_get_chip_resources_ptr(state, x, y))) {
+				parse_error(file, i, "fixed vertex does not fit on its chip");
+				ok = 0;
+			}
+		}
+		j++;
+	}
+	
+	free(num_vertex_nets);
+	free(resources);
+	
+	if (!ok) {
+		// Vertices and nets not yet created are NULL (which sa_free accepts)
+		if (state)
+			sa_free(state);
+		free(*vertex_indices);
+		*vertex_indices = NULL;
+		return NULL;
+	}
+	
+	return state;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Annealing
+////////////////////////////////////////////////////////////////////////////////
+
+// Set by SIGINT to stop annealing early.
+static volatile sig_atomic_t interrupted = 0;
+
+static void handle_interrupt(int signal_number) {
+	(void)signal_number;
+	interrupted = 1;
+}
+
+static int max_distance(const sa_state_t *state) {
+	return (int)((state->width > state->height) ? state->width : state->height);
+}
+
+/**
+ * Choose an initial temperature by annealing at infinite temperature (as in
+ * Rig's Python kernel driver). Note that this scrambles the placement.
+ */
+static double choose_temperature(sa_state_t *state, size_t num_steps) {
+	size_t num_accepted;
+	double cost_delta;
+	double cost_delta_sd;
+	
+	sa_run_steps(state, num_steps, max_distance(state), 1e50,
+	             &num_accepted, &cost_delta, &cost_delta_sd);
+	return SA_PLACE_INITIAL_TEMPERATURE_RATIO * cost_delta_sd;
+}
+
+/**
+ * Anneal the placement following the same schedule as Rig's Python kernel
+ * driver: the temperature is reduced geometrically and the distance limit is
+ * adjusted to keep the acceptance rate near SA_PLACE_TARGET_ACCEPT_RATE until
+ * the cost is no longer changing significantly, time_limit seconds (if not
+ * negative) have passed or SIGINT is received.
+ */
+static void anneal(sa_state_t *state, size_t num_steps, double temperature,
+                   double alpha, double effort, double time_limit, int verbose) {
+	int distance_limit = max_distance(state);
+	double deadline = sa_get_time() + time_limit;
+	double remaining = time_limit;
+	sa_run_status_t status;
+	size_t num_steps_done;
+	size_t num_accepted;
+	double cost_delta;
+	double cost_delta_sd;
+	double cost = sa_get_total_cost(state);
+	double accept_rate;
+	size_t iteration = 0;
+	
+	while (temperature > 0.0) {
+		if (time_limit >= 0.0) {
+			remaining = deadline - sa_get_time();
+			if (remaining < 0.0)
+				remaining = 0.0;
+		}
+		status = sa_run_steps_until(state, num_steps, distance_limit, temperature,
+		                            remaining, &interrupted, &num_steps_done,
+		                            &num_accepted, &cost_delta, &cost_delta_sd);
+		cost += cost_delta;
+		iteration++;
+		
+		if (verbose)
+			fprintf(stderr, "%lu: temperature %g, distance %d, accepted %lu, cost %g\n",
+			        (unsigned long)iteration, temperature, distance_limit,
+			        (unsigned long)num_accepted, cost);
+		
+		// Stop when out of time or interrupted
+		if (status != SA_RUN_FINISHED) {
+			if (verbose)
+				fprintf(stderr, "%s after %lu steps\n",
+				        (status == SA_RUN_TIMED_OUT) ? "timed out" : "interrupted",
+				        (unsigned long)num_steps_done);
+			break;
+		}
+		
+		// Stop once the cost has settled down
+		if (state->num_nets == 0 ||
+		    cost_delta_sd <= effort * cost / state->num_nets)
+			break;
+		
+		// Keep the acceptance rate near the target
+		accept_rate = (double)num_accepted / (double)num_steps;
+		distance_limit = (int)(distance_limit *
+		                       (1.0 - SA_PLACE_TARGET_ACCEPT_RATE + accept_rate) + 0.5);
+		if (distance_limit < 1)
+			distance_limit = 1;
+		if (distance_limit > max_distance(state))
+			distance_limit = max_distance(state);
+		
+		temperature *= alpha;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Main
+////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char *argv[]) {
+	int i;
+	size_t v;
+	size_t num_nets;
+	unsigned long seed = 0;
+	int quadratic = 0;
+	int verbose = 0;
+	long num_levels = 1;
+	long num_steps = 0;
+	long frozen_fanout = 0;
+	double temperature = -1.0;
+	double alpha = 0.95;
+	double effort = 0.001;
+	double time_limit = -1.0;
+	sa_cost_model_t cost_model = SA_COST_MODEL_HPWL;
+	const char *problem_filename = NULL;
+	const char *placements_filename = NULL;
+	const char *arg;
+	problem_file_t file;
+	size_t *vertex_indices;
+	sa_state_t *state;
+	sa_vertex_t *vertex;
+	FILE *out;
+	int placed;
+	
+	// Parse the arguments
+	for (i = 1; i < argc; i++) {
+		arg = argv[i];
+		if (arg[0] == '-' && arg[1] != '\0' && arg[2] == '\0' &&
+		    strchr("smntaelTF", arg[1]) != NULL) {
+			if (i + 1 >= argc) {
+				usage(argv[0]);
+				return 1;
+			}
+			switch (arg[1]) {
+				case 's': seed = strtoul(argv[++i], NULL, 10); break;
+				case 'n': num_steps = strtol(argv[++i], NULL, 10); break;
+				case 't': temperature = strtod(argv[++i], NULL); break;
+				case 'a': alpha = strtod(argv[++i], NULL); break;
+				case 'e': effort = strtod(argv[++i], NULL); break;
+				case 'l': num_levels = strtol(argv[++i], NULL, 10); break;
+				case 'T': time_limit = strtod(argv[++i], NULL); break;
+				case 'F': frozen_fanout = strtol(argv[++i], NULL, 10); break;
+				case 'm':
+					arg = argv[++i];
+					if (strcmp(arg, "hpwl") == 0) {
+						cost_model = SA_COST_MODEL_HPWL;
+					} else if (strcmp(arg, "clique") == 0) {
+						cost_model = SA_COST_MODEL_CLIQUE;
+					} else if (strcmp(arg, "star") == 0) {
+						cost_model = SA_COST_MODEL_STAR;
+					} else if (strcmp(arg, "hex_star") == 0) {
+						cost_model = SA_COST_MODEL_HEX_STAR;
+					} else {
+						fprintf(stderr, "unknown cost model '%s'\n", arg);
+						return 1;
+					}
+					break;
+			}
+		} else if (strcmp(arg, "-q") == 0) {
+			quadratic = 1;
+		} else if (strcmp(arg, "-v") == 0) {
+			verbose = 1;
+		} else if (strcmp(arg, "-h") == 0 || arg[0] == '-') {
+			usage(argv[0]);
+			return 1;
+		} else if (problem_filename == NULL) {
+			problem_filename = arg;
+		} else if (placements_filename == NULL) {
+			placements_filename = arg;
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (problem_filename == NULL || alpha <= 0.0 || alpha >= 1.0 ||
+	    num_steps < 0 || num_levels < 1) {
+		usage(argv[0]);
+		return 1;
+	}
+	
+	// Load the problem
+	if (!read_problem_file(problem_filename, &file)) {
+		fprintf(stderr, "could not read '%s'\n", problem_filename);
+		free_problem_file(&file);
+		return 1;
+	}
+	state = parse_problem(&file, &vertex_indices);
+	free_problem_file(&file);
+	if (state == NULL)
+		return 1;
+	state->cost_model = cost_model;
+	state->frozen_net_min_fanout = (frozen_fanout > 0) ? (size_t)frozen_fanout : 0;
+	srand((unsigned int)seed);
+	
+	// Duplicate and single-vertex nets only slow annealing down (if memory
+	// runs out they are simply kept)
+	num_nets = state->num_nets;
+	if (sa_merge_nets(state, NULL) && verbose)
+		fprintf(stderr, "merged %lu nets into %lu\n", (unsigned long)num_nets,
+		        (unsigned long)state->num_nets);
+	if (num_steps == 0)
+		num_steps = 10 * (long)state->num_movable_vertices;
+	
+	// Place
+	if (quadratic)
+		placed = sa_place_quadratic(state, 1000);
+	else
+		placed = sa_place_initial(state);
+	if (!placed) {
+		fprintf(stderr, "the vertices do not fit on the machine\n");
+		sa_free(state);
+		free(vertex_indices);
+		return 2;
+	}
+	sa_prepare(state);
+	if (verbose)
+		fprintf(stderr, "initial cost %g\n", sa_get_total_cost(state));
+	
+	// Anneal
+	if (temperature < 0.0)
+		temperature = choose_temperature(state, num_steps);
+	if (num_levels > 1) {
+		if (!sa_run_multilevel(state, num_levels, num_steps, max_distance(state),
+		                       temperature, 0.0))
+			fprintf(stderr, "out of memory: placement may not be fully annealed\n");
+	} else {
+		signal(SIGINT, handle_interrupt);
+		anneal(state, num_steps, temperature, alpha, effort, time_limit, verbose);
+		signal(SIGINT, SIG_DFL);
+	}
+	if (verbose)
+		fprintf(stderr, "final cost %g\n", sa_get_total_cost(state));
+	
+	// Write the placements
+	out = placements_filename ? fopen(placements_filename, "w") : stdout;
+	if (out == NULL) {
+		fprintf(stderr, "could not write '%s'\n", placements_filename);
+		sa_free(state);
+		free(vertex_indices);
+		return 1;
+	}
+	for (v = 0; v < state->num_vertices; v++) {
+		vertex = state->vertices[vertex_indices[v]];
+		fprintf(out, "%lu %d %d\n", (unsigned long)v, vertex->x, vertex->y);
+	}
+	if (placements_filename)
+		fclose(out);
+	
+	sa_free(state);
+	free(vertex_indices);
+	
+	return 0;
+}
@@ -12,24 +12,25 @@ ffi = FFI()
 
 source_dir = os.path.dirname(__file__)
 
+# Set RIG_C_SA_COMPACT when building to use the compact representation of
+# vertices and nets (see SA_COMPACT in sa.h). Note that vertices and nets must
+# then be stored in the state before vertices are added to nets.
+compact = bool(os.environ.get("RIG_C_SA_COMPACT"))
+
 ffi.set_source(
     "_rig_c_sa",
     """
         #include <stdlib.h>
         #include "sa.h"
-        
-        double sa_get_total_cost(sa_state_t *state) {
-            size_t i;
-            double total = 0.0;
-            for (i = 0; i < state->num_nets; i++)
-                total += sa_get_net_cost(state, state->nets[i]);
-            return total;
-        }
     """,
-    libraries=[] if platform.system() == "Windows" else ["m"],
+    libraries=[] if platform.system() == "Windows" else ["m", "pthread"],
     sources=[os.path.join(source_dir, "sa.c")],
     include_dirs=[source_dir],
-    extra_compile_args=[] if platform.system() == "Windows" else ["-O3"],
+    extra_compile_args=({"Windows": [],
+                         "Linux": ["-O3", "-fopenmp"]}
+                        .get(platform.system(), ["-O3"])),
+    extra_link_args=["-fopenmp"] if platform.system() == "Linux" else [],
+    define_macros=[("SA_COMPACT", None)] if compact else [],
 )
 
 ffi.cdef("""
@@ -42,28 +43,110 @@ ffi.cdef("""
     // Datastructures
     typedef struct sa_net sa_net_t;
     typedef struct sa_vertex sa_vertex_t;
+    typedef int... sa_coord_t;
+    typedef int... sa_count_t;
+    typedef int... sig_atomic_t;
+    typedef enum sa_cost_model {
+        SA_COST_MODEL_HPWL = 0,
+        SA_COST_MODEL_CLIQUE = 1,
+        SA_COST_MODEL_STAR = 2,
+        SA_COST_MODEL_HEX_STAR = 3,
+        SA_COST_MODEL_CUSTOM = 4
+    } sa_cost_model_t;
+    typedef enum sa_move_type {
+        SA_MOVE_VERTEX = 0,
+        SA_MOVE_CHIP_SWAP = 1,
+        SA_MOVE_SHIFT = 2,
+        SA_MOVE_CLUSTER = 3
+    } sa_move_type_t;
+    typedef enum sa_vertex_selection {
+        SA_VERTEX_SELECTION_UNIFORM = 0,
+        SA_VERTEX_SELECTION_COST_WEIGHTED = 1
+    } sa_vertex_selection_t;
+    typedef enum sa_alloc_policy {
+        SA_ALLOC_DEFAULT = 0,
+        SA_ALLOC_HUGE_PAGES = 1,
+        SA_ALLOC_NUMA_INTERLEAVE = 2
+    } sa_alloc_policy_t;
+    typedef enum sa_run_status {
+        SA_RUN_FINISHED = 0,
+        SA_RUN_TIMED_OUT = 1,
+        SA_RUN_CANCELLED = 2
+    } sa_run_status_t;
+    typedef enum sa_rng {
+        SA_RNG_RAND = 0,
+        SA_RNG_PHILOX = 1
+    } sa_rng_t;
+    typedef struct sa_progress {
+        double temperature;
+        double cost;
+        double accept_rate;
+        unsigned long long num_steps;
+        sa_bool_t running;
+    } sa_progress_t;
+    typedef struct sa_anneal sa_anneal_t;
+    #define SA_NUM_MOVE_TYPES 4
+    typedef struct sa_trace_entry {
+        unsigned long long step;
+        double delta;
+        sa_count_t vertex;
+        sa_coord_t from_x;
+        sa_coord_t from_y;
+        sa_coord_t to_x;
+        sa_coord_t to_y;
+    } sa_trace_entry_t;
+    typedef struct sa_placement {
+        sa_count_t vertex;
+        sa_coord_t x;
+        sa_coord_t y;
+    } sa_placement_t;
     struct sa_net {
         double weight;
+        sa_count_t index;
         ...;
     };
     struct sa_vertex {
-        int x;
-        int y;
+        sa_coord_t x;
+        sa_coord_t y;
         int *vertex_resources;
+        sa_count_t index;
         ...;
     };
     typedef struct sa_state {
         sa_bool_t has_wrap_around_links;
+        sa_cost_model_t cost_model;
         sa_net_t **nets;
         size_t num_movable_vertices;
         sa_vertex_t **vertices;
+        size_t net_histogram_min_fanout;
+        size_t frozen_net_min_fanout;
+        size_t frozen_net_resync_interval;
+        double congestion_weight;
+        double link_capacity;
+        double move_weights[SA_NUM_MOVE_TYPES];
+        size_t num_moves_proposed[SA_NUM_MOVE_TYPES];
+        size_t num_moves_accepted[SA_NUM_MOVE_TYPES];
+        sa_vertex_selection_t vertex_selection;
+        sa_rng_t rng;
+        unsigned long long rng_seed;
+        unsigned int rng_stream;
+        unsigned long long rng_step;
+        size_t num_threads;
+        size_t check_interval;
+        size_t trace_dropped;
         ...;
     } sa_state_t;
     
     // Constructors/distructors
     sa_state_t *sa_new(size_t width, size_t height, size_t num_resource_types,
                        size_t num_vertices, size_t num_nets);
+    sa_state_t *sa_new_with_policy(size_t width, size_t height,
+                                   size_t num_resource_types,
+                                   size_t num_vertices, size_t num_nets,
+                                   sa_alloc_policy_t policy);
     sa_vertex_t *sa_new_vertex(const sa_state_t *state, size_t num_nets);
+    sa_vertex_t *sa_new_vertex_with_resources(const sa_state_t *state,
+                                              size_t num_nets, int *resources);
     sa_net_t *sa_new_net(const sa_state_t *state, size_t num_vertices);
     void sa_free(sa_state_t *state);
     
@@ -72,13 +155,46 @@ ffi.cdef("""
     void sa_add_vertex_to_chip(sa_state_t *state, sa_vertex_t *vertex, int x, int y, sa_bool_t movable);
     void sa_set_chip_resources(sa_state_t *state, size_t x, size_t y,
                                size_t resource, int value);
+    sa_bool_t sa_place_initial(sa_state_t *state);
+    sa_bool_t sa_place_quadratic(sa_state_t *state, size_t max_iterations);
+    sa_bool_t sa_prepare(sa_state_t *state);
+    #define SA_NET_REMOVED ...
+    sa_bool_t sa_merge_nets(sa_state_t *state, size_t *net_map);
+    void sa_set_rng_step(sa_state_t *state, unsigned long long step);
     
     // Algorithm kernel
     void sa_run_steps(sa_state_t *state, size_t num_steps, int distance_limit, double temperature,
                       size_t *num_accepted, double *cost_delta, double *cost_delta_sd);
+    sa_run_status_t sa_run_steps_until(sa_state_t *state, size_t num_steps,
+                                       int distance_limit, double temperature,
+                                       double time_limit,
+                                       volatile sig_atomic_t *cancel,
+                                       size_t *num_steps_done, size_t *num_accepted,
+                                       double *cost_delta, double *cost_delta_sd);
+    double sa_get_time(void);
+    
+    // Background annealing
+    sa_anneal_t *sa_start_anneal(sa_state_t *state, size_t num_steps,
+                                 int distance_limit, double temperature,
+                                 double alpha, double final_temperature);
+    void sa_get_anneal_progress(const sa_anneal_t *anneal, sa_progress_t *progress);
+    void sa_get_anneal_snapshot(sa_anneal_t *anneal, sa_placement_t *placements);
+    void sa_stop_anneal(sa_anneal_t *anneal);
+    void sa_join_anneal(sa_anneal_t *anneal, sa_progress_t *progress);
+    sa_bool_t sa_run_multilevel(sa_state_t *state, size_t num_levels,
+                                size_t num_steps, int distance_limit,
+                                double temperature, double refine_temperature);
+    sa_bool_t sa_set_trace(sa_state_t *state, size_t capacity);
+    size_t sa_read_trace(sa_state_t *state, sa_trace_entry_t *entries,
+                         size_t max_entries);
+    sa_bool_t sa_set_dirty_tracking(sa_state_t *state, sa_bool_t enable);
+    size_t sa_read_dirty_vertices(sa_state_t *state, sa_placement_t *placements,
+                                  size_t max_placements);
     
-    // Utility function
+    // Utility functions
     double sa_get_total_cost(sa_state_t *state);
+    double sa_get_total_cost_per_net(sa_state_t *state, double *net_costs);
+    double sa_get_congestion_cost(sa_state_t *state);
 """)
 
 if __name__ == "__main__":
@@ -3,14 +3,24 @@
  * in C.
  */
 
+// Required for mmap() flags and syscall()
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #include <stdlib.h>
 #include <stdio.h>
 
 #include <string.h>
 #include <assert.h>
+#include <limits.h>
 
 #include <math.h>
 
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
 #include "usort/u1_sort.c"
 
 #include "sa.h"
@@ -23,6 +33,152 @@
 #include <alloca.h>
 #endif
 
+// Monotonic clock and thread support...
+#if defined(_WIN32) || defined(WIN32)
+#define WIN32_LEAN_AND_MEAN
+// Condition variables (used for background annealing) require Windows Vista
+// or later.
+#if !defined(_WIN32_WINNT)
+#define _WIN32_WINNT 0x0600
+#endif
+#include <windows.h>
+#else
+#include <time.h>
+#include <pthread.h>
+#endif
+
+// Atomic access to (32-bit) words shared between threads (e.g. cancellation
+// flags)
+#if defined(_MSC_VER)
+#define SA_ATOMIC_LOAD(p) InterlockedCompareExchange((volatile LONG *)(p), 0, 0)
+#define SA_ATOMIC_STORE(p, v) InterlockedExchange((volatile LONG *)(p), (v))
+#elif defined(__GNUC__)
+#define SA_ATOMIC_LOAD(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define SA_ATOMIC_STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#else
+#define SA_ATOMIC_LOAD(p) (*(p))
+#define SA_ATOMIC_STORE(p, v) ((void)(*(p) = (v)))
+#endif
+
+// Huge page and NUMA support...
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Functions which are specialised for a particular cost model by inlining them
+// into callers which pass a constant model argument.
+#if defined(_MSC_VER)
+#define SA_SPECIALISED static __forceinline
+#elif defined(__GNUC__)
+#define SA_SPECIALISED static inline __attribute__((always_inline))
+#else
+#define SA_SPECIALISED static
+#endif
+
+// Functions which must remain real calls, e.g. so that memory they (or the
+// specialised functions inlined into them) allocate with alloca() is released
+// when they return.
+#if defined(_MSC_VER)
+#define SA_NOINLINE static __declspec(noinline)
+#elif defined(__GNUC__)
+#define SA_NOINLINE static __attribute__((noinline))
+#else
+#define SA_NOINLINE static
+#endif
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Array allocation
+////////////////////////////////////////////////////////////////////////////////
+
+// The size of a (default) huge page. Arrays smaller than this are always
+// allocated using calloc().
+#define SA_HUGE_PAGE_SIZE ((size_t)2 * 1024 * 1024)
+
+// The size of the header placed before every array allocated by
+// sa_alloc_array(). A multiple of the alignment of any type stored in arrays.
+#define SA_ARRAY_HEADER_SIZE 64
+
+// The NUMA memory policy mode which interleaves pages across nodes (from
+// linux/mempolicy.h).
+#define SA_MPOL_INTERLEAVE 3
+
+/**
+ * Allocate a zeroed array of the given size according to state->alloc_policy.
+ * The array must be freed using sa_free_array().
+ *
+ * The array is preceded by a header giving the size of the memory mapping
+ * holding it or zero if it was allocated with calloc().
+ */
+static void *sa_alloc_array(const sa_state_t *state, size_t size) {
+	char *block = NULL;
+	size_t mapped_size = 0;
+#if defined(__linux__)
+	unsigned long nodes = ~0ul;
+	
+	if (state->alloc_policy != SA_ALLOC_DEFAULT &&
+	    size + SA_ARRAY_HEADER_SIZE >= SA_HUGE_PAGE_SIZE) {
+		mapped_size = ((size + SA_ARRAY_HEADER_SIZE + SA_HUGE_PAGE_SIZE - 1)
+		               / SA_HUGE_PAGE_SIZE) * SA_HUGE_PAGE_SIZE;
+		
+		// Try explicit huge pages first, falling back on transparent huge pages
+		if (state->alloc_policy & SA_ALLOC_HUGE_PAGES) {
+			block = mmap(NULL, mapped_size, PROT_READ | PROT_WRITE,
+			             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+			if (block == MAP_FAILED)
+				block = NULL;
+		}
+		if (block == NULL) {
+			block = mmap(NULL, mapped_size, PROT_READ | PROT_WRITE,
+			             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (block == MAP_FAILED)
+				block = NULL;
+			else if (state->alloc_policy & SA_ALLOC_HUGE_PAGES)
+				madvise(block, mapped_size, MADV_HUGEPAGE);
+		}
+		
+		// Must be done before any page is touched. Nodes which don't exist are
+		// ignored by the kernel and failure leaves the default policy in place.
+		if (block != NULL && (state->alloc_policy & SA_ALLOC_NUMA_INTERLEAVE))
+			syscall(SYS_mbind, block, mapped_size, SA_MPOL_INTERLEAVE,
+			        &nodes, sizeof(nodes) * 8, 0);
+	}
+#else
+	(void) state;
+#endif
+	
+	if (block == NULL) {
+		mapped_size = 0;
+		block = calloc(1, size + SA_ARRAY_HEADER_SIZE);
+		if (block == NULL)
+			return NULL;
+	}
+	
+	*((size_t *)block) = mapped_size;
+	return block + SA_ARRAY_HEADER_SIZE;
+}
+
+/**
+ * Free an array allocated by sa_alloc_array(). Does nothing if array is NULL.
+ */
+static void sa_free_array(void *array) {
+	char *block;
+	
+	if (array == NULL)
+		return;
+	
+	block = (char *)array - SA_ARRAY_HEADER_SIZE;
+#if defined(__linux__)
+	if (*((size_t *)block) != 0) {
+		munmap(block, *((size_t *)block));
+		return;
+	}
+#endif
+	free(block);
+}
+
 
 ////////////////////////////////////////////////////////////////////////////////
 // Constructors & Destructors
@@ -30,6 +186,14 @@
 
 sa_state_t *sa_new(size_t width, size_t height, size_t num_resource_types,
                    size_t num_vertices, size_t num_nets) {
+	return sa_new_with_policy(width, height, num_resource_types,
+	                          num_vertices, num_nets, SA_ALLOC_DEFAULT);
+}
+
+sa_state_t *sa_new_with_policy(size_t width, size_t height,
+                               size_t num_resource_types,
+                               size_t num_vertices, size_t num_nets,
+                               sa_alloc_policy_t policy) {
 	size_t x, y, r, i;
 	sa_state_t *state;
 	
@@ -38,32 +202,100 @@ sa_state_t *sa_new(size_t width, size_t height, size_t num_resource_types,
 	assert(width > 1 || height > 1);
 	assert(num_resource_types >= 1);
 	assert(num_vertices >= 1);
+#if defined(SA_COMPACT)
+	assert(width <= 32767 && height <= 32767);
+	assert(num_vertices < SA_NO_REF && num_nets < SA_NO_REF);
+#endif
 	
 	// Allocate memory for main state object
 	state = malloc(sizeof(sa_state_t));
 	if (state == NULL)
 		return NULL;
 	
+	state->alloc_policy = policy;
+	
 	state->has_wrap_around_links = sa_false;
 	state->num_movable_vertices = 0;
 	
+	state->cost_model = SA_COST_MODEL_HPWL;
+	state->custom_net_cost = NULL;
+	state->custom_net_cost_data = NULL;
+	
+	state->net_histogram_min_fanout = 128;
+	
+	state->frozen_net_min_fanout = 0;
+	state->frozen_net_resync_interval = 1024;
+	state->num_frozen_nets = 0;
+	state->frozen_nets = NULL;
+	state->frozen_net_cost = 0.0;
+	state->has_net_histograms = sa_false;
+	state->distance_table = NULL;
+	
+	state->congestion_weight = 0.0;
+	state->link_capacity = 1.0;
+	state->link_usage = NULL;
+	state->congestion_cost = 0.0;
+	
+	state->fixed_net_cost = 0.0;
+	
+	state->vertex_selection = SA_VERTEX_SELECTION_UNIFORM;
+	state->vertex_weights = NULL;
+	state->vertex_weights_total = 0.0;
+	state->vertex_weight_floor = 0.0;
+	
+	state->live_chip_counts = NULL;
+	state->live_chip_columns = NULL;
+	
+	state->chip_capacities = NULL;
+	
+	state->visit = NULL;
+	
+	state->rng = SA_RNG_RAND;
+	state->rng_seed = 0;
+	state->rng_stream = 0;
+	state->rng_step = 0;
+	state->rng_block = 0;
+	state->rng_buffer_used = 4;
+	
+	state->num_threads = 0;
+	
+	state->check_interval = 256;
+	
+	state->trace = NULL;
+	state->trace_capacity = 0;
+	state->trace_start = 0;
+	state->trace_length = 0;
+	state->trace_dropped = 0;
+	
+	state->dirty_bitmap = NULL;
+	state->dirty_vertices = NULL;
+	state->num_dirty_vertices = 0;
+	
+	for (i = 0; i < SA_NUM_MOVE_TYPES; i++) {
+		state->move_weights[i] = (i == SA_MOVE_VERTEX) ? 1.0 : 0.0;
+		state->num_moves_proposed[i] = 0;
+		state->num_moves_accepted[i] = 0;
+	}
+	
 	// A simple machine with Cores and SDRAM
 	state->width = width;
 	state->height = height;
 	state->num_resource_types = num_resource_types;
 	
 	// Allocate memory for chip resource counters
-	state->chip_resources = calloc(state->width * state->height * state->num_resource_types, 
-	                               sizeof(int));
+	state->chip_resources = sa_alloc_array(state, state->width * state->height *
+	                                              state->num_resource_types *
+	                                              sizeof(int));
 	if (state->chip_resources == NULL) {
 		free(state);
 		return NULL;
 	}
 	
 	// Allocate memory for chip vertex LL heads
-	state->chip_vertices = calloc(state->width * state->height, sizeof(sa_vertex_t *));
+	state->chip_vertices = sa_alloc_array(state, state->width * state->height *
+	                                             sizeof(sa_vertex_t *));
 	if (state->chip_vertices == NULL) {
-		free(state->chip_resources);
+		sa_free_array(state->chip_resources);
 		free(state);
 		return NULL;
 	}
@@ -80,10 +312,11 @@ sa_state_t *sa_new(size_t width, size_t height, size_t num_resource_types,
 	
 	// Allocate memory for vertex pointers
 	state->num_vertices = num_vertices;
-	state->vertices = calloc(state->num_vertices, sizeof(sa_vertex_t *));
+	state->vertices = sa_alloc_array(state, state->num_vertices *
+	                                        sizeof(sa_vertex_t *));
 	if (state->vertices == NULL) {
-		free(state->chip_resources);
-		free(state->chip_vertices);
+		sa_free_array(state->chip_resources);
+		sa_free_array(state->chip_vertices);
 		free(state);
 		return NULL;
 	}
@@ -92,11 +325,11 @@ sa_state_t *sa_new(size_t width, size_t height, size_t num_resource_types,
 	
 	// Allocate memory for net pointers
 	state->num_nets = num_nets;
-	state->nets = calloc(state->num_nets, sizeof(sa_net_t *));
+	state->nets = sa_alloc_array(state, state->num_nets * sizeof(sa_net_t *));
 	if (state->nets == NULL) {
-		free(state->vertices);
-		free(state->chip_resources);
-		free(state->chip_vertices);
+		sa_free_array(state->vertices);
+		sa_free_array(state->chip_resources);
+		sa_free_array(state->chip_vertices);
 		free(state);
 		return NULL;
 	}
@@ -117,46 +350,68 @@ void sa_free(sa_state_t *state) {
 	for (v = 0; v < state->num_vertices; v++)
 		sa_free_vertex(state->vertices[v]);
 	
-	free(state->vertices);
-	free(state->nets);
-	free(state->chip_vertices);
-	free(state->chip_resources);
+	sa_free_array(state->distance_table);
+	sa_free_array(state->link_usage);
+	sa_free_array(state->frozen_nets);
+	sa_free_array(state->vertex_weights);
+	sa_free_array(state->live_chip_counts);
+	sa_free_array(state->live_chip_columns);
+	sa_free_array(state->chip_capacities);
+	sa_free_visit(state->visit);
+	sa_free_array(state->trace);
+	sa_free_array(state->dirty_bitmap);
+	sa_free_array(state->dirty_vertices);
+	sa_free_array(state->vertices);
+	sa_free_array(state->nets);
+	sa_free_array(state->chip_vertices);
+	sa_free_array(state->chip_resources);
 	free(state);
 }
 
 sa_vertex_t *sa_new_vertex(const sa_state_t *state, size_t num_nets) {
+	return sa_new_vertex_with_resources(state, num_nets, NULL);
+}
+
+sa_vertex_t *sa_new_vertex_with_resources(const sa_state_t *state,
+                                          size_t num_nets, int *resources) {
 	size_t i;
 	sa_vertex_t *vertex;
 	
-	// Allocate the array of resources
-	int *resources = calloc(state->num_resource_types, sizeof(int));
-	if (resources == NULL)
-		return NULL;
+	// Unless a shared resource array is given, the vertex's own resources are
+	// allocated along with it, after its array of nets.
+	size_t size = sizeof(sa_vertex_t) + (sizeof(sa_net_ref_t) * num_nets);
+	size = ((size + sizeof(int) - 1) / sizeof(int)) * sizeof(int);
 	
-	// Allocate the vertex itself
-	vertex = malloc( sizeof(sa_vertex_t)
-	                              + (sizeof(sa_net_t *) * num_nets));
-	if (vertex == NULL) {
-		free(resources);
+	vertex = malloc(size + (resources ? 0
+	                                  : sizeof(int) * state->num_resource_types));
+	if (vertex == NULL)
 		return NULL;
+	
+	if (resources == NULL) {
+		resources = (int *)((char *)vertex + size);
+		for (i = 0; i < state->num_resource_types; i++)
+			resources[i] = 0;
 	}
 	
 	vertex->vertex_resources = resources;
-	vertex->num_nets = num_nets;
+	vertex->num_nets = (sa_count_t)num_nets;
+	vertex->index = 0;
+	
+	// The vertex is not on any chip until sa_add_vertex_to_chip() is called.
+	// sa_set_vertex_position() relies on this to detect the first placement.
+	vertex->x = -1;
+	vertex->y = -1;
 	
 	// Keep valgrind happy...
 	vertex->next = NULL;
 	for (i = 0; i < num_nets; i++)
-		vertex->nets[i] = NULL;
+		vertex->nets[i] = SA_NO_REF;
 	
 	return vertex;
 }
 
 void sa_free_vertex(sa_vertex_t *vertex) {
-	if (!vertex)
-		return;
-	
-	free(vertex->vertex_resources);
+	// The vertex's resources are either part of the same allocation or shared
 	free(vertex);
 }
 
@@ -169,16 +424,24 @@ sa_net_t *sa_new_net(const sa_state_t *state, size_t num_vertices) {
 	sa_net_t *net;
 	(void) state;
 	
-	net = malloc(sizeof(sa_net_t) + (sizeof(sa_vertex_t *) * num_vertices));
+	net = malloc(sizeof(sa_net_t) + (sizeof(sa_vertex_ref_t) * num_vertices));
 	if (net == NULL)
 		return NULL;
 	
-	net->num_vertices = num_vertices;
+	net->num_vertices = (sa_count_t)num_vertices;
 	net->counted = sa_false;
+	net->histogram = NULL;
+	net->num_fixed_vertices = 0;
+	net->fixed_coords = NULL;
+	net->num_fixed_xs = 0;
+	net->num_fixed_ys = 0;
+	net->frozen = sa_false;
+	net->cost = 0.0;
+	net->index = 0;
 	
 	// Keep valgrind happy
 	for (i = 0; i < num_vertices; i++)
-		net->vertices[i] = NULL;
+		net->vertices[i] = SA_NO_REF;
 	
 	return net;
 }
@@ -187,511 +450,4764 @@ void sa_free_net(sa_net_t *net) {
 	if (!net)
 		return;
 	
+	free(net->histogram);
+	free(net->fixed_coords);
 	free(net);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-// General data structure manipulation functions
+// Random number generation
 ////////////////////////////////////////////////////////////////////////////////
 
-int *sa_get_chip_resources_ptr(sa_state_t *state, size_t x, size_t y) {
-	return state->chip_resources + (
-		(y * state->width * state->num_resource_types)
-		+ (x * state->num_resource_types)
-	);
+// The round multipliers and key schedule constants of Philox4x32.
+#define SA_PHILOX_M0 0xD2511F53u
+#define SA_PHILOX_M1 0xCD9E8D57u
+#define SA_PHILOX_W0 0x9E3779B9u
+#define SA_PHILOX_W1 0xBB67AE85u
+#define SA_PHILOX_ROUNDS 10
+
+void sa_philox(const unsigned int counter[4], const unsigned int key[2],
+               unsigned int out[4]) {
+	unsigned long long p0, p1;
+	unsigned int c0 = counter[0];
+	unsigned int c1 = counter[1];
+	unsigned int c2 = counter[2];
+	unsigned int c3 = counter[3];
+	unsigned int k0 = key[0];
+	unsigned int k1 = key[1];
+	int i;
+	
+	for (i = 0; i < SA_PHILOX_ROUNDS; i++) {
+		p0 = (unsigned long long)SA_PHILOX_M0 * c0;
+		p1 = (unsigned long long)SA_PHILOX_M1 * c2;
+		c0 = (unsigned int)(p1 >> 32) ^ c1 ^ k0;
+		c1 = (unsigned int)p1;
+		c2 = (unsigned int)(p0 >> 32) ^ c3 ^ k1;
+		c3 = (unsigned int)p0;
+		k0 += SA_PHILOX_W0;
+		k1 += SA_PHILOX_W1;
+	}
+	
+	out[0] = c0;
+	out[1] = c1;
+	out[2] = c2;
+	out[3] = c3;
 }
 
-int sa_get_chip_resources(sa_state_t *state, size_t x, size_t y, size_t resource) {
-	return sa_get_chip_resources_ptr(state, x, y)[resource];
+/**
+ * Draw the next 32-bit word for the current step from the Philox generator.
+ */
+static unsigned int sa_random_word(sa_state_t *state) {
+	unsigned int counter[4];
+	unsigned int key[2];
+	
+	if (state->rng_buffer_used >= 4) {
+		counter[0] = state->rng_block++;
+		counter[1] = state->rng_stream;
+		counter[2] = (unsigned int)state->rng_step;
+		counter[3] = (unsigned int)(state->rng_step >> 32);
+		key[0] = (unsigned int)state->rng_seed;
+		key[1] = (unsigned int)(state->rng_seed >> 32);
+		sa_philox(counter, key, state->rng_buffer);
+		state->rng_buffer_used = 0;
+	}
+	
+	return state->rng_buffer[state->rng_buffer_used++];
 }
 
-void sa_set_chip_resources(sa_state_t *state, size_t x, size_t y, size_t resource, int value) {
-	sa_get_chip_resources_ptr(state, x, y)[resource] = value;
+/**
+ * Draw a random integer in the range [0, n).
+ */
+static int sa_random_int(sa_state_t *state, int n) {
+	if (state->rng == SA_RNG_PHILOX)
+		return (int)(sa_random_word(state) % (unsigned int)n);
+	else
+		return rand() % n;
 }
 
-sa_vertex_t *sa_get_chip_vertex(sa_state_t *state, size_t x, size_t y) {
-	return state->chip_vertices[(y * state->width) + x];
+/**
+ * Draw a random real number in the range [0, 1].
+ */
+static double sa_random_double(sa_state_t *state) {
+	if (state->rng == SA_RNG_PHILOX)
+		return sa_random_word(state) / 4294967295.0;
+	else
+		return (double)rand() / RAND_MAX;
 }
 
-void sa_set_chip_vertex(sa_state_t *state, size_t x, size_t y, sa_vertex_t *vertex) {
-	 state->chip_vertices[(y * state->width) + x] = vertex;
+void sa_set_rng_step(sa_state_t *state, unsigned long long step) {
+	state->rng_step = step;
+	state->rng_block = 0;
+	state->rng_buffer_used = 4;
 }
 
-void sa_subtract_resources(const sa_state_t *state, int *a, const int *b) {
-	size_t i;
-	for (i = 0; i < state->num_resource_types; i++)
-		a[i] -= b[i];
+
+////////////////////////////////////////////////////////////////////////////////
+// Net position histograms
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * The number of leaves of the gap tree (see sa_axis_histogram_t) for an axis
+ * of n columns: the next power of two of at least n (and at least 2).
+ */
+static int sa_axis_histogram_num_leaves(size_t n) {
+	int num_leaves = 2;
+	while ((size_t)num_leaves < n)
+		num_leaves *= 2;
+	return num_leaves;
 }
 
-void sa_add_resources(const sa_state_t *state, int *a, const int *b) {
-	size_t i;
-	for (i = 0; i < state->num_resource_types; i++)
-		a[i] += b[i];
+/**
+ * Allocate a new, empty, net histogram. Returns NULL on failure. Should be
+ * freed with free().
+ */
+static sa_net_histogram_t *sa_new_net_histogram(const sa_state_t *state) {
+	sa_net_histogram_t *histogram;
+	int x_leaves = sa_axis_histogram_num_leaves(state->width);
+	int y_leaves = sa_axis_histogram_num_leaves(state->height);
+	
+	// The counts arrays and gap trees are allocated in the same block as the
+	// histogram
+	histogram = calloc(1, sizeof(sa_net_histogram_t)
+	                      + (sizeof(int) * (state->width + state->height))
+	                      + (sizeof(int) * 2 * (x_leaves + y_leaves)));
+	if (histogram == NULL)
+		return NULL;
+	
+	histogram->x.counts = (int *)(histogram + 1);
+	histogram->y.counts = histogram->x.counts + state->width;
+	histogram->x.gaps = histogram->y.counts + state->height;
+	histogram->y.gaps = histogram->x.gaps + (2 * x_leaves);
+	histogram->x.num_leaves = x_leaves;
+	histogram->y.num_leaves = y_leaves;
+	
+	histogram->x.min = (int)state->width;
+	histogram->x.max = -1;
+	histogram->y.min = (int)state->height;
+	histogram->y.max = -1;
+	
+	return histogram;
 }
 
-sa_bool_t sa_positive_resources(const sa_state_t *state, const int *a) {
-	size_t i;
-	for (i = 0; i < state->num_resource_types; i++)
-		if (a[i] < 0)
-			return sa_false;
-	return sa_true;
+/**
+ * Set the leaf of column c in the gap tree of an axis histogram, updating its
+ * ancestors. O(log n).
+ */
+static void sa_axis_histogram_set_gap(sa_axis_histogram_t *axis, int c,
+                                      int length) {
+	int *gaps = axis->gaps;
+	int i = axis->num_leaves + c;
+	
+	gaps[i] = length;
+	for (i /= 2; i >= 1; i /= 2)
+		gaps[i] = (gaps[2 * i] > gaps[(2 * i) + 1]) ? gaps[2 * i]
+		                                             : gaps[(2 * i) + 1];
 }
 
-void sa_add_vertex_to_chip(sa_state_t *state, sa_vertex_t *vertex, int x, int y, sa_bool_t movable) {
-	vertex->x = x;
-	vertex->y = y;
+/**
+ * Find the first occupied column at or after column c (which may be one past
+ * the last column), or -1 if there is none. O(log n).
+ */
+static int sa_axis_histogram_next(const sa_axis_histogram_t *axis, int c) {
+	const int *gaps = axis->gaps;
+	int i = axis->num_leaves + c;
 	
-	// Insert the vertex into the LL of movable vertices on the target chip
-	if (movable) {
-		assert(vertex->next == NULL);
-		vertex->next = sa_get_chip_vertex(state, x, y);
-		sa_set_chip_vertex(state, x, y, vertex);
+	if (c >= axis->num_leaves)
+		return -1;
+	
+	// Climb until a subtree to the right holds an occupied column...
+	if (!gaps[i]) {
+		while (!((i % 2) == 0 && gaps[i + 1])) {
+			i /= 2;
+			if (i == 1)
+				return -1;
+		}
+		i++;
 	}
 	
-	// Subtract the resources consumed from those available on the chip
-	sa_subtract_resources(state,
-	                      sa_get_chip_resources_ptr(state, x, y),
-	                      vertex->vertex_resources);
+	// ...and descend to its leftmost one.
+	while (i < axis->num_leaves)
+		i = gaps[2 * i] ? (2 * i) : ((2 * i) + 1);
+	return i - axis->num_leaves;
 }
 
-void sa_add_vertices_to_chip(sa_state_t *state, sa_vertex_t *vertices, int x, int y) {
-	while (vertices != NULL) {
-		// Detatch the head of list
-		sa_vertex_t *vertex = vertices;
-		vertices = vertex->next;
-		vertex->next = NULL;
-		
-		// Add it to the chip
-		sa_add_vertex_to_chip(state, vertex, x, y, sa_true);
+/**
+ * Find the last occupied column at or before column c (which may be -1), or
+ * -1 if there is none. O(log n).
+ */
+static int sa_axis_histogram_prev(const sa_axis_histogram_t *axis, int c) {
+	const int *gaps = axis->gaps;
+	int i = axis->num_leaves + c;
+	
+	if (c < 0)
+		return -1;
+	
+	// Climb until a subtree to the left holds an occupied column...
+	if (!gaps[i]) {
+		while (!((i % 2) == 1 && gaps[i - 1])) {
+			i /= 2;
+			if (i == 1)
+				return -1;
+		}
+		i--;
 	}
+	
+	// ...and descend to its rightmost one.
+	while (i < axis->num_leaves)
+		i = gaps[(2 * i) + 1] ? ((2 * i) + 1) : (2 * i);
+	return i - axis->num_leaves;
 }
 
-sa_bool_t sa_add_vertices_to_chip_if_fit(sa_state_t *state, sa_vertex_t *vertices, int x, int y) {
-	int *resources_available = alloca(sizeof(int) * state->num_resource_types);
-	sa_vertex_t *v;
-	
-	memcpy(resources_available, sa_get_chip_resources_ptr(state, x, y),
-	       sizeof(int) * state->num_resource_types);
+/**
+ * Find the occupied columns either side of column c (cyclically, skipping c
+ * itself). At least one other column must be occupied. O(log n).
+ */
+static void sa_axis_histogram_neighbours(const sa_axis_histogram_t *axis,
+                                         int n, int c, int *prev, int *next) {
+	*prev = sa_axis_histogram_prev(axis, c - 1);
+	if (*prev < 0)
+		*prev = sa_axis_histogram_prev(axis, n - 1);
+	*next = sa_axis_histogram_next(axis, c + 1);
+	if (*next < 0)
+		*next = sa_axis_histogram_next(axis, 0);
+}
+
+/**
+ * Record a vertex in column c of an axis histogram. O(1) unless the column
+ * becomes occupied, then O(log n).
+ */
+static void sa_axis_histogram_add(sa_axis_histogram_t *axis, int n,
+                                  sa_bool_t wrap, int c) {
+	int prev, next;
 	
-	v = vertices;
-	while (v) {
-		// Update the coordinates of the vertex as we pass. If we don't actually
-		// end up adding the vertex to the chip, this change has no meaningful
-		// effect.
-		v->x = x;
-		v->y = y;
-		
-		sa_subtract_resources(state, resources_available, v->vertex_resources);
-		
-		// Leave v pointing at the last vertex
-		if (v->next == NULL)
-			break;
-		else
-			v = v->next;
-	}
+	if (axis->counts[c]++ > 0)
+		return;
 	
-	if (sa_positive_resources(state, resources_available)) {
-		// The vertices fit, insert them
-		if (vertices) {
-			v->next = sa_get_chip_vertex(state, x, y);
-			sa_set_chip_vertex(state, x, y, vertices);
-			
-			// And update the resource consumption
-			memcpy(sa_get_chip_resources_ptr(state, x, y), resources_available,
-			       sizeof(int) * state->num_resource_types);
+	// The column has just become occupied
+	if (wrap) {
+		if (axis->gaps[1] == 0) {
+			// The only occupied column: the gap wraps all the way around
+			sa_axis_histogram_set_gap(axis, c, n);
+		} else {
+			// The column splits the gap it falls within in two
+			sa_axis_histogram_neighbours(axis, n, c, &prev, &next);
+			sa_axis_histogram_set_gap(axis, prev, (c - prev + n) % n);
+			sa_axis_histogram_set_gap(axis, c, (next - c + n) % n);
 		}
-		return sa_true;
 	} else {
-		// The vertices didn't fit, just stop now
-		return sa_false;
+		sa_axis_histogram_set_gap(axis, c, 1);
+		if (c < axis->min)
+			axis->min = c;
+		if (c > axis->max)
+			axis->max = c;
 	}
 }
 
-void sa_remove_vertex_from_chip(sa_state_t *state, sa_vertex_t *vertex) {
-	sa_vertex_t *head = sa_get_chip_vertex(state, vertex->x, vertex->y);
-	sa_vertex_t **next_ptr = &head;
-	
-	// Search through the linked-list for the vertex to remove
-	while (*next_ptr != vertex) {
-		assert((*next_ptr)->next != NULL);  // The vertex *must* be present!
-		next_ptr = &((*next_ptr)->next);
-	}
-	
-	// Remove it
-	*next_ptr = vertex->next;
-	vertex->next = NULL;
+/**
+ * Remove a vertex from column c of an axis histogram. At least one other
+ * vertex must remain in the histogram. O(1) unless the column becomes empty,
+ * then O(log n).
+ */
+static void sa_axis_histogram_remove(sa_axis_histogram_t *axis, int n,
+                                     sa_bool_t wrap, int c) {
+	int prev, next, length;
 	
-	sa_set_chip_vertex(state, vertex->x, vertex->y, head);
+	assert(axis->counts[c] > 0);
+	if (--axis->counts[c] > 0)
+		return;
 	
-	// Account for the resources now freed up
-	sa_add_resources(state,
-	                 sa_get_chip_resources_ptr(state, vertex->x, vertex->y),
-	                 vertex->vertex_resources);
+	// The column has just become empty
+	sa_axis_histogram_set_gap(axis, c, 0);
+	if (wrap) {
+		// The gaps either side of the column merge
+		sa_axis_histogram_neighbours(axis, n, c, &prev, &next);
+		length = (next - prev + n) % n;
+		sa_axis_histogram_set_gap(axis, prev, length ? length : n);
+	} else {
+		if (c == axis->min)
+			axis->min = sa_axis_histogram_next(axis, c);
+		if (c == axis->max)
+			axis->max = sa_axis_histogram_prev(axis, c);
+	}
 }
 
-void sa_add_vertex_to_net(const sa_state_t *state, sa_net_t *net, sa_vertex_t *vertex) {
+/**
+ * Get the size of the minimal bounding interval of the vertices in an axis
+ * histogram. O(1).
+ */
+static int sa_axis_histogram_extent(sa_axis_histogram_t *axis, int n,
+                                    sa_bool_t wrap) {
+	if (wrap)
+		return n - axis->gaps[1];
+	else
+		return axis->max - axis->min;
+}
+
+/**
+ * Move a vertex within a net histogram. Vertices are added to their new
+ * position before being removed from the old one so that the histogram is
+ * never empty.
+ */
+static void sa_net_histogram_move(const sa_state_t *state,
+                                  sa_net_histogram_t *histogram,
+                                  int old_x, int old_y, int new_x, int new_y) {
+	if (old_x != new_x) {
+		sa_axis_histogram_add(&histogram->x, (int)state->width,
+		                      state->has_wrap_around_links, new_x);
+		sa_axis_histogram_remove(&histogram->x, (int)state->width,
+		                         state->has_wrap_around_links, old_x);
+	}
+	if (old_y != new_y) {
+		sa_axis_histogram_add(&histogram->y, (int)state->height,
+		                      state->has_wrap_around_links, new_y);
+		sa_axis_histogram_remove(&histogram->y, (int)state->height,
+		                         state->has_wrap_around_links, old_y);
+	}
+}
+
+/**
+ * Free all net histograms.
+ */
+static void sa_free_net_histograms(sa_state_t *state) {
 	size_t i;
-	(void) state;
 	
-	// Add vertex to net's list of vertices
-	for (i = 0; i < net->num_vertices; i++) {
-		if (net->vertices[i] == NULL) {
-			net->vertices[i] = vertex;
-			break;
-		}
+	for (i = 0; i < state->num_nets; i++) {
+		free(state->nets[i]->histogram);
+		state->nets[i]->histogram = NULL;
 	}
-	assert(i < net->num_vertices);
 	
-	// Add net to vertex's list of nets
-	for (i = 0; i < vertex->num_nets; i++) {
-		if (vertex->nets[i] == NULL) {
-			vertex->nets[i] = net;
-			break;
-		}
-	}
-	assert(i < vertex->num_nets);
+	state->has_net_histograms = sa_false;
 }
 
-sa_vertex_t *sa_get_random_movable_vertex(const sa_state_t *state) {
-	// TODO: Use a propper random scheme...
-	return state->vertices[rand() % state->num_movable_vertices];
+////////////////////////////////////////////////////////////////////////////////
+// Sorting
+////////////////////////////////////////////////////////////////////////////////
+
+int compar(const void *a, const void *b) {
+	return *((int *)a) - *((int *)b);
 }
 
-void sa_get_random_nearby_chip(const sa_state_t *state, int x, int y,
-                               int distance_limit,
-                               int *x_out, int *y_out) {
-	int x_min, y_min, x_max, y_max;
-	assert(distance_limit >= 1);
+void sort(const sa_state_t *state, int *array, size_t length) {
+  if (state->width <= 256 && state ->height <= 256) {
+    // If dimensions are always 8 bits or less (true for all real SpiNNaker
+    // machines), we use a fast sort algorithm.
+    u1_sort(array, length);
+  } else {
+    // ...if something odd is being done, we use a bog-standard qsort.
+    qsort(array, length, sizeof(int), &compar);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Non-movable net vertices
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Move the non-movable vertices of a net, other than its source, to the end of
+ * the net and record how many there are in net->num_fixed_vertices.
+ */
+static void sa_partition_net_vertices(const sa_state_t *state, sa_net_t *net) {
+	size_t i;
+	size_t num_movable = 1;
+	sa_vertex_ref_t ref;
+	
+	if (net->num_vertices == 0) {
+		net->num_fixed_vertices = 0;
+		return;
+	}
+	
+	for (i = 1; i < net->num_vertices; i++) {
+		if (SA_NET_VERTEX(state, net, i)->index < state->num_movable_vertices) {
+			ref = net->vertices[i];
+			net->vertices[i] = net->vertices[num_movable];
+			net->vertices[num_movable] = ref;
+			num_movable++;
+		}
+	}
+	
+	// When the source is non-movable too, the whole net is fixed
+	if (num_movable == 1 &&
+	    SA_NET_VERTEX(state, net, 0)->index >= state->num_movable_vertices)
+		num_movable = 0;
+	
+	net->num_fixed_vertices = (sa_count_t)(net->num_vertices - num_movable);
+}
+
+/**
+ * Remove the duplicates from a sorted array, returning the new length.
+ */
+static size_t sa_unique(int *sorted, size_t length) {
+	size_t i;
+	size_t num_unique = 0;
+	
+	for (i = 0; i < length; i++)
+		if (num_unique == 0 || sorted[num_unique - 1] != sorted[i])
+			sorted[num_unique++] = sorted[i];
+	
+	return num_unique;
+}
+
+/**
+ * Build net->fixed_coords from the positions of the (already partitioned)
+ * non-movable vertices of a net. Returns false if memory allocation failed.
+ */
+static sa_bool_t sa_build_net_fixed_coords(const sa_state_t *state,
+                                           sa_net_t *net) {
+	size_t i;
+	size_t num_fixed = net->num_fixed_vertices;
+	size_t first = net->num_vertices - num_fixed;
+	int *coords;
+	
+	coords = malloc(2 * num_fixed * sizeof(int));
+	if (coords == NULL)
+		return sa_false;
+	
+	for (i = 0; i < num_fixed; i++) {
+		coords[i] = SA_NET_VERTEX(state, net, first + i)->x;
+		coords[num_fixed + i] = SA_NET_VERTEX(state, net, first + i)->y;
+	}
+	
+	sort(state, coords, num_fixed);
+	sort(state, coords + num_fixed, num_fixed);
+	net->num_fixed_xs = (sa_count_t)sa_unique(coords, num_fixed);
+	net->num_fixed_ys = (sa_count_t)sa_unique(coords + num_fixed, num_fixed);
+	for (i = 0; i < net->num_fixed_ys; i++)
+		coords[net->num_fixed_xs + i] = coords[num_fixed + i];
+	
+	net->fixed_coords = coords;
+	return sa_true;
+}
+
+/**
+ * Free the fixed vertex coordinates of every net and forget which vertices are
+ * non-movable.
+ */
+static void sa_free_net_fixed_coords(sa_state_t *state) {
+	size_t i;
+	
+	for (i = 0; i < state->num_nets; i++) {
+		free(state->nets[i]->fixed_coords);
+		state->nets[i]->fixed_coords = NULL;
+		state->nets[i]->num_fixed_vertices = 0;
+	}
+	
+	state->fixed_net_cost = 0.0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Chip distances
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Compute the distance between two coordinates on an axis of n chips.
+ */
+static int sa_axis_distance(const sa_state_t *state, int a, int b, int n) {
+	int d = (a < b) ? b - a : a - b;
+	if (state->has_wrap_around_links && d > n - d)
+		return n - d;
+	else
+		return d;
+}
+
+/**
+ * Compute the number of hops required to traverse a displacement through a
+ * hexagonal network where links run along the X, Y and X=Y diagonal axes.
+ */
+static int sa_hex_vector_length(int dx, int dy) {
+	if ((dx >= 0) == (dy >= 0))
+		return (abs(dx) > abs(dy)) ? abs(dx) : abs(dy);
+	else
+		return abs(dx) + abs(dy);
+}
+
+/**
+ * Find the shortest displacement between two chips in a hexagonal network
+ * where links run along the X, Y and X=Y diagonal axes.
+ *
+ * @returns The length of the displacement found (i.e. the distance between the
+ *          chips).
+ */
+static int sa_hex_vector(const sa_state_t *state, int ax, int ay, int bx, int by,
+                         int *dx_out, int *dy_out) {
+	int dx, dy, wx, wy, d, best;
+	
+	dx = bx - ax;
+	dy = by - ay;
+	
+	if (!state->has_wrap_around_links) {
+		*dx_out = dx;
+		*dy_out = dy;
+		return sa_hex_vector_length(dx, dy);
+	}
+	
+	// With wrap-around links the shortest path may go either way around each
+	// axis so every combination must be considered.
+	if (dx < 0)
+		dx += (int)state->width;
+	if (dy < 0)
+		dy += (int)state->height;
+	best = -1;
+	for (wx = 0; wx < 2; wx++) {
+		for (wy = 0; wy < 2; wy++) {
+			int cx = dx - (wx ? (int)state->width : 0);
+			int cy = dy - (wy ? (int)state->height : 0);
+			d = sa_hex_vector_length(cx, cy);
+			if (best < 0 || d < best) {
+				best = d;
+				*dx_out = cx;
+				*dy_out = cy;
+			}
+		}
+	}
+	return best;
+}
+
+/**
+ * Compute the length of the shortest path between two chips in a hexagonal
+ * network where links run along the X, Y and X=Y diagonal axes.
+ */
+static int sa_hex_distance(const sa_state_t *state, int ax, int ay, int bx, int by) {
+	int dx, dy;
+	return sa_hex_vector(state, ax, ay, bx, by, &dx, &dy);
+}
+
+/**
+ * Build a table giving the distance between chips for every displacement
+ * between two chips in the system. See state->distance_table.
+ */
+static sa_bool_t sa_build_distance_table(sa_state_t *state, sa_bool_t hexagonal) {
+	int dx, dy;
+	int w = (int)state->width;
+	int h = (int)state->height;
+	int *centre;
+	
+	state->distance_table = sa_alloc_array(state, sizeof(int) * ((2 * w) - 1) *
+	                                              ((2 * h) - 1));
+	if (state->distance_table == NULL)
+		return sa_false;
+	
+	centre = state->distance_table + ((h - 1) * ((2 * w) - 1)) + (w - 1);
+	for (dy = -(h - 1); dy <= h - 1; dy++) {
+		for (dx = -(w - 1); dx <= w - 1; dx++) {
+			if (hexagonal)
+				centre[(dy * ((2 * w) - 1)) + dx] = sa_hex_distance(state, 0, 0, dx, dy);
+			else
+				centre[(dy * ((2 * w) - 1)) + dx] = sa_axis_distance(state, 0, dx, w)
+				                                    + sa_axis_distance(state, 0, dy, h);
+		}
+	}
+	
+	return sa_true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Link congestion
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Compute the congestion penalty for a link carrying the specified usage.
+ */
+static double sa_link_penalty(const sa_state_t *state, double usage) {
+	double excess = usage - state->link_capacity;
+	if (excess > 0.0)
+		return state->congestion_weight * excess * excess;
+	else
+		return 0.0;
+}
+
+/**
+ * Add an amount to the usage of a link, updating state->congestion_cost.
+ */
+static void sa_add_link_usage(sa_state_t *state, int x, int y, sa_link_t link,
+                              double amount) {
+	double *usage = state->link_usage
+	                + (((((size_t)y * state->width) + (size_t)x) * SA_NUM_LINKS) + link);
+	state->congestion_cost -= sa_link_penalty(state, *usage);
+	*usage += amount;
+	state->congestion_cost += sa_link_penalty(state, *usage);
+}
+
+/**
+ * Add an amount to the usage of every link along the estimated route between
+ * two chips. The route takes any diagonal hops first, followed by hops along
+ * the X and then the Y axis.
+ */
+static void sa_add_route_usage(sa_state_t *state, int ax, int ay, int bx, int by,
+                               double amount) {
+	int dx, dy, diagonal;
+	int x = ax;
+	int y = ay;
+	
+	sa_hex_vector(state, ax, ay, bx, by, &dx, &dy);
+	
+	// Take one hop along the specified link, wrapping around if required
+#define SA_HOP(link, hop_x, hop_y) \
+	do { \
+		sa_add_link_usage(state, x, y, (link), amount); \
+		x += (hop_x); \
+		y += (hop_y); \
+		if (x < 0) x += (int)state->width; \
+		if (x >= (int)state->width) x -= (int)state->width; \
+		if (y < 0) y += (int)state->height; \
+		if (y >= (int)state->height) y -= (int)state->height; \
+	} while (0)
+	
+	// Diagonal hops are only useful when dx and dy have the same sign
+	if ((dx >= 0) == (dy >= 0)) {
+		diagonal = (abs(dx) < abs(dy)) ? abs(dx) : abs(dy);
+		if (dx > 0) {
+			dx -= diagonal;
+			dy -= diagonal;
+			for (; diagonal > 0; diagonal--)
+				SA_HOP(SA_LINK_NORTH_EAST, 1, 1);
+		} else {
+			dx += diagonal;
+			dy += diagonal;
+			for (; diagonal > 0; diagonal--)
+				SA_HOP(SA_LINK_SOUTH_WEST, -1, -1);
+		}
+	}
+	
+	for (; dx > 0; dx--)
+		SA_HOP(SA_LINK_EAST, 1, 0);
+	for (; dx < 0; dx++)
+		SA_HOP(SA_LINK_WEST, -1, 0);
+	for (; dy > 0; dy--)
+		SA_HOP(SA_LINK_NORTH, 0, 1);
+	for (; dy < 0; dy++)
+		SA_HOP(SA_LINK_SOUTH, 0, -1);
+
+#undef SA_HOP
+}
+
+/**
+ * Add the estimated route of a net (scaled by the specified factor) to the link
+ * usage map. The route is estimated as a path from the first vertex in the net
+ * (its source) to every other vertex.
+ */
+static void sa_add_net_route_usage(sa_state_t *state, sa_net_t *net, double scale) {
+	size_t i;
+	for (i = 1; i < net->num_vertices; i++)
+		sa_add_route_usage(state,
+		                   SA_NET_VERTEX(state, net, 0)->x, SA_NET_VERTEX(state, net, 0)->y,
+		                   SA_NET_VERTEX(state, net, i)->x, SA_NET_VERTEX(state, net, i)->y,
+		                   net->weight * scale);
+}
+
+double sa_get_link_usage(const sa_state_t *state, size_t x, size_t y, sa_link_t link) {
+	return state->link_usage[(((y * state->width) + x) * SA_NUM_LINKS) + link];
+}
+
+double sa_get_congestion_cost(sa_state_t *state) {
+	size_t i;
+	
+	if (!state->link_usage)
+		return 0.0;
+	
+	// Recompute the cost from scratch to discard any rounding errors
+	// accumulated while it was updated incrementally.
+	state->congestion_cost = 0.0;
+	for (i = 0; i < state->width * state->height * SA_NUM_LINKS; i++)
+		state->congestion_cost += sa_link_penalty(state, state->link_usage[i]);
+	
+	return state->congestion_cost;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Cost-weighted vertex selection
+////////////////////////////////////////////////////////////////////////////////
+
+// The minimum weight given to every vertex, as a fraction of the mean vertex
+// weight when the selection tree is built. Without this, vertices whose nets
+// have zero cost would never be selected and so could never be moved out of
+// the way of other vertices.
+#define SA_VERTEX_WEIGHT_FLOOR 0.1
+
+/**
+ * Add an amount to the weight of the movable vertex with the specified index
+ * in the vertex selection tree.
+ */
+static void sa_add_vertex_weight(sa_state_t *state, size_t index, double delta) {
+	size_t i;
+	
+	state->vertex_weights_total += delta;
+	for (i = index + 1; i <= state->num_movable_vertices; i += i & (~i + 1))
+		state->vertex_weights[i] += delta;
+}
+
+/**
+ * Find the index of the movable vertex in whose interval of the cumulative
+ * vertex weights the value r falls.
+ */
+static size_t sa_find_vertex_weight(const sa_state_t *state, double r) {
+	size_t n = state->num_movable_vertices;
+	size_t pos = 0;
+	size_t step = 1;
+	
+	while (step * 2 <= n)
+		step *= 2;
+	
+	for (; step > 0; step /= 2) {
+		if (pos + step <= n && state->vertex_weights[pos + step] <= r) {
+			pos += step;
+			r -= state->vertex_weights[pos];
+		}
+	}
+	
+	// Guard against rounding errors in the accumulated weights
+	return (pos < n) ? pos : n - 1;
+}
+
+/**
+ * Build the vertex selection tree (see state->vertex_weights) from the
+ * current placement.
+ */
+static sa_bool_t sa_build_vertex_weights(sa_state_t *state) {
+	size_t i, j;
+	size_t n = state->num_movable_vertices;
+	sa_vertex_t *vertex;
+	
+	state->vertex_weights = sa_alloc_array(state, (n + 1) * sizeof(double));
+	if (state->vertex_weights == NULL)
+		return sa_false;
+	
+	for (i = 0; i < state->num_nets; i++)
+		state->nets[i]->cost = sa_get_net_cost(state, state->nets[i]);
+	
+	state->vertex_weights_total = 0.0;
+	for (i = 0; i < n; i++) {
+		vertex = state->vertices[i];
+		for (j = 0; j < vertex->num_nets; j++)
+			state->vertex_weights[i + 1] += SA_VERTEX_NET(state, vertex, j)->cost;
+		state->vertex_weights_total += state->vertex_weights[i + 1];
+	}
+	
+	// Give every vertex a minimum weight. This is fixed until the tree is next
+	// rebuilt so that later updates need only apply changes in net costs.
+	if (state->vertex_weights_total > 0.0)
+		state->vertex_weight_floor = SA_VERTEX_WEIGHT_FLOOR *
+		                             (state->vertex_weights_total / (double)n);
+	else
+		state->vertex_weight_floor = 1.0;
+	for (i = 0; i < n; i++)
+		state->vertex_weights[i + 1] += state->vertex_weight_floor;
+	state->vertex_weights_total += state->vertex_weight_floor * (double)n;
+	
+	// Initialise the tree in linear time by pushing each partial sum up to its
+	// parent.
+	for (i = 1; i <= n; i++) {
+		j = i + (i & (~i + 1));
+		if (j <= n)
+			state->vertex_weights[j] += state->vertex_weights[i];
+	}
+	
+	return sa_true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Live chip sampling
+////////////////////////////////////////////////////////////////////////////////
+
+// The number of chips drawn uniformly from a region (and rejected if dead)
+// before falling back on an exact search of the live chip tables. When most
+// chips are live, a live chip is almost always found within these attempts
+// making selection O(1) in expectation.
+#define SA_LIVE_CHIP_REJECTION_ATTEMPTS 4
+
+/**
+ * Count the live chips in the (inclusive) range of chips given. The ranges may
+ * extend beyond the edges of the system by up to one width/height in which case
+ * they wrap around.
+ */
+static int sa_count_live_chips(const sa_state_t *state,
+                               int x0, int x1, int y0, int y1) {
+	int w = (int)state->width;
+	int h = (int)state->height;
+	const int *counts = state->live_chip_counts;
+	
+	if (x0 > x1 || y0 > y1)
+		return 0;
+	
+	// Bring ranges lying entirely beyond an edge back into the system
+	if (x1 < 0) {
+		x0 += w;
+		x1 += w;
+	} else if (x0 >= w) {
+		x0 -= w;
+		x1 -= w;
+	}
+	if (y1 < 0) {
+		y0 += h;
+		y1 += h;
+	} else if (y0 >= h) {
+		y0 -= h;
+		y1 -= h;
+	}
+	
+	// Split ranges which straddle an edge
+	if (x0 < 0)
+		return sa_count_live_chips(state, x0 + w, w - 1, y0, y1)
+		       + sa_count_live_chips(state, 0, x1, y0, y1);
+	if (x1 >= w)
+		return sa_count_live_chips(state, x0, w - 1, y0, y1)
+		       + sa_count_live_chips(state, 0, x1 - w, y0, y1);
+	if (y0 < 0)
+		return sa_count_live_chips(state, x0, x1, y0 + h, h - 1)
+		       + sa_count_live_chips(state, x0, x1, 0, y1);
+	if (y1 >= h)
+		return sa_count_live_chips(state, x0, x1, y0, h - 1)
+		       + sa_count_live_chips(state, x0, x1, 0, y1 - h);
+	
+	return counts[((y1 + 1) * (w + 1)) + x1 + 1]
+	       - counts[(y0 * (w + 1)) + x1 + 1]
+	       - counts[((y1 + 1) * (w + 1)) + x0]
+	       + counts[(y0 * (w + 1)) + x0];
+}
+
+/**
+ * Select a live chip, other than chip (x, y), uniformly at random from the
+ * (inclusive) region of chips given, wrapping around the edges of the system as
+ * in sa_count_live_chips().
+ *
+ * @returns False if there are no other live chips in the region.
+ */
+static sa_bool_t sa_get_random_live_chip(sa_state_t *state, int x, int y,
+                                         int x_min, int x_max,
+                                         int y_min, int y_max,
+                                         int *x_out, int *y_out) {
+	int w = (int)state->width;
+	int h = (int)state->height;
+	int num_live = sa_count_live_chips(state, x_min, x_max, y_min, y_max);
+	int r, lo, hi, mid;
+	int row, row_start;
+	int i;
+	
+	if (num_live - sa_count_live_chips(state, x, x, y, y) <= 0)
+		return sa_false;
+	
+	// Try drawing chips from the whole region, rejecting dead ones. Each
+	// accepted chip is uniformly distributed over the live chips, as is one
+	// found by the search below, so the combination remains uniform.
+	for (i = 0; i < SA_LIVE_CHIP_REJECTION_ATTEMPTS; i++) {
+		*x_out = (x_min + sa_random_int(state, x_max - x_min + 1) + w) % w;
+		*y_out = (y_min + sa_random_int(state, y_max - y_min + 1) + h) % h;
+		if ((*x_out != x || *y_out != y) &&
+		    sa_count_live_chips(state, *x_out, *x_out, *y_out, *y_out))
+			return sa_true;
+	}
+	
+	do {
+		r = sa_random_int(state, num_live);
+		
+		// Find the row containing the r-th live chip in the region
+		lo = 0;
+		hi = y_max - y_min;
+		while (lo < hi) {
+			mid = (lo + hi) / 2;
+			if (sa_count_live_chips(state, x_min, x_max, y_min, y_min + mid) > r)
+				hi = mid;
+			else
+				lo = mid + 1;
+		}
+		r -= sa_count_live_chips(state, x_min, x_max, y_min, y_min + lo - 1);
+		row = (y_min + lo + h) % h;
+		
+		// Find the r-th live chip in the row counting (cyclically) from the
+		// left-hand edge of the region.
+		row_start = (x_min + w) % w;
+		r = (sa_count_live_chips(state, 0, row_start - 1, row, row) + r)
+		    % sa_count_live_chips(state, 0, w - 1, row, row);
+		
+		*x_out = state->live_chip_columns[(row * w) + r];
+		*y_out = row;
+	} while (*x_out == x && *y_out == y);
+	
+	return sa_true;
+}
+
+/**
+ * Build the live chip tables (see state->live_chip_counts) from the current
+ * chip resources.
+ */
+static sa_bool_t sa_build_live_chips(sa_state_t *state) {
+	size_t x, y;
+	size_t w = state->width;
+	int *counts;
+	int *columns;
+	int num_live;
+	
+	state->live_chip_counts = sa_alloc_array(state, (w + 1) * (state->height + 1) *
+	                                                sizeof(int));
+	state->live_chip_columns = sa_alloc_array(state, w * state->height *
+	                                                 sizeof(int));
+	if (state->live_chip_counts == NULL || state->live_chip_columns == NULL)
+		return sa_false;
+	
+	counts = state->live_chip_counts;
+	for (y = 0; y < state->height; y++) {
+		columns = state->live_chip_columns + (y * w);
+		num_live = 0;
+		for (x = 0; x < w; x++) {
+			if (sa_positive_resources(state, sa_get_chip_resources_ptr(state, x, y)))
+				columns[num_live++] = (int)x;
+			counts[((y + 1) * (w + 1)) + x + 1] = counts[(y * (w + 1)) + x + 1]
+			                                      + num_live;
+		}
+	}
+	
+	return sa_true;
+}
+
+/**
+ * Compute the resources available on each chip when it holds no movable
+ * vertices from the current placement.
+ *
+ * @param capacities An array [height][width][num_resource_types] to fill.
+ */
+static void sa_get_chip_capacities(sa_state_t *state, int *capacities) {
+	size_t x, y;
+	int *capacity;
+	sa_vertex_t *vertex;
+	
+	for (y = 0; y < state->height; y++) {
+		for (x = 0; x < state->width; x++) {
+			capacity = capacities + (
+				(y * state->width * state->num_resource_types)
+				+ (x * state->num_resource_types)
+			);
+			memcpy(capacity, sa_get_chip_resources_ptr(state, x, y),
+			       sizeof(int) * state->num_resource_types);
+			for (vertex = sa_get_chip_vertex(state, x, y); vertex; vertex = vertex->next)
+				sa_add_resources(state, capacity, vertex->vertex_resources);
+		}
+	}
+}
+
+/**
+ * Build the table of chip capacities (see state->chip_capacities) from the
+ * current placement.
+ */
+static sa_bool_t sa_build_chip_capacities(sa_state_t *state) {
+	state->chip_capacities = sa_alloc_array(state, state->width * state->height *
+	                                               state->num_resource_types *
+	                                               sizeof(int));
+	if (state->chip_capacities == NULL)
+		return sa_false;
+	
+	sa_get_chip_capacities(state, state->chip_capacities);
+	
+	return sa_true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Preparation
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Free all datastructures built by sa_prepare().
+ */
+static void sa_free_prepared(sa_state_t *state) {
+	size_t i;
+	
+	sa_free_net_histograms(state);
+	sa_free_net_fixed_coords(state);
+	
+	sa_free_array(state->distance_table);
+	state->distance_table = NULL;
+	
+	sa_free_array(state->link_usage);
+	state->link_usage = NULL;
+	state->congestion_cost = 0.0;
+	
+	for (i = 0; i < state->num_frozen_nets; i++)
+		state->nets[state->frozen_nets[i]]->frozen = sa_false;
+	sa_free_array(state->frozen_nets);
+	state->frozen_nets = NULL;
+	state->num_frozen_nets = 0;
+	state->frozen_net_cost = 0.0;
+	
+	sa_free_array(state->vertex_weights);
+	state->vertex_weights = NULL;
+	state->vertex_weights_total = 0.0;
+	state->vertex_weight_floor = 0.0;
+	
+	sa_free_array(state->live_chip_counts);
+	state->live_chip_counts = NULL;
+	sa_free_array(state->live_chip_columns);
+	state->live_chip_columns = NULL;
+	
+	sa_free_array(state->chip_capacities);
+	state->chip_capacities = NULL;
+	
+	sa_free_visit(state->visit);
+	state->visit = NULL;
+}
+
+sa_bool_t sa_prepare(sa_state_t *state) {
+	size_t i, j;
+	sa_net_t *net;
+	sa_net_histogram_t *histogram;
+	
+	sa_free_prepared(state);
+	
+	// Number the vertices and nets
+	for (i = 0; i < state->num_vertices; i++)
+		state->vertices[i]->index = (sa_count_t)i;
+	for (i = 0; i < state->num_nets; i++)
+		state->nets[i]->index = (sa_count_t)i;
+	
+	// Index the live chips and record the capacity of every chip
+	if (!sa_build_live_chips(state) || !sa_build_chip_capacities(state)) {
+		sa_free_prepared(state);
+		return sa_false;
+	}
+	
+	// Allocate the visit marks used to evaluate moves without modifying the
+	// state (not possible with custom cost functions)
+	if (state->cost_model != SA_COST_MODEL_CUSTOM) {
+		state->visit = sa_new_visit(state);
+		if (state->visit == NULL) {
+			sa_free_prepared(state);
+			return sa_false;
+		}
+	}
+	
+	// Create histograms for high-fanout nets (only used by the HPWL model)
+	for (i = 0; i < state->num_nets && state->cost_model == SA_COST_MODEL_HPWL; i++) {
+		net = state->nets[i];
+		if (net->num_vertices < 2 ||
+		    net->num_vertices < state->net_histogram_min_fanout)
+			continue;
+		
+		histogram = sa_new_net_histogram(state);
+		if (histogram == NULL) {
+			sa_free_prepared(state);
+			return sa_false;
+		}
+		
+		for (j = 0; j < net->num_vertices; j++) {
+			sa_axis_histogram_add(&histogram->x, (int)state->width,
+			                      state->has_wrap_around_links,
+			                      SA_NET_VERTEX(state, net, j)->x);
+			sa_axis_histogram_add(&histogram->y, (int)state->height,
+			                      state->has_wrap_around_links,
+			                      SA_NET_VERTEX(state, net, j)->y);
+		}
+		
+		net->histogram = histogram;
+		state->has_net_histograms = sa_true;
+	}
+	
+	// Group the non-movable vertices of every net and, for the HPWL model,
+	// summarise their positions so that they need not be visited again. When
+	// no vertices are movable, sa_step() does nothing and the vertices are
+	// assumed to be positioned by other means (or not at all).
+	for (i = 0; i < state->num_nets && state->num_movable_vertices > 0; i++) {
+		net = state->nets[i];
+		sa_partition_net_vertices(state, net);
+		if (state->cost_model != SA_COST_MODEL_HPWL || net->histogram ||
+		    net->num_vertices < 2 || net->num_fixed_vertices == 0)
+			continue;
+		
+		if (!sa_build_net_fixed_coords(state, net)) {
+			sa_free_prepared(state);
+			return sa_false;
+		}
+	}
+	
+	// Tabulate the chip-to-chip distances used by the star models
+	if (state->cost_model == SA_COST_MODEL_STAR ||
+	    state->cost_model == SA_COST_MODEL_HEX_STAR) {
+		if (!sa_build_distance_table(state,
+		                             state->cost_model == SA_COST_MODEL_HEX_STAR)) {
+			sa_free_prepared(state);
+			return sa_false;
+		}
+	}
+	
+	// Build the link usage map from the current placement
+	if (state->congestion_weight > 0.0) {
+		state->link_usage = sa_alloc_array(state, state->width * state->height *
+		                                          SA_NUM_LINKS * sizeof(double));
+		if (state->link_usage == NULL) {
+			sa_free_prepared(state);
+			return sa_false;
+		}
+		
+		for (i = 0; i < state->num_nets; i++)
+			sa_add_net_route_usage(state, state->nets[i], 1.0);
+	}
+	
+	// Build the cost-weighted vertex selection tree
+	if (state->vertex_selection == SA_VERTEX_SELECTION_COST_WEIGHTED) {
+		if (!sa_build_vertex_weights(state)) {
+			sa_free_prepared(state);
+			return sa_false;
+		}
+	}
+	
+	// The cost of nets which can never move is constant (though custom cost
+	// functions need not be)
+	if (state->cost_model != SA_COST_MODEL_CUSTOM && state->num_movable_vertices > 0)
+		for (i = 0; i < state->num_nets; i++)
+			if (state->nets[i]->num_fixed_vertices == state->nets[i]->num_vertices)
+				state->fixed_net_cost += sa_get_net_cost(state, state->nets[i]);
+	
+	// Freeze the nets with the largest fanouts
+	if (state->frozen_net_min_fanout > 0) {
+		for (i = 0; i < state->num_nets; i++)
+			if (state->nets[i]->num_vertices >= state->frozen_net_min_fanout &&
+			    state->nets[i]->num_fixed_vertices < state->nets[i]->num_vertices)
+				state->num_frozen_nets++;
+		
+		state->frozen_nets = sa_alloc_array(state, (state->num_frozen_nets + 1) *
+		                                           sizeof(sa_count_t));
+		if (state->frozen_nets == NULL) {
+			state->num_frozen_nets = 0;
+			sa_free_prepared(state);
+			return sa_false;
+		}
+		
+		j = 0;
+		for (i = 0; i < state->num_nets; i++) {
+			net = state->nets[i];
+			if (net->num_vertices >= state->frozen_net_min_fanout &&
+			    net->num_fixed_vertices < net->num_vertices) {
+				net->frozen = sa_true;
+				state->frozen_nets[j++] = (sa_count_t)i;
+				state->frozen_net_cost += sa_get_net_cost(state, net);
+			}
+		}
+	}
+	
+	return sa_true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Netlist simplification
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Mix the bits of an integer (the finaliser of SplitMix64).
+ */
+static unsigned long long sa_mix_bits(unsigned long long x) {
+	x ^= x >> 30;
+	x *= 0xBF58476D1CE4E5B9ull;
+	x ^= x >> 27;
+	x *= 0x94D049BB133111EBull;
+	x ^= x >> 31;
+	return x;
+}
+
+/**
+ * Hash the vertices of a (numbered) net such that nets with the same source and
+ * set of other vertices, in any order, have the same hash.
+ */
+static unsigned long long sa_hash_net(const sa_state_t *state,
+                                      const sa_net_t *net) {
+	size_t i;
+	unsigned long long hash;
+	(void) state;
+	
+	hash = sa_mix_bits(~(unsigned long long)SA_NET_VERTEX(state, net, 0)->index)
+	       + net->num_vertices;
+	for (i = 1; i < net->num_vertices; i++)
+		hash += sa_mix_bits(SA_NET_VERTEX(state, net, i)->index);
+	
+	return hash;
+}
+
+/**
+ * Do two (numbered) nets have the same source and set of other vertices?
+ * vertex_stamps is an array [num_vertices] of marks, none of which may exceed
+ * *stamp, which is advanced.
+ */
+static sa_bool_t sa_nets_equal(const sa_state_t *state,
+                               const sa_net_t *a, const sa_net_t *b,
+                               size_t *vertex_stamps, size_t *stamp) {
+	size_t i;
+	(void) state;
+	
+	if (a->num_vertices != b->num_vertices ||
+	    SA_NET_VERTEX(state, a, 0) != SA_NET_VERTEX(state, b, 0))
+		return sa_false;
+	
+	// Every vertex of b must be in a...
+	(*stamp)++;
+	for (i = 0; i < a->num_vertices; i++)
+		vertex_stamps[SA_NET_VERTEX(state, a, i)->index] = *stamp;
+	for (i = 0; i < b->num_vertices; i++)
+		if (vertex_stamps[SA_NET_VERTEX(state, b, i)->index] != *stamp)
+			return sa_false;
+	
+	// ...and vice versa
+	(*stamp)++;
+	for (i = 0; i < b->num_vertices; i++)
+		vertex_stamps[SA_NET_VERTEX(state, b, i)->index] = *stamp;
+	for (i = 0; i < a->num_vertices; i++)
+		if (vertex_stamps[SA_NET_VERTEX(state, a, i)->index] != *stamp)
+			return sa_false;
+	
+	return sa_true;
+}
+
+sa_bool_t sa_merge_nets(sa_state_t *state, size_t *net_map) {
+	size_t i, j, k;
+	size_t num_slots;
+	size_t num_distinct = 0;
+	size_t stamp = 0;
+	size_t *map = net_map;
+	size_t *slots;
+	size_t *firsts;
+	size_t *vertex_stamps;
+	unsigned long long *hashes;
+	sa_net_t *net;
+	sa_vertex_t *vertex;
+	
+	// The hash table of distinct nets is kept at most half full
+	for (num_slots = 1; num_slots < 2 * state->num_nets; num_slots *= 2)
+		;
+	
+	slots = malloc(num_slots * sizeof(size_t));
+	firsts = malloc((state->num_nets + 1) * sizeof(size_t));
+	vertex_stamps = calloc(state->num_vertices + 1, sizeof(size_t));
+	hashes = malloc((state->num_nets + 1) * sizeof(unsigned long long));
+	if (map == NULL)
+		map = malloc((state->num_nets + 1) * sizeof(size_t));
+	if (slots == NULL || firsts == NULL || vertex_stamps == NULL ||
+	    hashes == NULL || map == NULL) {
+		free(slots);
+		free(firsts);
+		free(vertex_stamps);
+		free(hashes);
+		if (map != net_map)
+			free(map);
+		return sa_false;
+	}
+	
+	sa_free_prepared(state);
+	
+	// Number the vertices and nets
+	for (i = 0; i < state->num_vertices; i++)
+		state->vertices[i]->index = (sa_count_t)i;
+	for (i = 0; i < state->num_nets; i++)
+		state->nets[i]->index = (sa_count_t)i;
+	
+	// Find the first net with each distinct set of vertices and add the
+	// weights of the others to it. firsts[n] is the original index of the nth
+	// distinct net.
+	for (i = 0; i < num_slots; i++)
+		slots[i] = SA_NET_REMOVED;
+	for (i = 0; i < state->num_nets; i++) {
+		net = state->nets[i];
+		if (net->num_vertices < 2) {
+			map[i] = SA_NET_REMOVED;
+			continue;
+		}
+		
+		hashes[i] = sa_hash_net(state, net);
+		for (j = hashes[i] & (num_slots - 1); slots[j] != SA_NET_REMOVED;
+		     j = (j + 1) & (num_slots - 1)) {
+			k = slots[j];
+			if (hashes[k] == hashes[i] &&
+			    sa_nets_equal(state, state->nets[k], net, vertex_stamps, &stamp))
+				break;
+		}
+		
+		if (slots[j] == SA_NET_REMOVED) {
+			slots[j] = i;
+			firsts[num_distinct] = i;
+			map[i] = num_distinct++;
+		} else {
+			map[i] = map[slots[j]];
+			state->nets[slots[j]]->weight += net->weight;
+		}
+	}
+	
+	// Give every net the index of the net it is merged into
+	for (i = 0; i < state->num_nets; i++)
+		state->nets[i]->index = (sa_count_t)map[i];
+	
+	// Replace the nets of every vertex with those they were merged into, each
+	// listed once. The hash table is no longer required and so slots[n] is
+	// reused to record the last vertex to list the nth distinct net.
+	for (i = 0; i < num_distinct; i++)
+		slots[i] = SA_NET_REMOVED;
+	for (i = 0; i < state->num_vertices; i++) {
+		vertex = state->vertices[i];
+		k = 0;
+		for (j = 0; j < vertex->num_nets; j++) {
+			if (vertex->nets[j] == SA_NO_REF) {
+				vertex->nets[k++] = SA_NO_REF;
+				continue;
+			}
+			
+			net = SA_VERTEX_NET(state, vertex, j);
+			if (net->index == (sa_count_t)SA_NET_REMOVED || slots[net->index] == i)
+				continue;
+			slots[net->index] = i;
+			vertex->nets[k++] = SA_NET_REF(state->nets[firsts[net->index]]);
+		}
+		vertex->num_nets = (sa_count_t)k;
+	}
+	
+	// Free the merged and removed nets and pack the remainder (which only move
+	// towards the start of the array)
+	for (i = 0; i < state->num_nets; i++) {
+		net = state->nets[i];
+		state->nets[i] = NULL;
+		if (map[i] != SA_NET_REMOVED && firsts[map[i]] == i)
+			state->nets[map[i]] = net;
+		else
+			sa_free_net(net);
+	}
+	state->num_nets = num_distinct;
+	
+	free(slots);
+	free(firsts);
+	free(vertex_stamps);
+	free(hashes);
+	if (map != net_map)
+		free(map);
+	
+	return sa_true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// General data structure manipulation functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Set the position of a vertex, keeping the histograms of any nets it belongs
+ * to and the link usage map up-to-date.
+ */
+static void sa_set_vertex_position(sa_state_t *state, sa_vertex_t *vertex,
+                                   int x, int y) {
+	size_t i;
+	sa_net_t *net;
+	
+	if (vertex->x == x && vertex->y == y)
+		return;
+	
+	if (state->has_net_histograms) {
+		for (i = 0; i < vertex->num_nets; i++) {
+			if (vertex->nets[i] != SA_NO_REF &&
+			    SA_VERTEX_NET(state, vertex, i)->histogram)
+				sa_net_histogram_move(state, SA_VERTEX_NET(state, vertex, i)->histogram,
+				                      vertex->x, vertex->y, x, y);
+		}
+	}
+	
+	if (state->link_usage) {
+		// When the vertex is the source of a net, the whole net's route moves,
+		// otherwise just the route from the source to this vertex.
+		for (i = 0; i < vertex->num_nets; i++) {
+			net = SA_VERTEX_NET(state, vertex, i);
+			if (SA_NET_VERTEX(state, net, 0) == vertex)
+				sa_add_net_route_usage(state, net, -1.0);
+			else
+				sa_add_route_usage(state, SA_NET_VERTEX(state, net, 0)->x, SA_NET_VERTEX(state, net, 0)->y,
+				                   vertex->x, vertex->y, -net->weight);
+		}
+		vertex->x = x;
+		vertex->y = y;
+		for (i = 0; i < vertex->num_nets; i++) {
+			net = SA_VERTEX_NET(state, vertex, i);
+			if (SA_NET_VERTEX(state, net, 0) == vertex)
+				sa_add_net_route_usage(state, net, 1.0);
+			else
+				sa_add_route_usage(state, SA_NET_VERTEX(state, net, 0)->x, SA_NET_VERTEX(state, net, 0)->y,
+				                   vertex->x, vertex->y, net->weight);
+		}
+	}
+	
+	vertex->x = x;
+	vertex->y = y;
+}
+
+int *sa_get_chip_resources_ptr(sa_state_t *state, size_t x, size_t y) {
+	return state->chip_resources + (
+		(y * state->width * state->num_resource_types)
+		+ (x * state->num_resource_types)
+	);
+}
+
+int sa_get_chip_resources(sa_state_t *state, size_t x, size_t y, size_t resource) {
+	return sa_get_chip_resources_ptr(state, x, y)[resource];
+}
+
+void sa_set_chip_resources(sa_state_t *state, size_t x, size_t y, size_t resource, int value) {
+	sa_get_chip_resources_ptr(state, x, y)[resource] = value;
+}
+
+sa_vertex_t *sa_get_chip_vertex(sa_state_t *state, size_t x, size_t y) {
+	return state->chip_vertices[(y * state->width) + x];
+}
+
+void sa_set_chip_vertex(sa_state_t *state, size_t x, size_t y, sa_vertex_t *vertex) {
+	 state->chip_vertices[(y * state->width) + x] = vertex;
+}
+
+void sa_subtract_resources(const sa_state_t *state, int *a, const int *b) {
+	size_t i;
+	for (i = 0; i < state->num_resource_types; i++)
+		a[i] -= b[i];
+}
+
+void sa_add_resources(const sa_state_t *state, int *a, const int *b) {
+	size_t i;
+	for (i = 0; i < state->num_resource_types; i++)
+		a[i] += b[i];
+}
+
+sa_bool_t sa_positive_resources(const sa_state_t *state, const int *a) {
+	size_t i;
+	for (i = 0; i < state->num_resource_types; i++)
+		if (a[i] < 0)
+			return sa_false;
+	return sa_true;
+}
+
+/**
+ * Add a vertex to the set of dirty vertices (see sa_set_dirty_tracking()).
+ */
+static void sa_mark_vertex_dirty(sa_state_t *state, const sa_vertex_t *vertex) {
+	unsigned int *word = state->dirty_bitmap + (vertex->index / 32);
+	unsigned int bit = 1u << (vertex->index % 32);
+	
+	if (*word & bit)
+		return;
+	*word |= bit;
+	state->dirty_vertices[state->num_dirty_vertices++] = vertex->index;
+}
+
+void sa_add_vertex_to_chip(sa_state_t *state, sa_vertex_t *vertex, int x, int y, sa_bool_t movable) {
+	if (state->dirty_bitmap && (vertex->x != x || vertex->y != y))
+		sa_mark_vertex_dirty(state, vertex);
+	
+	sa_set_vertex_position(state, vertex, x, y);
+	
+	// Insert the vertex into the LL of movable vertices on the target chip
+	if (movable) {
+		assert(vertex->next == NULL);
+		vertex->next = sa_get_chip_vertex(state, x, y);
+		sa_set_chip_vertex(state, x, y, vertex);
+	}
+	
+	// Subtract the resources consumed from those available on the chip
+	sa_subtract_resources(state,
+	                      sa_get_chip_resources_ptr(state, x, y),
+	                      vertex->vertex_resources);
+}
+
+void sa_add_vertices_to_chip(sa_state_t *state, sa_vertex_t *vertices, int x, int y) {
+	while (vertices != NULL) {
+		// Detatch the head of list
+		sa_vertex_t *vertex = vertices;
+		vertices = vertex->next;
+		vertex->next = NULL;
+		
+		// Add it to the chip
+		sa_add_vertex_to_chip(state, vertex, x, y, sa_true);
+	}
+}
+
+sa_bool_t sa_add_vertices_to_chip_if_fit(sa_state_t *state, sa_vertex_t *vertices, int x, int y) {
+	int *resources_available = alloca(sizeof(int) * state->num_resource_types);
+	sa_vertex_t *v;
+	sa_vertex_t *last = NULL;
+	
+	memcpy(resources_available, sa_get_chip_resources_ptr(state, x, y),
+	       sizeof(int) * state->num_resource_types);
+	
+	// Find the resources which would remain (and the last vertex in the list)
+	for (v = vertices; v; v = v->next) {
+		sa_subtract_resources(state, resources_available, v->vertex_resources);
+		last = v;
+	}
+	
+	if (sa_positive_resources(state, resources_available)) {
+		// The vertices fit, move them to the chip...
+		for (v = vertices; v; v = v->next) {
+			if (state->dirty_bitmap && (v->x != x || v->y != y))
+				sa_mark_vertex_dirty(state, v);
+			sa_set_vertex_position(state, v, x, y);
+		}
+		
+		// ...and insert them
+		if (last) {
+			last->next = sa_get_chip_vertex(state, x, y);
+			sa_set_chip_vertex(state, x, y, vertices);
+			
+			// And update the resource consumption
+			memcpy(sa_get_chip_resources_ptr(state, x, y), resources_available,
+			       sizeof(int) * state->num_resource_types);
+		}
+		return sa_true;
+	} else {
+		// The vertices didn't fit, just stop now
+		return sa_false;
+	}
+}
+
+void sa_remove_vertex_from_chip(sa_state_t *state, sa_vertex_t *vertex) {
+	sa_vertex_t *head = sa_get_chip_vertex(state, vertex->x, vertex->y);
+	sa_vertex_t **next_ptr = &head;
+	
+	// Search through the linked-list for the vertex to remove
+	while (*next_ptr != vertex) {
+		assert((*next_ptr)->next != NULL);  // The vertex *must* be present!
+		next_ptr = &((*next_ptr)->next);
+	}
+	
+	// Remove it
+	*next_ptr = vertex->next;
+	vertex->next = NULL;
+	
+	sa_set_chip_vertex(state, vertex->x, vertex->y, head);
+	
+	// Account for the resources now freed up
+	sa_add_resources(state,
+	                 sa_get_chip_resources_ptr(state, vertex->x, vertex->y),
+	                 vertex->vertex_resources);
+}
+
+#if defined(SA_COMPACT)
+/**
+ * Set the index of every vertex and net currently in the state.
+ */
+static void sa_number_vertices_and_nets(const sa_state_t *state) {
+	size_t i;
+	
+	for (i = 0; i < state->num_vertices; i++)
+		if (state->vertices[i])
+			state->vertices[i]->index = (sa_count_t)i;
+	for (i = 0; i < state->num_nets; i++)
+		if (state->nets[i])
+			state->nets[i]->index = (sa_count_t)i;
+}
+#endif
+
+void sa_add_vertex_to_net(const sa_state_t *state, sa_net_t *net, sa_vertex_t *vertex) {
+	size_t i;
+	(void) state;
+	
+#if defined(SA_COMPACT)
+	// Nets and vertices refer to each other by index. If either has not been
+	// numbered yet, number everything in the state (normally this happens just
+	// once, when the first vertex is added to a net).
+	if (vertex->index >= state->num_vertices ||
+	    state->vertices[vertex->index] != vertex ||
+	    net->index >= state->num_nets ||
+	    state->nets[net->index] != net)
+		sa_number_vertices_and_nets(state);
+	assert(vertex->index < state->num_vertices);
+	assert(state->vertices[vertex->index] == vertex);
+	assert(net->index < state->num_nets);
+	assert(state->nets[net->index] == net);
+#endif
+	
+	// Add vertex to net's list of vertices
+	for (i = 0; i < net->num_vertices; i++) {
+		if (net->vertices[i] == SA_NO_REF) {
+			net->vertices[i] = SA_VERTEX_REF(vertex);
+			break;
+		}
+	}
+	assert(i < net->num_vertices);
+	
+	// Add net to vertex's list of nets
+	for (i = 0; i < vertex->num_nets; i++) {
+		if (vertex->nets[i] == SA_NO_REF) {
+			vertex->nets[i] = SA_NET_REF(net);
+			break;
+		}
+	}
+	assert(i < vertex->num_nets);
+}
+
+sa_vertex_t *sa_get_random_movable_vertex(sa_state_t *state) {
+	// Pick vertices in proportion to their weight, if enabled
+	if (state->vertex_weights && state->vertex_weights_total > 0.0)
+		return state->vertices[sa_find_vertex_weight(
+			state, sa_random_double(state) * state->vertex_weights_total)];
+	
+	return state->vertices[sa_random_int(state,
+	                                     (int)state->num_movable_vertices)];
+}
+
+void sa_get_random_nearby_chip(sa_state_t *state, int x, int y,
+                               int distance_limit,
+                               int *x_out, int *y_out) {
+	int x_min, y_min, x_max, y_max;
+	assert(distance_limit >= 1);
+	
+	*x_out = x;
+	*y_out = y;
+	
+	// Compute the bounds of the region from which candidate chips may be chosen
+	x_min = x - distance_limit;
+	y_min = y - distance_limit;
+	x_max = x + distance_limit;
+	y_max = y + distance_limit;
+	if (state->has_wrap_around_links) {
+		// If the distance limit allows wrapping more than all the way around, just
+		// clamp to that range
+		if ((x_max - x_min) >= (int)state->width) {
+			x_min = 0;
+			x_max = (int)state->width - 1;
+		}
+		if ((y_max - y_min) >= (int)state->height) {
+			y_min = 0;
+			y_max = (int)state->height - 1;
+		}
+	} else {
+		// No wrap-around links
+		if (x_min < 0)
+			x_min = 0;
+		if (y_min < 0)
+			y_min = 0;
+		if (x_max > (int)state->width - 1)
+			x_max = (int)state->width - 1;
+		if (y_max > (int)state->height - 1)
+			y_max = (int)state->height - 1;
+	}
+	
+	// If the live chips have been indexed, pick only from those
+	if (state->live_chip_counts &&
+	    sa_get_random_live_chip(state, x, y, x_min, x_max, y_min, y_max,
+	                            x_out, y_out))
+		return;
+	
+	// Note we must pick a chip which isn't this chip(!)
+	while (*x_out == x && *y_out == y) {
+		*x_out = x_min + sa_random_int(state, (x_max - x_min) + 1);
+		*y_out = y_min + sa_random_int(state, (y_max - y_min) + 1);
+		
+		// Wrap-around (if required)
+		if (*x_out < 0)
+			*x_out += (int)state->width;
+		if (*x_out >= (int)state->width)
+			*x_out -= (int)state->width;
+		if (*y_out < 0)
+			*y_out += (int)state->height;
+		if (*y_out >= (int)state->height)
+			*y_out -= (int)state->height;
+	}
+}
+
+
+sa_bool_t sa_make_room_on_chip(sa_state_t *state, int x, int y,
+                               const int *resources_required,
+                               sa_vertex_t **removed_vertices) {
+	
+	// Create a local copy of the resource requirement on the stack
+	int *resources_available = alloca(sizeof(int) * state->num_resource_types);
+	const int *capacity;
+	size_t i;
+	
+	// Give up immediately if even an empty chip couldn't meet the requirement
+	*removed_vertices = NULL;
+	if (state->chip_capacities) {
+		capacity = state->chip_capacities + (
+			(y * state->width * state->num_resource_types)
+			+ (x * state->num_resource_types)
+		);
+		for (i = 0; i < state->num_resource_types; i++)
+			if (capacity[i] < resources_required[i])
+				return sa_false;
+	}
+	
+	memcpy(resources_available, sa_get_chip_resources_ptr(state, x, y),
+	       sizeof(int) * state->num_resource_types);
+	
+	// See if the resources already available on the chip are sufficient alone
+	sa_subtract_resources(state, resources_available, resources_required);
+	
+	// Keep removing vertices until all the requred resources have been found.
+	while (!sa_positive_resources(state, resources_available)) {
+		if (sa_get_chip_vertex(state, x, y) != NULL) {
+			// Remove a vertex
+			sa_vertex_t *new_chip_head = sa_get_chip_vertex(state, x, y)->next;
+			sa_get_chip_vertex(state, x, y)->next = *removed_vertices;
+			*removed_vertices = sa_get_chip_vertex(state, x, y);
+			sa_set_chip_vertex(state, x, y, new_chip_head);
+			
+			sa_add_resources(state,
+			                 resources_available,
+			                 (*removed_vertices)->vertex_resources);
+		} else {
+			// Ran out of vertices to remove! Put them all back then report a
+			// failure.
+			sa_set_chip_vertex(state, x, y, *removed_vertices);
+			*removed_vertices = NULL;
+			return sa_false;
+		}
+	}
+	
+	// Update the resource counts for the chip if a vertex was removed
+	if (*removed_vertices) {
+		sa_add_resources(state, resources_available, resources_required);
+		memcpy(sa_get_chip_resources_ptr(state, x, y), resources_available,
+		       sizeof(int) * state->num_resource_types);
+	}
+	
+	return sa_true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Initial placement
+////////////////////////////////////////////////////////////////////////////////
+
+// The number of chips (in curve order) which sa_place_initial() keeps open to
+// receive vertices at any one time.
+#define SA_INITIAL_PLACEMENT_OPEN_CHIPS 4
+
+/**
+ * Convert a distance along a Hilbert curve filling an n*n square (where n is a
+ * power of two) into a coordinate.
+ */
+static void sa_hilbert_curve_point(int n, int d, int *x, int *y) {
+	int s, rx, ry, t;
+	
+	*x = 0;
+	*y = 0;
+	for (s = 1; s < n; s *= 2) {
+		rx = 1 & (d / 2);
+		ry = 1 & (d ^ rx);
+		
+		// Rotate the quadrant
+		if (ry == 0) {
+			if (rx == 1) {
+				*x = s - 1 - *x;
+				*y = s - 1 - *y;
+			}
+			t = *x;
+			*x = *y;
+			*y = t;
+		}
+		
+		*x += s * rx;
+		*y += s * ry;
+		d /= 4;
+	}
+}
+
+/**
+ * Produce a list of the live chips in the order they're visited by a Hilbert
+ * curve. Chips are given as indices (y*width + x).
+ *
+ * @returns The number of chips listed.
+ */
+static size_t sa_order_live_chips(sa_state_t *state, int *chips) {
+	int n = 1;
+	int d, x, y;
+	size_t num_chips = 0;
+	
+	while (n < (int)state->width || n < (int)state->height)
+		n *= 2;
+	
+	for (d = 0; d < n * n; d++) {
+		sa_hilbert_curve_point(n, d, &x, &y);
+		if (x < (int)state->width && y < (int)state->height &&
+		    sa_positive_resources(state, sa_get_chip_resources_ptr(state, x, y)))
+			chips[num_chips++] = (y * (int)state->width) + x;
+	}
+	
+	return num_chips;
+}
+
+static int sa_compare_vertex_degree(const void *a, const void *b) {
+	const sa_vertex_t *va = *((const sa_vertex_t * const *)a);
+	const sa_vertex_t *vb = *((const sa_vertex_t * const *)b);
+	
+	if (va->num_nets != vb->num_nets)
+		return (va->num_nets < vb->num_nets) ? -1 : 1;
+	else
+		return (va->index < vb->index) ? -1 : (va->index > vb->index);
+}
+
+/**
+ * Order the movable vertices by a breadth-first search of the netlist (as in
+ * the Cuthill-McKee ordering) so that connected vertices appear close together.
+ * Each connected component is started from its lowest-degree vertex.
+ *
+ * @param order Array of num_movable_vertices to be filled with the ordering.
+ * @param seeds Array of num_movable_vertices used as scratch space.
+ * @param visited Array of num_movable_vertices flags, initially all false.
+ */
+static void sa_order_movable_vertices(sa_state_t *state, sa_vertex_t **order,
+                                      sa_vertex_t **seeds, sa_bool_t *visited) {
+	size_t i, j, k;
+	size_t head = 0;
+	size_t tail = 0;
+	sa_vertex_t *vertex;
+	sa_net_t *net;
+	
+	for (i = 0; i < state->num_vertices; i++)
+		state->vertices[i]->index = i;
+	
+	memcpy(seeds, state->vertices,
+	       sizeof(sa_vertex_t *) * state->num_movable_vertices);
+	qsort(seeds, state->num_movable_vertices, sizeof(sa_vertex_t *),
+	      sa_compare_vertex_degree);
+	
+	// The 'counted' flag of each net marks nets which have been expanded so
+	// that each is only expanded once.
+	for (i = 0; i < state->num_movable_vertices; i++) {
+		if (visited[seeds[i]->index])
+			continue;
+		visited[seeds[i]->index] = sa_true;
+		order[tail++] = seeds[i];
+		
+		while (head < tail) {
+			vertex = order[head++];
+			for (j = 0; j < vertex->num_nets; j++) {
+				net = SA_VERTEX_NET(state, vertex, j);
+				if (net->counted)
+					continue;
+				net->counted = sa_true;
+				
+				for (k = 0; k < net->num_vertices; k++) {
+					if (SA_NET_VERTEX(state, net, k)->index < state->num_movable_vertices &&
+					    !visited[SA_NET_VERTEX(state, net, k)->index]) {
+						visited[SA_NET_VERTEX(state, net, k)->index] = sa_true;
+						order[tail++] = SA_NET_VERTEX(state, net, k);
+					}
+				}
+			}
+		}
+	}
+	
+	for (i = 0; i < state->num_nets; i++)
+		state->nets[i]->counted = sa_false;
+}
+
+/**
+ * Does the specified chip have room for the given vertex?
+ */
+static sa_bool_t sa_chip_has_room(sa_state_t *state, int x, int y,
+                                  const sa_vertex_t *vertex) {
+	size_t i;
+	const int *resources = sa_get_chip_resources_ptr(state, x, y);
+	
+	for (i = 0; i < state->num_resource_types; i++)
+		if (resources[i] < vertex->vertex_resources[i])
+			return sa_false;
+	return sa_true;
+}
+
+/**
+ * Find the first chip in chips[start:end] with room for the given vertex.
+ *
+ * @returns The index of the chip or end if none has room.
+ */
+static size_t sa_find_chip_with_room(sa_state_t *state, const int *chips,
+                                     size_t start, size_t end,
+                                     const sa_vertex_t *vertex) {
+	size_t c;
+	
+	for (c = start; c < end; c++)
+		if (sa_chip_has_room(state, chips[c] % (int)state->width,
+		                     chips[c] / (int)state->width, vertex))
+			return c;
+	
+	return end;
+}
+
+sa_bool_t sa_place_initial(sa_state_t *state) {
+	size_t i, c;
+	size_t num_chips;
+	size_t first_open = 0;
+	sa_bool_t success = sa_true;
+	
+	int *chips = malloc(state->width * state->height * sizeof(int));
+	sa_vertex_t **order = malloc(state->num_movable_vertices * sizeof(sa_vertex_t *));
+	sa_vertex_t **seeds = malloc(state->num_movable_vertices * sizeof(sa_vertex_t *));
+	sa_bool_t *visited = calloc(state->num_movable_vertices, sizeof(sa_bool_t));
+	if (chips == NULL || order == NULL || seeds == NULL || visited == NULL) {
+		free(chips);
+		free(order);
+		free(seeds);
+		free(visited);
+		return sa_false;
+	}
+	
+	num_chips = sa_order_live_chips(state, chips);
+	sa_order_movable_vertices(state, order, seeds, visited);
+	
+	// Fill the chips in curve order, keeping a few chips open at once so that
+	// later (smaller) vertices may fill gaps left on recently used chips.
+	for (i = 0; i < state->num_movable_vertices; i++) {
+		c = sa_find_chip_with_room(state, chips, first_open, num_chips, order[i]);
+		if (c == num_chips) {
+			// Fall back on any chip with room left
+			c = sa_find_chip_with_room(state, chips, 0, first_open, order[i]);
+			if (c == first_open) {
+				success = sa_false;
+				break;
+			}
+		} else if (c >= first_open + SA_INITIAL_PLACEMENT_OPEN_CHIPS) {
+			first_open = c + 1 - SA_INITIAL_PLACEMENT_OPEN_CHIPS;
+		}
+		
+		sa_add_vertex_to_chip(state, order[i],
+		                      chips[c] % (int)state->width,
+		                      chips[c] / (int)state->width,
+		                      sa_true);
+	}
+	
+	// If not everything fitted, remove the vertices placed so far
+	if (!success)
+		while (i-- > 0)
+			sa_remove_vertex_from_chip(state, order[i]);
+	
+	free(chips);
+	free(order);
+	free(seeds);
+	free(visited);
+	
+	return success;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Quadratic placement
+////////////////////////////////////////////////////////////////////////////////
+
+// Nets with more than this many vertices are modelled as a star (with an extra
+// variable for the centre of the star) rather than a clique.
+#define SA_QUADRATIC_CLIQUE_MAX_FANOUT 8
+
+// The weight of the spring pulling every vertex towards the centre of the
+// system. This keeps the system solvable when there are no fixed vertices.
+#define SA_QUADRATIC_ANCHOR_WEIGHT 1e-3
+
+// The conjugate gradient solver stops once the residual has been reduced by
+// this factor.
+#define SA_QUADRATIC_TOLERANCE 1e-6
+
+// A sparse symmetric system of equations A.x = b (solved separately for the X
+// and Y axes) whose solution minimises the squared wire length of the nets.
+// There is one variable per movable vertex followed by one per star-modelled
+// net. The off-diagonal elements of A are stored in CSR form as positive
+// weights which are subtracted.
+typedef struct sa_quadratic_system {
+	size_t num_variables;
+	size_t *row_start;
+	size_t *columns;
+	double *weights;
+	double *diagonal;
+	double *rhs_x;
+	double *rhs_y;
+} sa_quadratic_system_t;
+
+/**
+ * Add a spring of the given weight between two endpoints of the system. An
+ * endpoint is either a variable or, if the variable is SIZE_MAX, a fixed
+ * position.
+ *
+ * If system->columns is NULL, only the number of elements in each row is
+ * counted (in row_start[row + 1]), otherwise the elements are filled in, with
+ * row_start[row] being advanced as elements are added.
+ */
+static void sa_quadratic_add_spring(sa_quadratic_system_t *system,
+                                    size_t a, int ax, int ay,
+                                    size_t b, int bx, int by,
+                                    double weight) {
+	if (a == (size_t)-1 && b == (size_t)-1)
+		return;
+	
+	if (system->columns == NULL) {
+		if (a != (size_t)-1 && b != (size_t)-1) {
+			system->row_start[a + 1]++;
+			system->row_start[b + 1]++;
+		}
+		return;
+	}
+	
+	if (a == (size_t)-1) {
+		system->diagonal[b] += weight;
+		system->rhs_x[b] += weight * ax;
+		system->rhs_y[b] += weight * ay;
+	} else if (b == (size_t)-1) {
+		system->diagonal[a] += weight;
+		system->rhs_x[a] += weight * bx;
+		system->rhs_y[a] += weight * by;
+	} else {
+		system->diagonal[a] += weight;
+		system->diagonal[b] += weight;
+		system->columns[system->row_start[a]] = b;
+		system->weights[system->row_start[a]++] = weight;
+		system->columns[system->row_start[b]] = a;
+		system->weights[system->row_start[b]++] = weight;
+	}
+}
+
+/**
+ * Add the springs for every net to the system (see sa_quadratic_add_spring()
+ * for the two modes of operation).
+ */
+static void sa_quadratic_add_nets(sa_state_t *state,
+                                  sa_quadratic_system_t *system) {
+	size_t i, j, k;
+	size_t star = state->num_movable_vertices;
+	size_t a, b;
+	sa_net_t *net;
+	sa_vertex_t *va, *vb;
+	double weight;
+	
+	for (i = 0; i < state->num_nets; i++) {
+		net = state->nets[i];
+		if (net->num_vertices < 2)
+			continue;
+		
+		if (net->num_vertices <= SA_QUADRATIC_CLIQUE_MAX_FANOUT) {
+			weight = net->weight / (net->num_vertices - 1);
+			for (j = 0; j < net->num_vertices; j++) {
+				va = SA_NET_VERTEX(state, net, j);
+				a = (va->index < state->num_movable_vertices) ? va->index : (size_t)-1;
+				for (k = j + 1; k < net->num_vertices; k++) {
+					vb = SA_NET_VERTEX(state, net, k);
+					b = (vb->index < state->num_movable_vertices) ? vb->index : (size_t)-1;
+					sa_quadratic_add_spring(system, a, va->x, va->y,
+					                        b, vb->x, vb->y, weight);
+				}
+			}
+		} else {
+			// The star weight which gives the same total spring constant as the
+			// clique model.
+			weight = (net->weight * net->num_vertices) / (net->num_vertices - 1);
+			for (j = 0; j < net->num_vertices; j++) {
+				va = SA_NET_VERTEX(state, net, j);
+				a = (va->index < state->num_movable_vertices) ? va->index : (size_t)-1;
+				sa_quadratic_add_spring(system, a, va->x, va->y,
+				                        star, 0, 0, weight);
+			}
+			star++;
+		}
+	}
+}
+
+/**
+ * Compute out = A.x for the system.
+ */
+static void sa_quadratic_multiply(const sa_quadratic_system_t *system,
+                                  const double *x, double *out) {
+	size_t i, j;
+	double sum;
+	
+	for (i = 0; i < system->num_variables; i++) {
+		sum = system->diagonal[i] * x[i];
+		for (j = system->row_start[i]; j < system->row_start[i + 1]; j++)
+			sum -= system->weights[j] * x[system->columns[j]];
+		out[i] = sum;
+	}
+}
+
+/**
+ * Solve A.x = b using the Jacobi-preconditioned conjugate gradient method,
+ * starting from the value already in x.
+ *
+ * @param scratch Array of 4*num_variables doubles.
+ */
+static void sa_quadratic_solve(const sa_quadratic_system_t *system,
+                               const double *b, double *x,
+                               size_t max_iterations, double *scratch) {
+	size_t n = system->num_variables;
+	double *r = scratch;
+	double *z = scratch + n;
+	double *p = scratch + (2 * n);
+	double *ap = scratch + (3 * n);
+	double rz, rz_new, b_norm, r_norm, alpha, pap;
+	size_t i, iteration;
+	
+	sa_quadratic_multiply(system, x, ap);
+	rz = 0.0;
+	b_norm = 0.0;
+	for (i = 0; i < n; i++) {
+		r[i] = b[i] - ap[i];
+		z[i] = r[i] / system->diagonal[i];
+		p[i] = z[i];
+		rz += r[i] * z[i];
+		b_norm += b[i] * b[i];
+	}
+	
+	for (iteration = 0; iteration < max_iterations; iteration++) {
+		r_norm = 0.0;
+		for (i = 0; i < n; i++)
+			r_norm += r[i] * r[i];
+		if (r_norm <= SA_QUADRATIC_TOLERANCE * SA_QUADRATIC_TOLERANCE * b_norm ||
+		    rz == 0.0)
+			break;
+		
+		sa_quadratic_multiply(system, p, ap);
+		pap = 0.0;
+		for (i = 0; i < n; i++)
+			pap += p[i] * ap[i];
+		alpha = rz / pap;
+		
+		rz_new = 0.0;
+		for (i = 0; i < n; i++) {
+			x[i] += alpha * p[i];
+			r[i] -= alpha * ap[i];
+			z[i] = r[i] / system->diagonal[i];
+			rz_new += r[i] * z[i];
+		}
+		
+		for (i = 0; i < n; i++)
+			p[i] = z[i] + (rz_new / rz) * p[i];
+		rz = rz_new;
+	}
+}
+
+// A vertex's position along one axis, used when spreading vertices out.
+typedef struct sa_quadratic_rank {
+	double position;
+	size_t index;
+} sa_quadratic_rank_t;
+
+static int sa_compare_quadratic_rank(const void *a, const void *b) {
+	const sa_quadratic_rank_t *ra = (const sa_quadratic_rank_t *)a;
+	const sa_quadratic_rank_t *rb = (const sa_quadratic_rank_t *)b;
+	
+	if (ra->position != rb->position)
+		return (ra->position < rb->position) ? -1 : 1;
+	else
+		return (ra->index < rb->index) ? -1 : (ra->index > rb->index);
+}
+
+/**
+ * Spread the movable vertices out along one axis. The vertices keep their
+ * order along the axis but are redistributed in proportion to the number of
+ * live chips in each column (or row).
+ *
+ * @param positions The positions of the vertices, replaced with the spread
+ *                  positions.
+ * @param live_counts The number of live chips in each column (or row).
+ * @param size The number of columns (or rows).
+ * @param ranks Scratch array of num_movable_vertices elements.
+ */
+static void sa_quadratic_spread(sa_state_t *state, double *positions,
+                                const size_t *live_counts, size_t size,
+                                sa_quadratic_rank_t *ranks) {
+	size_t n = state->num_movable_vertices;
+	size_t i;
+	size_t column = 0;
+	size_t total = 0;
+	size_t before = 0;
+	double q;
+	
+	for (i = 0; i < size; i++)
+		total += live_counts[i];
+	
+	for (i = 0; i < n; i++) {
+		ranks[i].position = positions[i];
+		ranks[i].index = i;
+	}
+	qsort(ranks, n, sizeof(sa_quadratic_rank_t), sa_compare_quadratic_rank);
+	
+	for (i = 0; i < n; i++) {
+		q = ((i + 0.5) / n) * total;
+		while (column < size - 1 && before + live_counts[column] <= q) {
+			before += live_counts[column];
+			column++;
+		}
+		positions[ranks[i].index] = column + ((live_counts[column] > 0)
+		                                      ? (q - before) / live_counts[column]
+		                                      : 0.5);
+	}
+}
+
+/**
+ * An index of the chips which may still have room for a vertex, used when
+ * legalising many vertices one after another so that chips which have filled
+ * up are not visited again. A chip is "exhausted" (and skipped) once it has
+ * less of some resource than the smallest requirement of any vertex to be
+ * placed, at which point no such vertex can fit on it.
+ */
+typedef struct sa_room_index {
+	// Disjoint sets for each row [height][width + 1] giving the nearest chip at
+	// or to the right of a column which is not exhausted (width if none)...
+	int *right;
+	
+	// ...and, offset by one, the nearest at or to the left (0 if none).
+	int *left;
+	
+	// The smallest amount of each resource required by any of the vertices to
+	// be placed. An array [num_resource_types].
+	int *min_resources;
+} sa_room_index_t;
+
+/**
+ * Find the representative of element i in a room index disjoint set, halving
+ * the path followed along the way.
+ */
+static int sa_room_index_find(int *parent, int i) {
+	while (parent[i] != i) {
+		parent[i] = parent[parent[i]];
+		i = parent[i];
+	}
+	return i;
+}
+
+/**
+ * Remove a chip from the room index if it has become exhausted.
+ */
+static void sa_room_index_update(sa_state_t *state, sa_room_index_t *index,
+                                 int x, int y) {
+	size_t i;
+	int row = y * ((int)state->width + 1);
+	const int *resources = sa_get_chip_resources_ptr(state, x, y);
+	
+	for (i = 0; i < state->num_resource_types; i++) {
+		if (resources[i] < index->min_resources[i]) {
+			index->right[row + x] = x + 1;
+			index->left[row + x + 1] = x;
+			return;
+		}
+	}
+}
+
+/**
+ * Build a room index for placing the given vertices onto the chips' current
+ * free resources. Returns false on failure. Should be freed by
+ * sa_free_room_index() either way.
+ */
+static sa_bool_t sa_new_room_index(sa_state_t *state, sa_room_index_t *index,
+                                   sa_vertex_t *const *vertices,
+                                   size_t num_vertices) {
+	size_t i, j;
+	int x, y;
+	int w = (int)state->width;
+	int h = (int)state->height;
+	
+	index->right = malloc(h * (w + 1) * sizeof(int));
+	index->left = malloc(h * (w + 1) * sizeof(int));
+	index->min_resources = malloc(state->num_resource_types * sizeof(int));
+	if (index->right == NULL || index->left == NULL ||
+	    index->min_resources == NULL)
+		return sa_false;
+	
+	for (j = 0; j < state->num_resource_types; j++)
+		index->min_resources[j] = num_vertices ? INT_MAX : 0;
+	for (i = 0; i < num_vertices; i++)
+		for (j = 0; j < state->num_resource_types; j++)
+			if (vertices[i]->vertex_resources[j] < index->min_resources[j])
+				index->min_resources[j] = vertices[i]->vertex_resources[j];
+	
+	for (y = 0; y < h; y++) {
+		for (x = 0; x <= w; x++) {
+			index->right[(y * (w + 1)) + x] = x;
+			index->left[(y * (w + 1)) + x] = x;
+		}
+		for (x = 0; x < w; x++)
+			sa_room_index_update(state, index, x, y);
+	}
+	
+	return sa_true;
+}
+
+/**
+ * Free the arrays of a room index.
+ */
+static void sa_free_room_index(sa_room_index_t *index) {
+	free(index->right);
+	free(index->left);
+	free(index->min_resources);
+}
+
+/**
+ * Find the chip with room for a vertex nearest the given position.
+ *
+ * Rows are searched in order of increasing distance from the position, with
+ * the room index used to step directly between chips in each row which are not
+ * exhausted. When all vertices have the same requirements, every such chip has
+ * room and so each row is visited in near-constant time.
+ *
+ * @returns False if no chip has room for the vertex.
+ */
+static sa_bool_t sa_find_nearest_chip_with_room(sa_state_t *state,
+                                                sa_room_index_t *index,
+                                                double x, double y,
+                                                const sa_vertex_t *vertex,
+                                                int *x_out, int *y_out) {
+	int w = (int)state->width;
+	int h = (int)state->height;
+	int cx = (int)x;
+	int cy = (int)y;
+	int d, side, row, c;
+	int *right, *left;
+	double dy2, distance;
+	double best_distance = 0.0;
+	sa_bool_t found = sa_false;
+	
+	if (cx < 0)
+		cx = 0;
+	if (cx > w - 1)
+		cx = w - 1;
+	if (cy < 0)
+		cy = 0;
+	if (cy > h - 1)
+		cy = h - 1;
+	
+	for (d = 0; d < h; d++) {
+		// Stop once neither row at this distance can hold a nearer chip
+		if ((cy - d < 0 || (found && ((cy - d + 0.5 - y) * (cy - d + 0.5 - y))
+		                             >= best_distance)) &&
+		    (cy + d >= h || (found && ((cy + d + 0.5 - y) * (cy + d + 0.5 - y))
+		                             >= best_distance)))
+			break;
+		
+		for (side = (d == 0) ? 1 : -1; side <= 1; side += 2) {
+			row = cy + (side * d);
+			if (row < 0 || row >= h)
+				continue;
+			dy2 = (row + 0.5 - y) * (row + 0.5 - y);
+			if (found && dy2 >= best_distance)
+				continue;
+			right = index->right + (row * (w + 1));
+			left = index->left + (row * (w + 1));
+			
+			// Search rightward from the position...
+			for (c = sa_room_index_find(right, cx); c < w;
+			     c = sa_room_index_find(right, c + 1)) {
+				distance = dy2 + ((c + 0.5 - x) * (c + 0.5 - x));
+				if (found && distance >= best_distance)
+					break;
+				if (sa_chip_has_room(state, c, row, vertex)) {
+					found = sa_true;
+					best_distance = distance;
+					*x_out = c;
+					*y_out = row;
+					break;
+				}
+			}
+			
+			// ...and leftward.
+			for (c = sa_room_index_find(left, cx) - 1; c >= 0;
+			     c = sa_room_index_find(left, c) - 1) {
+				distance = dy2 + ((c + 0.5 - x) * (c + 0.5 - x));
+				if (found && distance >= best_distance)
+					break;
+				if (sa_chip_has_room(state, c, row, vertex)) {
+					found = sa_true;
+					best_distance = distance;
+					*x_out = c;
+					*y_out = row;
+					break;
+				}
+			}
+		}
+	}
+	
+	return found;
+}
+
+sa_bool_t sa_place_quadratic(sa_state_t *state, size_t max_iterations) {
+	size_t i, x, y;
+	size_t n_movable = state->num_movable_vertices;
+	size_t n;
+	int chip_x = 0;
+	int chip_y = 0;
+	sa_bool_t success = sa_true;
+	sa_quadratic_system_t system;
+	double *positions_x = NULL;
+	double *positions_y = NULL;
+	double *scratch = NULL;
+	size_t *column_live_counts = NULL;
+	size_t *row_live_counts = NULL;
+	sa_quadratic_rank_t *ranks = NULL;
+	sa_room_index_t room_index = {NULL, NULL, NULL};
+	
+	// Number the vertices and count the star-modelled nets
+	for (i = 0; i < state->num_vertices; i++)
+		state->vertices[i]->index = i;
+	n = n_movable;
+	for (i = 0; i < state->num_nets; i++)
+		if (state->nets[i]->num_vertices > SA_QUADRATIC_CLIQUE_MAX_FANOUT)
+			n++;
+	
+	// Count the elements in each row of the system
+	system.num_variables = n;
+	system.row_start = calloc(n + 1, sizeof(size_t));
+	system.columns = NULL;
+	system.weights = NULL;
+	system.diagonal = NULL;
+	system.rhs_x = NULL;
+	system.rhs_y = NULL;
+	if (system.row_start) {
+		sa_quadratic_add_nets(state, &system);
+		for (i = 0; i < n; i++)
+			system.row_start[i + 1] += system.row_start[i];
+		
+		system.columns = malloc((system.row_start[n] + 1) * sizeof(size_t));
+		system.weights = malloc((system.row_start[n] + 1) * sizeof(double));
+		system.diagonal = malloc(n * sizeof(double));
+		system.rhs_x = malloc(n * sizeof(double));
+		system.rhs_y = malloc(n * sizeof(double));
+	}
+	positions_x = malloc(n * sizeof(double));
+	positions_y = malloc(n * sizeof(double));
+	scratch = malloc(4 * n * sizeof(double));
+	column_live_counts = calloc(state->width, sizeof(size_t));
+	row_live_counts = calloc(state->height, sizeof(size_t));
+	ranks = malloc(n_movable * sizeof(sa_quadratic_rank_t));
+	if (system.row_start == NULL || system.columns == NULL ||
+	    system.weights == NULL || system.diagonal == NULL ||
+	    system.rhs_x == NULL || system.rhs_y == NULL ||
+	    positions_x == NULL || positions_y == NULL || scratch == NULL ||
+	    column_live_counts == NULL || row_live_counts == NULL || ranks == NULL) {
+		success = sa_false;
+	}
+	
+	if (success) {
+		// Build the system with every variable weakly anchored to the centre of
+		// the system.
+		for (i = 0; i < n; i++) {
+			system.diagonal[i] = SA_QUADRATIC_ANCHOR_WEIGHT;
+			system.rhs_x[i] = SA_QUADRATIC_ANCHOR_WEIGHT * (state->width - 1) / 2.0;
+			system.rhs_y[i] = SA_QUADRATIC_ANCHOR_WEIGHT * (state->height - 1) / 2.0;
+			positions_x[i] = (state->width - 1) / 2.0;
+			positions_y[i] = (state->height - 1) / 2.0;
+		}
+		sa_quadratic_add_nets(state, &system);
+		
+		// Filling in the elements advanced each row_start to the start of the
+		// following row: shift them back.
+		for (i = n; i > 0; i--)
+			system.row_start[i] = system.row_start[i - 1];
+		system.row_start[0] = 0;
+		
+		sa_quadratic_solve(&system, system.rhs_x, positions_x,
+		                   max_iterations, scratch);
+		sa_quadratic_solve(&system, system.rhs_y, positions_y,
+		                   max_iterations, scratch);
+		
+		// Spread the vertices out over the live chips
+		for (y = 0; y < state->height; y++) {
+			for (x = 0; x < state->width; x++) {
+				if (sa_positive_resources(state, sa_get_chip_resources_ptr(state, x, y))) {
+					column_live_counts[x]++;
+					row_live_counts[y]++;
+				}
+			}
+		}
+		sa_quadratic_spread(state, positions_x, column_live_counts,
+		                    state->width, ranks);
+		sa_quadratic_spread(state, positions_y, row_live_counts,
+		                    state->height, ranks);
+		
+		// Legalise, sweeping up the system (the order left in ranks)
+		success = sa_new_room_index(state, &room_index, state->vertices, n_movable);
+		for (i = 0; success && i < n_movable; i++) {
+			if (!sa_find_nearest_chip_with_room(state, &room_index,
+			                                    positions_x[ranks[i].index],
+			                                    positions_y[ranks[i].index],
+			                                    state->vertices[ranks[i].index],
+			                                    &chip_x, &chip_y)) {
+				success = sa_false;
+				break;
+			}
+			sa_add_vertex_to_chip(state, state->vertices[ranks[i].index],
+			                      chip_x, chip_y, sa_true);
+			sa_room_index_update(state, &room_index, chip_x, chip_y);
+		}
+		
+		// If not everything fitted, remove the vertices placed so far
+		if (!success)
+			while (i-- > 0)
+				sa_remove_vertex_from_chip(state, state->vertices[ranks[i].index]);
+	}
+	
+	free(system.row_start);
+	free(system.columns);
+	free(system.weights);
+	free(system.diagonal);
+	free(system.rhs_x);
+	free(system.rhs_y);
+	free(positions_x);
+	free(positions_y);
+	free(scratch);
+	free(column_live_counts);
+	free(row_live_counts);
+	free(ranks);
+	sa_free_room_index(&room_index);
+	
+	return success;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Multilevel placement
+////////////////////////////////////////////////////////////////////////////////
+
+// Only nets with at most this many vertices are considered when choosing
+// vertices to cluster together.
+#define SA_MULTILEVEL_MAX_MATCH_FANOUT 16
+
+// Coarsening stops once a level would have more than this fraction of the
+// vertices of the level below.
+#define SA_MULTILEVEL_MIN_REDUCTION 0.9
+
+// The number of temperatures the coarsest level is annealed at.
+#define SA_MULTILEVEL_NUM_TEMPERATURES 10
+
+/**
+ * Pair up strongly connected movable vertices (heavy-edge matching).
+ *
+ * A vertex is paired with the unpaired neighbour with which it shares the most
+ * net weight, providing that the pair would fit on the vertex's current chip
+ * when that chip is otherwise empty.
+ *
+ * @param capacities The capacity of every chip (see sa_get_chip_capacities()).
+ * @param cluster Array of num_movable_vertices to be filled with the index of
+ *                the cluster each vertex is assigned to.
+ * @param first_members Array of num_movable_vertices to be filled with the
+ *                      first vertex of each cluster.
+ * @param scores Array of num_movable_vertices doubles, initially all zero.
+ * @param touched Array of num_movable_vertices used as scratch space.
+ *
+ * @returns The number of clusters.
+ */
+static size_t sa_match_vertices(sa_state_t *state, const int *capacities,
+                                size_t *cluster, sa_vertex_t **first_members,
+                                double *scores, size_t *touched) {
+	size_t n = state->num_movable_vertices;
+	size_t num_clusters = 0;
+	size_t num_touched;
+	size_t i, j, k, r, u, best;
+	sa_vertex_t *v;
+	sa_net_t *net;
+	const int *capacity;
+	
+	for (i = 0; i < n; i++)
+		cluster[i] = (size_t)-1;
+	
+	for (i = 0; i < n; i++) {
+		if (cluster[i] != (size_t)-1)
+			continue;
+		v = state->vertices[i];
+		
+		// Accumulate the connection strength to each unpaired neighbour
+		num_touched = 0;
+		for (j = 0; j < v->num_nets; j++) {
+			net = SA_VERTEX_NET(state, v, j);
+			if (net->num_vertices < 2 || net->weight <= 0.0 ||
+			    net->num_vertices > SA_MULTILEVEL_MAX_MATCH_FANOUT)
+				continue;
+			for (k = 0; k < net->num_vertices; k++) {
+				u = SA_NET_VERTEX(state, net, k)->index;
+				if (u >= n || u == i || cluster[u] != (size_t)-1)
+					continue;
+				if (scores[u] == 0.0)
+					touched[num_touched++] = u;
+				scores[u] += net->weight / (net->num_vertices - 1);
+			}
+		}
+		
+		// Pick the strongest neighbour which the vertex would fit with
+		capacity = capacities + (
+			(v->y * state->width * state->num_resource_types)
+			+ (v->x * state->num_resource_types)
+		);
+		best = (size_t)-1;
+		for (j = 0; j < num_touched; j++) {
+			u = touched[j];
+			for (r = 0; r < state->num_resource_types; r++)
+				if (v->vertex_resources[r] + state->vertices[u]->vertex_resources[r]
+				    > capacity[r])
+					break;
+			if (r == state->num_resource_types &&
+			    (best == (size_t)-1 || scores[u] > scores[best]))
+				best = u;
+		}
+		for (j = 0; j < num_touched; j++)
+			scores[touched[j]] = 0.0;
+		
+		first_members[num_clusters] = v;
+		cluster[i] = num_clusters;
+		if (best != (size_t)-1)
+			cluster[best] = num_clusters;
+		num_clusters++;
+	}
+	
+	return num_clusters;
+}
+
+/**
+ * Build a coarsened copy of a state in which pairs of strongly connected
+ * movable vertices are merged into single vertices with the combined resources
+ * of the pair. Each net connects the coarse vertices its vertices were merged
+ * into (nets left with fewer than two vertices are dropped) and non-movable
+ * vertices are copied as they are. Each coarse vertex is placed on the chip of
+ * the first of its vertices or, if there isn't room, the nearest chip with
+ * room.
+ *
+ * @param cluster Array of num_movable_vertices to be filled with the index of
+ *                the coarse vertex each movable vertex was merged into.
+ * @param out_of_memory Set to true if NULL is returned because memory
+ *                      allocation failed and false otherwise.
+ *
+ * @returns The coarse state or NULL if the state could not be usefully
+ *          coarsened or if memory allocation failed.
+ */
+static sa_state_t *sa_new_coarse_state(sa_state_t *state, size_t *cluster,
+                                       sa_bool_t *out_of_memory) {
+	size_t n = state->num_movable_vertices;
+	size_t num_fixed = state->num_vertices - n;
+	size_t num_clusters = 0;
+	size_t num_coarse_nets = 0;
+	size_t num_pins;
+	size_t i, j, c, pin;
+	int x, y;
+	sa_bool_t success;
+	sa_bool_t useful = sa_true;
+	sa_state_t *coarse = NULL;
+	sa_vertex_t *v;
+	sa_net_t *net;
+	sa_net_t *coarse_net;
+	sa_room_index_t room_index = {NULL, NULL, NULL};
+	
+	int *capacities = malloc(state->width * state->height *
+	                         state->num_resource_types * sizeof(int));
+	sa_vertex_t **first_members = malloc(n * sizeof(sa_vertex_t *));
+	double *scores = calloc(n, sizeof(double));
+	size_t *touched = malloc(n * sizeof(size_t));
+	size_t *num_nets = NULL;
+	size_t *stamps = NULL;
+	
+	success = capacities && first_members && scores && touched;
+	
+	// Choose the clusters
+	if (success) {
+		for (i = 0; i < state->num_vertices; i++)
+			state->vertices[i]->index = i;
+		sa_get_chip_capacities(state, capacities);
+		num_clusters = sa_match_vertices(state, capacities, cluster,
+		                                 first_members, scores, touched);
+		useful = num_clusters <= n * SA_MULTILEVEL_MIN_REDUCTION;
+		success = useful;
+	}
+	
+	// Count the coarse nets and the number of nets of each coarse vertex. The
+	// stamps record which net last counted a coarse vertex so that each is only
+	// counted once per net.
+	if (success) {
+		num_nets = calloc(num_clusters + num_fixed, sizeof(size_t));
+		stamps = malloc((num_clusters + num_fixed) * sizeof(size_t));
+		success = num_nets && stamps;
+	}
+	if (success) {
+		for (c = 0; c < num_clusters + num_fixed; c++)
+			stamps[c] = (size_t)-1;
+		for (i = 0; i < state->num_nets; i++) {
+			net = state->nets[i];
+			num_pins = 0;
+			for (j = 0; j < net->num_vertices; j++) {
+				pin = SA_NET_VERTEX(state, net, j)->index;
+				c = (pin < n) ? cluster[pin] : num_clusters + (pin - n);
+				if (stamps[c] != i) {
+					stamps[c] = i;
+					num_pins++;
+				}
+			}
+			if (num_pins >= 2) {
+				num_coarse_nets++;
+				for (j = 0; j < net->num_vertices; j++) {
+					pin = SA_NET_VERTEX(state, net, j)->index;
+					c = (pin < n) ? cluster[pin] : num_clusters + (pin - n);
+					if (stamps[c] == i) {
+						stamps[c] = (size_t)-2;
+						num_nets[c]++;
+					}
+				}
+				for (j = 0; j < net->num_vertices; j++) {
+					pin = SA_NET_VERTEX(state, net, j)->index;
+					c = (pin < n) ? cluster[pin] : num_clusters + (pin - n);
+					stamps[c] = i;
+				}
+			}
+		}
+		
+		coarse = sa_new_with_policy(state->width, state->height,
+		                            state->num_resource_types,
+		                            num_clusters + num_fixed, num_coarse_nets,
+		                            state->alloc_policy);
+		success = coarse != NULL;
+	}
+	
+	// Copy the system and settings
+	if (success) {
+		coarse->has_wrap_around_links = state->has_wrap_around_links;
+		coarse->cost_model = state->cost_model;
+		coarse->custom_net_cost = state->custom_net_cost;
+		coarse->custom_net_cost_data = state->custom_net_cost_data;
+		coarse->net_histogram_min_fanout = state->net_histogram_min_fanout;
+		coarse->frozen_net_min_fanout = state->frozen_net_min_fanout;
+		coarse->frozen_net_resync_interval = state->frozen_net_resync_interval;
+		coarse->congestion_weight = state->congestion_weight;
+		coarse->link_capacity = state->link_capacity;
+		coarse->vertex_selection = state->vertex_selection;
+		coarse->rng = state->rng;
+		coarse->rng_seed = state->rng_seed;
+		coarse->rng_stream = state->rng_stream;
+		sa_set_rng_step(coarse, state->rng_step);
+		for (i = 0; i < SA_NUM_MOVE_TYPES; i++)
+			coarse->move_weights[i] = state->move_weights[i];
+		
+		// The non-movable vertices' resources are already accounted for in the
+		// capacities and so the coarse copies of them consume nothing.
+		memcpy(coarse->chip_resources, capacities,
+		       state->width * state->height * state->num_resource_types *
+		       sizeof(int));
+		coarse->num_movable_vertices = num_clusters;
+		
+		for (c = 0; c < num_clusters + num_fixed; c++)
+			coarse->vertices[c] = NULL;
+		for (i = 0; i < num_coarse_nets; i++)
+			coarse->nets[i] = NULL;
+		
+		for (c = 0; c < num_clusters + num_fixed && success; c++) {
+			coarse->vertices[c] = sa_new_vertex(coarse, num_nets[c]);
+			success = coarse->vertices[c] != NULL;
+			if (success)
+				coarse->vertices[c]->index = c;
+		}
+	}
+	
+	// Create the coarse nets, filling in the nets of each vertex as we go
+	// (num_nets is reused to count the nets added to each vertex)
+	if (success) {
+		for (c = 0; c < num_clusters + num_fixed; c++) {
+			num_nets[c] = 0;
+			stamps[c] = (size_t)-1;
+		}
+		num_coarse_nets = 0;
+		for (i = 0; i < state->num_nets && success; i++) {
+			net = state->nets[i];
+			num_pins = 0;
+			for (j = 0; j < net->num_vertices; j++) {
+				pin = SA_NET_VERTEX(state, net, j)->index;
+				c = (pin < n) ? cluster[pin] : num_clusters + (pin - n);
+				if (stamps[c] != i) {
+					stamps[c] = i;
+					num_pins++;
+				}
+			}
+			if (num_pins < 2)
+				continue;
+			
+			coarse_net = sa_new_net(coarse, num_pins);
+			if (coarse_net == NULL) {
+				success = sa_false;
+				break;
+			}
+			coarse_net->weight = net->weight;
+			coarse_net->index = num_coarse_nets;
+			coarse->nets[num_coarse_nets++] = coarse_net;
+			
+			// The net's vertices keep their order so that the first vertex
+			// (the source of the net) remains first.
+			num_pins = 0;
+			for (j = 0; j < net->num_vertices; j++) {
+				pin = SA_NET_VERTEX(state, net, j)->index;
+				c = (pin < n) ? cluster[pin] : num_clusters + (pin - n);
+				if (stamps[c] == i) {
+					stamps[c] = (size_t)-2;
+					v = coarse->vertices[c];
+					coarse_net->vertices[num_pins++] = SA_VERTEX_REF(v);
+					v->nets[num_nets[c]++] = SA_NET_REF(coarse_net);
+				}
+			}
+			for (j = 0; j < net->num_vertices; j++) {
+				pin = SA_NET_VERTEX(state, net, j)->index;
+				c = (pin < n) ? cluster[pin] : num_clusters + (pin - n);
+				stamps[c] = i;
+			}
+		}
+	}
+	
+	// Place the vertices
+	if (success) {
+		for (i = 0; i < n; i++)
+			sa_add_resources(coarse, coarse->vertices[cluster[i]]->vertex_resources,
+			                 state->vertices[i]->vertex_resources);
+		for (i = 0; i < num_fixed; i++)
+			sa_add_vertex_to_chip(coarse, coarse->vertices[num_clusters + i],
+			                      state->vertices[n + i]->x,
+			                      state->vertices[n + i]->y, sa_false);
+		success = sa_new_room_index(coarse, &room_index, coarse->vertices,
+		                            num_clusters);
+		for (c = 0; c < num_clusters && success; c++) {
+			v = coarse->vertices[c];
+			x = first_members[c]->x;
+			y = first_members[c]->y;
+			if (!sa_chip_has_room(coarse, x, y, v)) {
+				useful = sa_find_nearest_chip_with_room(coarse, &room_index,
+				                                        x + 0.5, y + 0.5,
+				                                        v, &x, &y);
+				success = useful;
+			}
+			if (success) {
+				sa_add_vertex_to_chip(coarse, v, x, y, sa_true);
+				sa_room_index_update(coarse, &room_index, x, y);
+			}
+		}
+	}
+	
+	if (success)
+		success = sa_prepare(coarse);
+	
+	// Anything other than too little reduction or no room for a coarse vertex
+	// is an allocation failure
+	*out_of_memory = !success && useful;
+	
+	if (!success && coarse) {
+		sa_free(coarse);
+		coarse = NULL;
+	}
+	
+	free(capacities);
+	free(first_members);
+	free(scores);
+	free(touched);
+	free(num_nets);
+	free(stamps);
+	sa_free_room_index(&room_index);
+	
+	return coarse;
+}
+
+sa_bool_t sa_run_multilevel(sa_state_t *state, size_t num_levels,
+                            size_t num_steps, int distance_limit,
+                            double temperature, double refine_temperature) {
+	size_t i;
+	size_t n = state->num_movable_vertices;
+	size_t num_accepted;
+	double cost_delta;
+	double cost_delta_sd;
+	sa_bool_t success = sa_true;
+	sa_bool_t out_of_memory = sa_false;
+	sa_state_t *coarse = NULL;
+	size_t *cluster = NULL;
+	sa_vertex_t *v;
+	
+	// If the coarse state can't be built for lack of memory, this level is
+	// still annealed flat so that the placement is valid but failure reported
+	if (num_levels > 1) {
+		cluster = malloc(n * sizeof(size_t));
+		if (cluster)
+			coarse = sa_new_coarse_state(state, cluster, &out_of_memory);
+		if (!cluster || out_of_memory)
+			success = sa_false;
+	}
+	
+	if (coarse) {
+		// Place the coarse problem and then project its placement back
+		success = sa_run_multilevel(coarse, num_levels - 1, num_steps,
+		                            distance_limit, temperature,
+		                            refine_temperature);
+		sa_set_rng_step(state, coarse->rng_step);
+		for (i = 0; i < n; i++)
+			sa_remove_vertex_from_chip(state, state->vertices[i]);
+		for (i = 0; i < n; i++) {
+			v = coarse->vertices[cluster[i]];
+			sa_add_vertex_to_chip(state, state->vertices[i], v->x, v->y, sa_true);
+		}
+		sa_free(coarse);
+		
+		// The cached net costs used for vertex selection are not updated by the
+		// moves above.
+		if (state->vertex_weights && !sa_prepare(state))
+			success = sa_false;
+		
+		// Refine
+		sa_run_steps(state, num_steps, distance_limit, refine_temperature,
+		             &num_accepted, &cost_delta, &cost_delta_sd);
+	} else {
+		// This is the coarsest level: anneal, cooling linearly from the initial
+		// temperature to the refinement temperature.
+		for (i = 0; i < SA_MULTILEVEL_NUM_TEMPERATURES; i++)
+			sa_run_steps(state, num_steps / SA_MULTILEVEL_NUM_TEMPERATURES,
+			             distance_limit,
+			             temperature + ((refine_temperature - temperature) * i
+			                            / (SA_MULTILEVEL_NUM_TEMPERATURES - 1)),
+			             &num_accepted, &cost_delta, &cost_delta_sd);
+	}
+	
+	free(cluster);
+	
+	return success;
+}
+
+/**
+ * Get the size of the minimal interval containing every one of two sorted
+ * arrays of coordinates (either of which may be empty, but not both) on an
+ * axis of n chips with wrap-around links.
+ *
+ * To do this the largest gap between any pair of coordinates is found:
+ *
+ *     |    x     x             x   |
+ *                ^-------------^
+ *                    max gap
+ *
+ * The minimal interval then goes the other way around:
+ *
+ *     |    x     x             x   |
+ *      ----------^             ^---
+ */
+static int sa_wrapped_extent(const int *a, size_t num_a,
+                             const int *b, size_t num_b, int n) {
+	size_t i = 0, j = 0;
+	int delta, value;
+	int last;
+	int max_delta = 0;
+	
+	// Walk the two arrays in merged order, starting from the largest
+	// coordinate (wrapped around)
+	if (num_b == 0 || (num_a > 0 && a[num_a - 1] > b[num_b - 1]))
+		last = a[num_a - 1] - n;
+	else
+		last = b[num_b - 1] - n;
+	
+	while (i < num_a || j < num_b) {
+		if (j >= num_b || (i < num_a && a[i] <= b[j]))
+			value = a[i++];
+		else
+			value = b[j++];
+		delta = value - last;
+		last = value;
+		if (delta > max_delta)
+			max_delta = delta;
+	}
+	
+	return n - max_delta;
+}
+
+/**
+ * Get the number of a net's vertices which must be visited to compute its
+ * cost using the HPWL model: any non-movable vertices summarised by
+ * net->fixed_coords are at the end of the net and may be skipped.
+ */
+static size_t sa_get_num_hpwl_vertices(const sa_net_t *net) {
+	if (net->fixed_coords)
+		return net->num_vertices - net->num_fixed_vertices;
+	else
+		return net->num_vertices;
+}
+
+/**
+ * Compute the HPWL model cost of a net with at least two vertices given the
+ * positions of its first sa_get_num_hpwl_vertices() vertices. The arrays are
+ * sorted when there are wrap-around links.
+ */
+static double sa_get_hpwl_cost(const sa_state_t *state, const sa_net_t *net,
+                               int *xs, int *ys, size_t length) {
+	size_t i;
+	const int *fixed_xs = net->fixed_coords;
+	const int *fixed_ys = NULL;
+	size_t num_fixed_xs = 0, num_fixed_ys = 0;
+	int bbox_width, bbox_height;
+	int min_x, max_x, min_y, max_y;
+	
+	if (fixed_xs) {
+		num_fixed_xs = net->num_fixed_xs;
+		num_fixed_ys = net->num_fixed_ys;
+		fixed_ys = fixed_xs + num_fixed_xs;
+	}
+	
+	if (state->has_wrap_around_links) {
+		// Torroidal network: When wrap-around links exist, we find the minimal
+		// bounding box (see sa_wrapped_extent()) and return the HPWL weighted by
+		// the net weight.
+		sort(state, xs, length);
+		sort(state, ys, length);
+		bbox_width = sa_wrapped_extent(xs, length, fixed_xs, num_fixed_xs,
+		                               (int)state->width);
+		bbox_height = sa_wrapped_extent(ys, length, fixed_ys, num_fixed_ys,
+		                                (int)state->height);
+	} else {
+		// Non-toriodal network: Compute bounding box, starting from that of the
+		// non-movable vertices (if known)
+		if (fixed_xs) {
+			min_x = fixed_xs[0];
+			max_x = fixed_xs[num_fixed_xs - 1];
+			min_y = fixed_ys[0];
+			max_y = fixed_ys[num_fixed_ys - 1];
+		} else {
+			min_x = max_x = xs[0];
+			min_y = max_y = ys[0];
+		}
+		for (i = 0; i < length; i++) {
+			if (xs[i] < min_x)
+				min_x = xs[i];
+			if (max_x < xs[i])
+				max_x = xs[i];
+			if (ys[i] < min_y)
+				min_y = ys[i];
+			if (max_y < ys[i])
+				max_y = ys[i];
+		}
+		bbox_width = max_x - min_x;
+		bbox_height = max_y - min_y;
+	}
+	
+	return sqrt(net->num_vertices) * (bbox_width + bbox_height) * net->weight;
+}
+
+/**
+ * Compute the cost of a net using the HPWL model.
+ */
+static double sa_get_net_cost_hpwl(sa_state_t *state, sa_net_t *net) {
+	size_t i;
+	size_t length;
+	int *xs, *ys;
+	int bbox_width, bbox_height;
+		
+	// If 1 or 0 vertices in the net, the net can never have non-zero cost. This
+	// also saves some special-case handling below.
+	if (net->num_vertices <= 1)
+		return 0.0;
+	
+	// High-fanout nets: the bounding box is maintained by the histogram
+	if (net->histogram) {
+		bbox_width = sa_axis_histogram_extent(&net->histogram->x,
+		                                      (int)state->width,
+		                                      state->has_wrap_around_links);
+		bbox_height = sa_axis_histogram_extent(&net->histogram->y,
+		                                       (int)state->height,
+		                                       state->has_wrap_around_links);
+		return sqrt(net->num_vertices) * (bbox_width + bbox_height) * net->weight;
+	}
+	
+	// Gather the positions of the vertices not summarised by net->fixed_coords
+	// (the array is never empty to keep alloca happy)
+	length = sa_get_num_hpwl_vertices(net);
+	xs = alloca((length + 1) * sizeof(int));
+	ys = alloca((length + 1) * sizeof(int));
+	for (i = 0; i < length; i++) {
+		xs[i] = SA_NET_VERTEX(state, net, i)->x;
+		ys[i] = SA_NET_VERTEX(state, net, i)->y;
+	}
+	
+	return sa_get_hpwl_cost(state, net, xs, ys, length);
+}
+
+/**
+ * Compute the sum of the distances between every pair of a sorted array of
+ * coordinates on an axis of n chips.
+ */
+static double sa_sum_pairwise_distances(const sa_state_t *state,
+                                        const int *sorted, size_t length, int n) {
+	size_t i, k;
+	double total = 0.0;
+	
+	// prefix[i] is the sum of the first i coordinates
+	double *prefix = alloca((length + 1) * sizeof(double));
+	prefix[0] = 0.0;
+	for (i = 0; i < length; i++)
+		prefix[i + 1] = prefix[i] + sorted[i];
+	
+	// For each coordinate, the coordinates after it up to index k are reached
+	// directly, those beyond k (with wrap-around links) are reached more quickly
+	// by going the other way around the axis.
+	k = 0;
+	for (i = 0; i < length; i++) {
+		if (k < i)
+			k = i;
+		if (state->has_wrap_around_links) {
+			while (k + 1 < length && 2 * (sorted[k + 1] - sorted[i]) <= n)
+				k++;
+		} else {
+			k = length - 1;
+		}
+		
+		total += (prefix[k + 1] - prefix[i + 1]) - ((double)(k - i) * sorted[i]);
+		total += ((double)(length - 1 - k) * (n + sorted[i])) - (prefix[length] - prefix[k + 1]);
+	}
+	
+	return total;
+}
+
+/**
+ * Compute the clique model cost of a net of the given weight whose (at least
+ * two) vertices are at the given positions. The arrays are sorted as a
+ * side-effect.
+ */
+static double sa_get_clique_cost(const sa_state_t *state, double weight,
+                                 int *xs, int *ys, size_t length) {
+	double total;
+	
+	sort(state, xs, length);
+	sort(state, ys, length);
+	
+	total = sa_sum_pairwise_distances(state, xs, length, (int)state->width)
+	        + sa_sum_pairwise_distances(state, ys, length, (int)state->height);
+	return total / (length - 1) * weight;
+}
+
+/**
+ * Compute the cost of a net using the clique model.
+ */
+static double sa_get_net_cost_clique(sa_state_t *state, sa_net_t *net) {
+	size_t i;
+	int *xs, *ys;
+	
+	if (net->num_vertices <= 1)
+		return 0.0;
+	
+	xs = alloca(net->num_vertices * sizeof(int));
+	ys = alloca(net->num_vertices * sizeof(int));
+	for (i = 0; i < net->num_vertices; i++) {
+		xs[i] = SA_NET_VERTEX(state, net, i)->x;
+		ys[i] = SA_NET_VERTEX(state, net, i)->y;
+	}
+	
+	return sa_get_clique_cost(state, net->weight, xs, ys, net->num_vertices);
+}
+
+/**
+ * Compute the cost of a net using the star model, optionally with hexagonal
+ * distances.
+ */
+SA_SPECIALISED double sa_get_net_cost_star(sa_state_t *state, sa_net_t *net,
+                                           const sa_bool_t hexagonal) {
+	size_t i;
+	int sx, sy;
+	int stride;
+	const int *distances;
+	int total = 0;
+	
+	if (net->num_vertices <= 1)
+		return 0.0;
+	
+	sx = SA_NET_VERTEX(state, net, 0)->x;
+	sy = SA_NET_VERTEX(state, net, 0)->y;
+	
+	// If available, look up distances in the table relative to the source
+	if (state->distance_table) {
+		stride = (2 * (int)state->width) - 1;
+		distances = state->distance_table
+		            + ((((int)state->height - 1) - sy) * stride)
+		            + (((int)state->width - 1) - sx);
+		for (i = 1; i < net->num_vertices; i++)
+			total += distances[(SA_NET_VERTEX(state, net, i)->y * stride) + SA_NET_VERTEX(state, net, i)->x];
+		return total * net->weight;
+	}
+	
+	for (i = 1; i < net->num_vertices; i++) {
+		if (hexagonal)
+			total += sa_hex_distance(state, sx, sy,
+			                         SA_NET_VERTEX(state, net, i)->x, SA_NET_VERTEX(state, net, i)->y);
+		else
+			total += sa_axis_distance(state, sx, SA_NET_VERTEX(state, net, i)->x, (int)state->width)
+			         + sa_axis_distance(state, sy, SA_NET_VERTEX(state, net, i)->y, (int)state->height);
+	}
+	
+	return total * net->weight;
+}
+
+/**
+ * Compute the cost of a net using the specified cost model. When model is a
+ * constant, the model selection is resolved at compile time.
+ */
+SA_SPECIALISED double sa_get_net_cost_model(sa_state_t *state, sa_net_t *net,
+                                            const sa_cost_model_t model) {
+	switch (model) {
+		default:
+		case SA_COST_MODEL_HPWL:
+			return sa_get_net_cost_hpwl(state, net);
+		case SA_COST_MODEL_CLIQUE:
+			return sa_get_net_cost_clique(state, net);
+		case SA_COST_MODEL_STAR:
+			return sa_get_net_cost_star(state, net, sa_false);
+		case SA_COST_MODEL_HEX_STAR:
+			return sa_get_net_cost_star(state, net, sa_true);
+		case SA_COST_MODEL_CUSTOM:
+			return state->custom_net_cost(state, net, state->custom_net_cost_data);
+	}
+}
+
+double sa_get_net_cost(sa_state_t *state, sa_net_t *net) {
+	return sa_get_net_cost_model(state, net, state->cost_model);
+}
+
+/**
+ * Compute the cost of a net if its vertices were at the given positions (the
+ * source first) using the specified cost model. For the HPWL model only the
+ * positions of the first sa_get_num_hpwl_vertices() vertices are given, for
+ * the other models those of every vertex. Unlike sa_get_net_cost_model() this
+ * neither reads the positions of the net's vertices nor updates any cached
+ * state. The arrays may be reordered. The custom cost model is not supported.
+ */
+SA_SPECIALISED double sa_get_positions_cost_model(const sa_state_t *state,
+                                                  const sa_net_t *net,
+                                                  int *xs, int *ys, size_t length,
+                                                  const sa_cost_model_t model) {
+	size_t i;
+	int stride;
+	int total = 0;
+	double weight = net->weight;
+	
+	if (net->num_vertices <= 1)
+		return 0.0;
+	
+	switch (model) {
+		default:
+		case SA_COST_MODEL_HPWL:
+			return sa_get_hpwl_cost(state, net, xs, ys, length);
+		
+		case SA_COST_MODEL_CLIQUE:
+			return sa_get_clique_cost(state, weight, xs, ys, length);
+		
+		case SA_COST_MODEL_STAR:
+		case SA_COST_MODEL_HEX_STAR:
+			stride = (2 * (int)state->width) - 1;
+			for (i = 1; i < length; i++) {
+				if (state->distance_table)
+					total += state->distance_table[
+						(((int)state->height - 1) + (ys[i] - ys[0])) * stride
+						+ (((int)state->width - 1) + (xs[i] - xs[0]))];
+				else if (model == SA_COST_MODEL_HEX_STAR)
+					total += sa_hex_distance(state, xs[0], ys[0], xs[i], ys[i]);
+				else
+					total += sa_axis_distance(state, xs[0], xs[i], (int)state->width)
+					         + sa_axis_distance(state, ys[0], ys[i], (int)state->height);
+			}
+			return total * weight;
+		
+		case SA_COST_MODEL_CUSTOM:
+			assert(model != SA_COST_MODEL_CUSTOM);
+			return 0.0;
+	}
+}
+
+// The number of nets in each of the chunks which sa_get_total_cost() sums
+// independently (and possibly in parallel). The chunks do not depend on the
+// number of threads used and so neither does the result.
+#define SA_TOTAL_COST_CHUNK 1024
+
+/**
+ * Sum the costs of the nets [start, end) using the specified cost model and
+ * Kahan summation, optionally recording the cost of each net in net_costs.
+ * Unless net_costs is given, nets included in state->fixed_net_cost are
+ * skipped.
+ */
+SA_SPECIALISED double sa_sum_net_costs_model(sa_state_t *state,
+                                             size_t start, size_t end,
+                                             double *net_costs,
+                                             const sa_cost_model_t model) {
+	size_t i;
+	double cost, y, t;
+	double total = 0.0;
+	double compensation = 0.0;
+	
+	for (i = start; i < end; i++) {
+		if (!net_costs && model != SA_COST_MODEL_CUSTOM &&
+		    state->nets[i]->num_fixed_vertices == state->nets[i]->num_vertices)
+			continue;
+		
+		cost = sa_get_net_cost_model(state, state->nets[i], model);
+		if (net_costs)
+			net_costs[i] = cost;
+		
+		y = cost - compensation;
+		t = total + y;
+		compensation = (t - total) - y;
+		total = t;
+	}
+	
+	return total;
+}
+
+/**
+ * Sum an array of values using pairwise summation.
+ */
+static double sa_sum_pairwise(const double *values, size_t n) {
+	if (n == 0)
+		return 0.0;
+	else if (n == 1)
+		return values[0];
+	else
+		return sa_sum_pairwise(values, n / 2)
+		       + sa_sum_pairwise(values + (n / 2), n - (n / 2));
+}
+
+/**
+ * Sum the cost of every net using the specified cost model.
+ *
+ * The nets are split into chunks of SA_TOTAL_COST_CHUNK which are summed
+ * independently, in parallel when OpenMP is available, and the chunk totals
+ * then combined pairwise. Custom cost functions are always called from a
+ * single thread since they need not be thread-safe.
+ */
+SA_SPECIALISED double sa_get_total_cost_model(sa_state_t *state,
+                                              double *net_costs,
+                                              const sa_cost_model_t model) {
+	long c;
+	long num_chunks = (long)((state->num_nets + SA_TOTAL_COST_CHUNK - 1)
+	                         / SA_TOTAL_COST_CHUNK);
+	double *chunk_totals;
+	size_t end;
+#if defined(_OPENMP)
+	int num_threads = (state->num_threads > 0) ? (int)state->num_threads
+	                                           : omp_get_max_threads();
+#endif
+	
+	if (num_chunks <= 1)
+		return sa_sum_net_costs_model(state, 0, state->num_nets, net_costs, model);
+	
+	chunk_totals = alloca(num_chunks * sizeof(double));
+#if defined(_OPENMP)
+	#pragma omp parallel for private(end) schedule(dynamic) \
+	                         num_threads(num_threads) \
+	                         if(model != SA_COST_MODEL_CUSTOM && num_threads > 1)
+#endif
+	for (c = 0; c < num_chunks; c++) {
+		end = (c + 1) * SA_TOTAL_COST_CHUNK;
+		if (end > state->num_nets)
+			end = state->num_nets;
+		chunk_totals[c] = sa_sum_net_costs_model(state, c * SA_TOTAL_COST_CHUNK,
+		                                         end, net_costs, model);
+	}
+	
+	return sa_sum_pairwise(chunk_totals, num_chunks);
+}
+
+double sa_get_total_cost(sa_state_t *state) {
+	return sa_get_total_cost_per_net(state, NULL);
+}
+
+double sa_get_total_cost_per_net(sa_state_t *state, double *net_costs) {
+	double total;
+	switch (state->cost_model) {
+		default:
+		case SA_COST_MODEL_HPWL:
+			total = sa_get_total_cost_model(state, net_costs, SA_COST_MODEL_HPWL);
+			break;
+		case SA_COST_MODEL_CLIQUE:
+			total = sa_get_total_cost_model(state, net_costs, SA_COST_MODEL_CLIQUE);
+			break;
+		case SA_COST_MODEL_STAR:
+			total = sa_get_total_cost_model(state, net_costs, SA_COST_MODEL_STAR);
+			break;
+		case SA_COST_MODEL_HEX_STAR:
+			total = sa_get_total_cost_model(state, net_costs, SA_COST_MODEL_HEX_STAR);
+			break;
+		case SA_COST_MODEL_CUSTOM:
+			total = sa_get_total_cost_model(state, net_costs, SA_COST_MODEL_CUSTOM);
+			break;
+	}
+	
+	// Nets which cannot move were only skipped when their costs weren't wanted
+	if (!net_costs)
+		total += state->fixed_net_cost;
+	
+	return total + sa_get_congestion_cost(state);
+}
+
+/**
+ * sa_get_swap_cost for a specific cost model.
+ */
+SA_SPECIALISED double sa_get_swap_cost_model(sa_state_t *state,
+                                             int ax, int ay, sa_vertex_t *va,
+                                             int bx, int by, sa_vertex_t *vb,
+                                             const sa_cost_model_t model) {
+	int which_verts;
+	size_t i;
+	sa_vertex_t *v;
+	double after_cost;
+	
+	// The congestion cost is updated as the vertices are moved
+	double before_congestion_cost = state->congestion_cost;
+	
+	// Calculate total cost of all nets before swap
+	double before_cost = 0.0;
+	for (which_verts = 0; which_verts < 2; which_verts++) {
+		sa_vertex_t *v = (which_verts == 0) ? va : vb;
+		while (v) {
+			for (i = 0; i < v->num_nets; i++) {
+				if (!SA_VERTEX_NET(state, v, i)->counted &&
+				    !SA_VERTEX_NET(state, v, i)->frozen) {
+					before_cost += sa_get_net_cost_model(state, SA_VERTEX_NET(state, v, i), model);
+					SA_VERTEX_NET(state, v, i)->counted = sa_true;
+				}
+			}
+			v = v->next;
+		}
+	}
+	
+	// Swap the positions of all va and all vb. Note that since these vertices
+	// have been removed and will later be re-added to the chip, restoring the
+	// values of x and y if required.
+	v = va;
+	while (v) {
+		sa_set_vertex_position(state, v, bx, by);
+		v = v->next;
+	}
+	v = vb;
+	while (v) {
+		sa_set_vertex_position(state, v, ax, ay);
+		v = v->next;
+	}
+	
+	// Calculate the cost after swap
+	after_cost = 0.0;
+	for (which_verts = 0; which_verts < 2; which_verts++) {
+		sa_vertex_t *v = (which_verts == 0) ? va : vb;
+		while (v) {
+			for (i = 0; i < v->num_nets; i++) {
+				if (SA_VERTEX_NET(state, v, i)->counted) { // Meaning inverted in this pass
+					after_cost += sa_get_net_cost_model(state, SA_VERTEX_NET(state, v, i), model);
+					SA_VERTEX_NET(state, v, i)->counted = sa_false; // Meaning inverted in this pass
+				}
+			}
+			v = v->next;
+		}
+	}
+	
+	return (after_cost - before_cost)
+	       + (state->congestion_cost - before_congestion_cost);
+}
+
+double sa_get_swap_cost(sa_state_t *state,
+                        int ax, int ay, sa_vertex_t *va,
+                        int bx, int by, sa_vertex_t *vb) {
+	return sa_get_swap_cost_model(state, ax, ay, va, bx, by, vb, state->cost_model);
+}
+
+sa_visit_t *sa_new_visit(const sa_state_t *state) {
+	sa_visit_t *visit = malloc(sizeof(sa_visit_t));
+	if (visit == NULL)
+		return NULL;
+	
+	visit->epoch = 1;
+	visit->net_stamps = calloc(state->num_nets, sizeof(unsigned int));
+	visit->vertex_stamps = calloc(state->num_vertices, sizeof(unsigned int));
+	if (visit->net_stamps == NULL || visit->vertex_stamps == NULL) {
+		sa_free_visit(visit);
+		return NULL;
+	}
+	
+	return visit;
+}
+
+void sa_free_visit(sa_visit_t *visit) {
+	if (!visit)
+		return;
+	
+	free(visit->net_stamps);
+	free(visit->vertex_stamps);
+	free(visit);
+}
+
+/**
+ * sa_get_swap_cost_pure for a specific cost model.
+ */
+SA_SPECIALISED double sa_get_swap_cost_pure_model(const sa_state_t *state,
+                                                  sa_visit_t *visit,
+                                                  int ax, int ay,
+                                                  sa_vertex_t *const *va,
+                                                  size_t num_va,
+                                                  int bx, int by,
+                                                  sa_vertex_t *const *vb,
+                                                  size_t num_vb,
+                                                  const sa_cost_model_t model) {
+	size_t i, j, k;
+	size_t length;
+	size_t max_length = 0;
+	unsigned int epoch;
+	unsigned int stamp;
+	const sa_vertex_t *v;
+	const sa_vertex_t *pin;
+	const sa_net_t *net;
+	int *xs, *ys;
+	double before, after;
+	double cost = 0.0;
+	
+	// Two new stamps are used by every evaluation. When they run out, the
+	// stamps are reset.
+	if (visit->epoch >= ((unsigned int)-1) - 2) {
+		memset(visit->net_stamps, 0, state->num_nets * sizeof(unsigned int));
+		memset(visit->vertex_stamps, 0, state->num_vertices * sizeof(unsigned int));
+		visit->epoch = 1;
+	}
+	epoch = visit->epoch;
+	visit->epoch += 2;
+	
+	// Mark the vertices being moved (epoch: to B, epoch + 1: to A) and each net
+	// they belong to.
+	for (i = 0; i < num_va + num_vb; i++) {
+		v = (i < num_va) ? va[i] : vb[i - num_va];
+		visit->vertex_stamps[v->index] = epoch + (i >= num_va);
+		for (j = 0; j < v->num_nets; j++) {
+			net = SA_VERTEX_NET(state, v, j);
+			if (net->frozen)
+				continue;
+			visit->net_stamps[net->index] = epoch;
+			if (net->num_vertices > max_length)
+				max_length = net->num_vertices;
+		}
+	}
+	
+	xs = alloca(max_length * sizeof(int));
+	ys = alloca(max_length * sizeof(int));
+	
+	// Sum the change in cost of every marked net, marking each again once done
+	for (i = 0; i < num_va + num_vb; i++) {
+		v = (i < num_va) ? va[i] : vb[i - num_va];
+		for (j = 0; j < v->num_nets; j++) {
+			net = SA_VERTEX_NET(state, v, j);
+			if (visit->net_stamps[net->index] != epoch)
+				continue;
+			visit->net_stamps[net->index] = epoch + 1;
+			
+			length = (model == SA_COST_MODEL_HPWL) ? sa_get_num_hpwl_vertices(net)
+			                                       : net->num_vertices;
+			
+			for (k = 0; k < length; k++) {
+				pin = SA_NET_VERTEX(state, net, k);
+				xs[k] = pin->x;
+				ys[k] = pin->y;
+			}
+			before = sa_get_positions_cost_model(state, net, xs, ys, length, model);
+			
+			for (k = 0; k < length; k++) {
+				pin = SA_NET_VERTEX(state, net, k);
+				stamp = visit->vertex_stamps[pin->index];
+				xs[k] = (stamp == epoch) ? bx : (stamp == epoch + 1) ? ax : pin->x;
+				ys[k] = (stamp == epoch) ? by : (stamp == epoch + 1) ? ay : pin->y;
+			}
+			after = sa_get_positions_cost_model(state, net, xs, ys, length, model);
+			
+			cost += after - before;
+		}
+	}
+	
+	return cost;
+}
+
+double sa_get_swap_cost_pure(const sa_state_t *state, sa_visit_t *visit,
+                             int ax, int ay, sa_vertex_t *const *va, size_t num_va,
+                             int bx, int by, sa_vertex_t *const *vb, size_t num_vb) {
+	assert(state->cost_model != SA_COST_MODEL_CUSTOM);
+	
+	switch (state->cost_model) {
+		default:
+		case SA_COST_MODEL_HPWL:
+			return sa_get_swap_cost_pure_model(state, visit, ax, ay, va, num_va,
+			                                   bx, by, vb, num_vb,
+			                                   SA_COST_MODEL_HPWL);
+		case SA_COST_MODEL_CLIQUE:
+			return sa_get_swap_cost_pure_model(state, visit, ax, ay, va, num_va,
+			                                   bx, by, vb, num_vb,
+			                                   SA_COST_MODEL_CLIQUE);
+		case SA_COST_MODEL_STAR:
+			return sa_get_swap_cost_pure_model(state, visit, ax, ay, va, num_va,
+			                                   bx, by, vb, num_vb,
+			                                   SA_COST_MODEL_STAR);
+		case SA_COST_MODEL_HEX_STAR:
+			return sa_get_swap_cost_pure_model(state, visit, ax, ay, va, num_va,
+			                                   bx, by, vb, num_vb,
+			                                   SA_COST_MODEL_HEX_STAR);
+	}
+}
+
+// A proposed move which swaps the vertices va on chip A with the vertices vb
+// on chip B. The vertices vb are always the first num_vb vertices in chip B's
+// list. Neither chip's vertex list nor its resources are modified until the
+// move is committed by sa_commit_move().
+typedef struct sa_move {
+	int ax, ay;
+	sa_vertex_t **va;
+	size_t num_va;
+	
+	int bx, by;
+	sa_vertex_t **vb;
+	size_t num_vb;
+} sa_move_t;
+
+/**
+ * Count the movable vertices on a chip.
+ */
+static size_t sa_count_chip_vertices(sa_state_t *state, int x, int y) {
+	size_t count = 0;
+	sa_vertex_t *v;
+	for (v = sa_get_chip_vertex(state, x, y); v; v = v->next)
+		count++;
+	return count;
+}
+
+/**
+ * Copy the first num_vertices vertices in a chip's list into an array.
+ */
+static void sa_get_chip_vertices(sa_state_t *state, int x, int y,
+                                 sa_vertex_t **vertices, size_t num_vertices) {
+	size_t i;
+	sa_vertex_t *v = sa_get_chip_vertex(state, x, y);
+	for (i = 0; i < num_vertices; i++, v = v->next)
+		vertices[i] = v;
+}
+
+/**
+ * Count the vertices which sa_make_room_on_chip() would remove from the head of
+ * a chip's list to make room for resources_required, without removing them.
+ * Returns false if the chip could not be made to fit the resources.
+ */
+static sa_bool_t sa_count_room_on_chip(sa_state_t *state, int x, int y,
+                                       const int *resources_required,
+                                       size_t *num_removed) {
+	int *resources_available = alloca(sizeof(int) * state->num_resource_types);
+	const int *capacity;
+	sa_vertex_t *v;
+	size_t i;
 	
-	*x_out = x;
-	*y_out = y;
+	// Give up immediately if even an empty chip couldn't meet the requirement
+	*num_removed = 0;
+	if (state->chip_capacities) {
+		capacity = state->chip_capacities + (
+			(y * state->width * state->num_resource_types)
+			+ (x * state->num_resource_types)
+		);
+		for (i = 0; i < state->num_resource_types; i++)
+			if (capacity[i] < resources_required[i])
+				return sa_false;
+	}
 	
-	// Compute the bounds of the region from which candidate chips may be chosen
-	x_min = x - distance_limit;
-	y_min = y - distance_limit;
-	x_max = x + distance_limit;
-	y_max = y + distance_limit;
-	if (state->has_wrap_around_links) {
-		// If the distance limit allows wrapping more than all the way around, just
-		// clamp to that range
-		if ((x_max - x_min) >= (int)state->width) {
-			x_min = 0;
-			x_max = (int)state->width - 1;
+	memcpy(resources_available, sa_get_chip_resources_ptr(state, x, y),
+	       sizeof(int) * state->num_resource_types);
+	sa_subtract_resources(state, resources_available, resources_required);
+	
+	v = sa_get_chip_vertex(state, x, y);
+	while (!sa_positive_resources(state, resources_available)) {
+		if (v == NULL)
+			return sa_false;
+		sa_add_resources(state, resources_available, v->vertex_resources);
+		(*num_removed)++;
+		v = v->next;
+	}
+	
+	return sa_true;
+}
+
+/**
+ * Will both chips have enough resources once a move has been made?
+ */
+static sa_bool_t sa_move_fits(sa_state_t *state, const sa_move_t *move) {
+	int *resources_a = alloca(sizeof(int) * state->num_resource_types);
+	int *resources_b = alloca(sizeof(int) * state->num_resource_types);
+	size_t i;
+	
+	memcpy(resources_a, sa_get_chip_resources_ptr(state, move->ax, move->ay),
+	       sizeof(int) * state->num_resource_types);
+	memcpy(resources_b, sa_get_chip_resources_ptr(state, move->bx, move->by),
+	       sizeof(int) * state->num_resource_types);
+	for (i = 0; i < move->num_va; i++) {
+		sa_add_resources(state, resources_a, move->va[i]->vertex_resources);
+		sa_subtract_resources(state, resources_b, move->va[i]->vertex_resources);
+	}
+	for (i = 0; i < move->num_vb; i++) {
+		sa_add_resources(state, resources_b, move->vb[i]->vertex_resources);
+		sa_subtract_resources(state, resources_a, move->vb[i]->vertex_resources);
+	}
+	
+	return sa_positive_resources(state, resources_a) &&
+	       sa_positive_resources(state, resources_b);
+}
+
+/**
+ * Set the positions of the vertices in a move to their destinations (forward)
+ * or back to their origins.
+ */
+static void sa_set_move_positions(sa_state_t *state, const sa_move_t *move,
+                                  sa_bool_t forward) {
+	size_t i;
+	for (i = 0; i < move->num_va; i++)
+		sa_set_vertex_position(state, move->va[i],
+		                       forward ? move->bx : move->ax,
+		                       forward ? move->by : move->ay);
+	for (i = 0; i < move->num_vb; i++)
+		sa_set_vertex_position(state, move->vb[i],
+		                       forward ? move->ax : move->bx,
+		                       forward ? move->ay : move->by);
+}
+
+/**
+ * Compute the change in cost a move would cause.
+ *
+ * When possible the cost is computed by sa_get_swap_cost_pure_model() and the
+ * state is not modified. Otherwise (custom cost functions, net histograms or
+ * congestion), the vertices are moved to their new positions (but not chips)
+ * and *moved is set: the caller must put them back if the move is rejected.
+ */
+SA_SPECIALISED double sa_get_move_cost_model(sa_state_t *state,
+                                             const sa_move_t *move,
+                                             sa_bool_t *moved,
+                                             const sa_cost_model_t model) {
+	size_t i, j;
+	sa_vertex_t *v;
+	sa_net_t *net;
+	double before_cost = 0.0;
+	double after_cost = 0.0;
+	double before_congestion_cost;
+	
+	if (state->visit && !state->has_net_histograms && !state->link_usage) {
+		*moved = sa_false;
+		return sa_get_swap_cost_pure_model(state, state->visit,
+		                                   move->ax, move->ay,
+		                                   move->va, move->num_va,
+		                                   move->bx, move->by,
+		                                   move->vb, move->num_vb, model);
+	}
+	
+	// As sa_get_swap_cost_model() but for arrays of vertices
+	*moved = sa_true;
+	before_congestion_cost = state->congestion_cost;
+	for (i = 0; i < move->num_va + move->num_vb; i++) {
+		v = (i < move->num_va) ? move->va[i] : move->vb[i - move->num_va];
+		for (j = 0; j < v->num_nets; j++) {
+			net = SA_VERTEX_NET(state, v, j);
+			if (!net->counted && !net->frozen) {
+				before_cost += sa_get_net_cost_model(state, net, model);
+				net->counted = sa_true;
+			}
 		}
-		if ((y_max - y_min) >= (int)state->height) {
-			y_min = 0;
-			y_max = (int)state->height - 1;
+	}
+	
+	sa_set_move_positions(state, move, sa_true);
+	
+	for (i = 0; i < move->num_va + move->num_vb; i++) {
+		v = (i < move->num_va) ? move->va[i] : move->vb[i - move->num_va];
+		for (j = 0; j < v->num_nets; j++) {
+			net = SA_VERTEX_NET(state, v, j);
+			if (net->counted) { // Meaning inverted in this pass
+				after_cost += sa_get_net_cost_model(state, net, model);
+				net->counted = sa_false;
+			}
 		}
-	} else {
-		// No wrap-around links
-		if (x_min < 0)
-			x_min = 0;
-		if (y_min < 0)
-			y_min = 0;
-		if (x_max > (int)state->width - 1)
-			x_max = (int)state->width - 1;
-		if (y_max > (int)state->height - 1)
-			y_max = (int)state->height - 1;
 	}
 	
-	// Note we must pick a chip which isn't this chip(!)
-	while (*x_out == x && *y_out == y) {
-		// XXX: TODO: Use a proper random scheme...
-		*x_out = x_min + (rand() % ((x_max - x_min) + 1));
-		*y_out = y_min + (rand() % ((y_max - y_min) + 1));
+	return (after_cost - before_cost)
+	       + (state->congestion_cost - before_congestion_cost);
+}
+
+/**
+ * Move the vertices of an accepted move onto their new chips, updating the
+ * chips' vertex lists and resources.
+ */
+static void sa_commit_move(sa_state_t *state, const sa_move_t *move) {
+	sa_vertex_t *head;
+	sa_vertex_t **next_ptr;
+	size_t i;
+	
+	// Detach vb from the head of chip B's list
+	if (move->num_vb)
+		sa_set_chip_vertex(state, move->bx, move->by,
+		                   move->vb[move->num_vb - 1]->next);
+	for (i = 0; i < move->num_vb; i++) {
+		move->vb[i]->next = NULL;
+		sa_add_resources(state,
+		                 sa_get_chip_resources_ptr(state, move->bx, move->by),
+		                 move->vb[i]->vertex_resources);
+	}
+	
+	// Unlink each of va from chip A's list
+	head = sa_get_chip_vertex(state, move->ax, move->ay);
+	for (i = 0; i < move->num_va; i++) {
+		next_ptr = &head;
+		while (*next_ptr != move->va[i]) {
+			assert((*next_ptr)->next != NULL);  // The vertex *must* be present!
+			next_ptr = &((*next_ptr)->next);
+		}
+		*next_ptr = move->va[i]->next;
+		move->va[i]->next = NULL;
+		sa_add_resources(state,
+		                 sa_get_chip_resources_ptr(state, move->ax, move->ay),
+		                 move->va[i]->vertex_resources);
+	}
+	sa_set_chip_vertex(state, move->ax, move->ay, head);
+	
+	// The cost evaluation may already have set the positions of the vertices so
+	// sa_add_vertex_to_chip() can't be relied on to mark them as dirty
+	if (state->dirty_bitmap) {
+		for (i = 0; i < move->num_va; i++)
+			sa_mark_vertex_dirty(state, move->va[i]);
+		for (i = 0; i < move->num_vb; i++)
+			sa_mark_vertex_dirty(state, move->vb[i]);
+	}
+	
+	// Add them to their new chips (also setting their positions if the cost
+	// evaluation didn't)
+	for (i = 0; i < move->num_vb; i++)
+		sa_add_vertex_to_chip(state, move->vb[i], move->ax, move->ay, sa_true);
+	for (i = 0; i < move->num_va; i++)
+		sa_add_vertex_to_chip(state, move->va[i], move->bx, move->by, sa_true);
+}
+
+/**
+ * Set the cached cost of a net, updating the weights of its vertices in the
+ * vertex selection tree accordingly.
+ */
+static void sa_set_net_vertex_weights(sa_state_t *state, sa_net_t *net,
+                                      double cost) {
+	size_t i;
+	
+	if (cost == net->cost)
+		return;
+	
+	for (i = 0; i < net->num_vertices; i++)
+		if (SA_NET_VERTEX(state, net, i)->index < state->num_movable_vertices)
+			sa_add_vertex_weight(state, SA_NET_VERTEX(state, net, i)->index,
+			                     cost - net->cost);
+	net->cost = cost;
+}
+
+/**
+ * Update the cached costs of all (unfrozen) nets connected to an array of
+ * vertices, updating the weights of the vertices in the vertex selection tree
+ * accordingly.
+ */
+SA_SPECIALISED void sa_update_vertex_weights_model(sa_state_t *state,
+                                                   sa_vertex_t *const *vertices,
+                                                   size_t num_vertices,
+                                                   const sa_cost_model_t model) {
+	size_t i, k;
+	sa_net_t *net;
+	
+	for (k = 0; k < num_vertices; k++) {
+		for (i = 0; i < vertices[k]->num_nets; i++) {
+			net = SA_VERTEX_NET(state, vertices[k], i);
+			if (!net->frozen)
+				sa_set_net_vertex_weights(state, net,
+				                          sa_get_net_cost_model(state, net, model));
+		}
+	}
+}
+
+/**
+ * Recompute the cost of every frozen net (updating vertex weights, if in use),
+ * returning the change in their total cost since last recomputed.
+ */
+SA_SPECIALISED double sa_resync_frozen_nets_model(sa_state_t *state,
+                                                  const sa_cost_model_t model) {
+	size_t i;
+	sa_net_t *net;
+	double cost;
+	double total = 0.0;
+	double delta;
+	
+	for (i = 0; i < state->num_frozen_nets; i++) {
+		net = state->nets[state->frozen_nets[i]];
+		cost = sa_get_net_cost_model(state, net, model);
+		if (state->vertex_weights)
+			sa_set_net_vertex_weights(state, net, cost);
+		total += cost;
+	}
+	
+	delta = total - state->frozen_net_cost;
+	state->frozen_net_cost = total;
+	return delta;
+}
+
+/**
+ * Record the vertices moved by an accepted move in the trace.
+ */
+static void sa_trace_move(sa_state_t *state, const sa_move_t *move,
+                          double cost) {
+	size_t i;
+	sa_trace_entry_t *entry;
+	
+	for (i = 0; i < move->num_va + move->num_vb; i++) {
+		// Overwrite the oldest entry when full
+		if (state->trace_length == state->trace_capacity) {
+			state->trace_start = (state->trace_start + 1) % state->trace_capacity;
+			state->trace_length--;
+			state->trace_dropped++;
+		}
+		entry = &state->trace[(state->trace_start + state->trace_length) %
+		                      state->trace_capacity];
+		state->trace_length++;
 		
-		// Wrap-around (if required)
-		if (*x_out < 0)
-			*x_out += (int)state->width;
-		if (*x_out >= (int)state->width)
-			*x_out -= (int)state->width;
-		if (*y_out < 0)
-			*y_out += (int)state->height;
-		if (*y_out >= (int)state->height)
-			*y_out -= (int)state->height;
+		entry->step = state->rng_step;
+		entry->delta = (i == 0) ? cost : 0.0;
+		if (i < move->num_va) {
+			entry->vertex = move->va[i]->index;
+			entry->from_x = (sa_coord_t)move->ax;
+			entry->from_y = (sa_coord_t)move->ay;
+			entry->to_x = (sa_coord_t)move->bx;
+			entry->to_y = (sa_coord_t)move->by;
+		} else {
+			entry->vertex = move->vb[i - move->num_va]->index;
+			entry->from_x = (sa_coord_t)move->bx;
+			entry->from_y = (sa_coord_t)move->by;
+			entry->to_x = (sa_coord_t)move->ax;
+			entry->to_y = (sa_coord_t)move->ay;
+		}
+	}
+}
+
+/**
+ * Complete a proposed move. The move is accepted or rejected according to the
+ * rules of the SA and, only if accepted, the vertices are moved between chips.
+ */
+SA_SPECIALISED sa_bool_t sa_complete_move_model(sa_state_t *state,
+                                                const sa_move_t *move,
+                                                double temperature, double *cost,
+                                                const sa_cost_model_t model) {
+	sa_bool_t swap_accepted;
+	sa_bool_t moved;
+	
+	// Moves which don't fit are rejected before their cost is evaluated
+	if (!sa_move_fits(state, move)) {
+		*cost = 0.0;
+		return sa_false;
+	}
+	
+	// Assess whether the swap chosen is acceptable. Swaps that reduce the cost
+	// are always acceptable, swaps which increase it are acceptable with a
+	// probability related to how bad the swap is and how high the temperature
+	// is.
+	*cost = sa_get_move_cost_model(state, move, &moved, model);
+	swap_accepted = ((*cost) <= 0.0)
+	                 || sa_random_double(state) < exp(-(*cost) / temperature);
+	
+	if (!swap_accepted) {
+		if (moved)
+			sa_set_move_positions(state, move, sa_false);
+		*cost = 0.0;
+		return sa_false;
+	}
+	
+	sa_commit_move(state, move);
+	
+	if (state->trace)
+		sa_trace_move(state, move, *cost);
+	
+	// Update the weights of the vertices whose net costs have changed.
+	if (state->vertex_weights) {
+		sa_update_vertex_weights_model(state, move->va, move->num_va, model);
+		sa_update_vertex_weights_model(state, move->vb, move->num_vb, model);
+	}
+	
+	// Swap completed successfully
+	return sa_true;
+}
+
+/**
+ * SA_MOVE_VERTEX: Move a random vertex to a nearby chip, evicting vertices from
+ * that chip to the vertex's original chip as required.
+ */
+SA_SPECIALISED sa_bool_t sa_move_vertex_model(sa_state_t *state, int distance_limit,
+                                              double temperature, double *cost,
+                                              const sa_cost_model_t model) {
+	
+	// Select a random vertex to swap
+	sa_vertex_t *va = sa_get_random_movable_vertex(state);
+	sa_move_t move;
+	move.ax = va->x;
+	move.ay = va->y;
+	move.va = &va;
+	move.num_va = 1;
+	
+	// Find a suitable chip B to place the vertex on
+	sa_get_random_nearby_chip(state, move.ax, move.ay, distance_limit,
+	                          &move.bx, &move.by);
+	
+	// Find how many vertices must be evicted from chip B (if any) to allow our
+	// randomly selected vertex to fit. If not possible (e.g. due to insufficient
+	// space even when you remove all vertices or due to a dead chip), just fail
+	// the step.
+	if (!sa_count_room_on_chip(state, move.bx, move.by, va->vertex_resources,
+	                           &move.num_vb)) {
+		*cost = 0.0;
+		return sa_false;
+	}
+	move.vb = alloca(sizeof(sa_vertex_t *) * (move.num_vb + 1));
+	sa_get_chip_vertices(state, move.bx, move.by, move.vb, move.num_vb);
+	
+	return sa_complete_move_model(state, &move, temperature, cost, model);
+}
+
+/**
+ * SA_MOVE_CHIP_SWAP: Swap all of the movable vertices on the chip of a random
+ * vertex with those on a nearby chip.
+ */
+SA_SPECIALISED sa_bool_t sa_move_chip_swap_model(sa_state_t *state, int distance_limit,
+                                                 double temperature, double *cost,
+                                                 const sa_cost_model_t model) {
+	sa_vertex_t *vertex = sa_get_random_movable_vertex(state);
+	sa_move_t move;
+	move.ax = vertex->x;
+	move.ay = vertex->y;
+	sa_get_random_nearby_chip(state, move.ax, move.ay, distance_limit,
+	                          &move.bx, &move.by);
+	
+	// Swap the entire contents of both chips
+	move.num_va = sa_count_chip_vertices(state, move.ax, move.ay);
+	move.va = alloca(sizeof(sa_vertex_t *) * move.num_va);
+	sa_get_chip_vertices(state, move.ax, move.ay, move.va, move.num_va);
+	move.num_vb = sa_count_chip_vertices(state, move.bx, move.by);
+	move.vb = alloca(sizeof(sa_vertex_t *) * (move.num_vb + 1));
+	sa_get_chip_vertices(state, move.bx, move.by, move.vb, move.num_vb);
+	
+	return sa_complete_move_model(state, &move, temperature, cost, model);
+}
+
+/**
+ * SA_MOVE_SHIFT: Move a random vertex to an adjacent chip which has enough
+ * free resources to accept it without evicting anything.
+ */
+SA_SPECIALISED sa_bool_t sa_move_shift_model(sa_state_t *state,
+                                             double temperature, double *cost,
+                                             const sa_cost_model_t model) {
+	// The displacements to the neighbouring chips in the hexagonal network,
+	// indexed by sa_link_t.
+	static const int link_dx[SA_NUM_LINKS] = {+1, +1, 0, -1, -1, 0};
+	static const int link_dy[SA_NUM_LINKS] = {0, +1, +1, 0, -1, -1};
+	
+	sa_vertex_t *va = sa_get_random_movable_vertex(state);
+	int link = sa_random_int(state, SA_NUM_LINKS);
+	sa_move_t move;
+	move.ax = va->x;
+	move.ay = va->y;
+	move.bx = move.ax + link_dx[link];
+	move.by = move.ay + link_dy[link];
+	move.va = &va;
+	move.num_va = 1;
+	move.vb = NULL;
+	move.num_vb = 0;
+	
+	*cost = 0.0;
+	
+	// Wrap-around (if possible)
+	if (state->has_wrap_around_links) {
+		move.bx = (move.bx + (int)state->width) % (int)state->width;
+		move.by = (move.by + (int)state->height) % (int)state->height;
+	} else if (move.bx < 0 || move.by < 0 ||
+	           move.bx >= (int)state->width || move.by >= (int)state->height) {
+		return sa_false;
+	}
+	if (move.bx == move.ax && move.by == move.ay)
+		return sa_false;
+	
+	// The vertex must fit in the free space on the target chip (checked by
+	// sa_complete_move_model())
+	return sa_complete_move_model(state, &move, temperature, cost, model);
+}
+
+/**
+ * Do two vertices share any nets? Net slots which have not been set (i.e.
+ * SA_NO_REF) are not considered shared.
+ */
+static sa_bool_t sa_vertices_share_net(const sa_vertex_t *a, const sa_vertex_t *b) {
+	size_t i, j;
+	for (i = 0; i < a->num_nets; i++) {
+		if (a->nets[i] == SA_NO_REF)
+			continue;
+		for (j = 0; j < b->num_nets; j++)
+			if (a->nets[i] == b->nets[j])
+				return sa_true;
+	}
+	return sa_false;
+}
+
+/**
+ * SA_MOVE_CLUSTER: Move a random vertex along with every other vertex on the
+ * same chip which shares a net with it to a nearby chip, evicting vertices
+ * from that chip as required.
+ */
+SA_SPECIALISED sa_bool_t sa_move_cluster_model(sa_state_t *state, int distance_limit,
+                                               double temperature, double *cost,
+                                               const sa_cost_model_t model) {
+	int *resources = alloca(sizeof(int) * state->num_resource_types);
+	sa_vertex_t *vertex = sa_get_random_movable_vertex(state);
+	sa_vertex_t *v;
+	sa_move_t move;
+	move.ax = vertex->x;
+	move.ay = vertex->y;
+	
+	sa_get_random_nearby_chip(state, move.ax, move.ay, distance_limit,
+	                          &move.bx, &move.by);
+	
+	// Gather the cluster and total up the resources it uses
+	move.va = alloca(sizeof(sa_vertex_t *) *
+	                 sa_count_chip_vertices(state, move.ax, move.ay));
+	move.num_va = 0;
+	memset(resources, 0, sizeof(int) * state->num_resource_types);
+	for (v = sa_get_chip_vertex(state, move.ax, move.ay); v; v = v->next) {
+		if (v == vertex || sa_vertices_share_net(v, vertex)) {
+			move.va[move.num_va++] = v;
+			sa_add_resources(state, resources, v->vertex_resources);
+		}
+	}
+	
+	// Find the vertices to evict from chip B to make room for the cluster
+	if (!sa_count_room_on_chip(state, move.bx, move.by, resources,
+	                           &move.num_vb)) {
+		*cost = 0.0;
+		return sa_false;
+	}
+	move.vb = alloca(sizeof(sa_vertex_t *) * (move.num_vb + 1));
+	sa_get_chip_vertices(state, move.bx, move.by, move.vb, move.num_vb);
+	
+	return sa_complete_move_model(state, &move, temperature, cost, model);
+}
+
+/**
+ * Randomly select a type of move according to state->move_weights.
+ */
+static sa_move_type_t sa_get_random_move_type(sa_state_t *state) {
+	int t;
+	double total = 0.0;
+	double r;
+	sa_move_type_t only = SA_MOVE_VERTEX;
+	size_t num_enabled = 0;
+	
+	for (t = 0; t < SA_NUM_MOVE_TYPES; t++) {
+		if (state->move_weights[t] > 0.0) {
+			total += state->move_weights[t];
+			only = (sa_move_type_t)t;
+			num_enabled++;
+		}
 	}
+	
+	// Don't consume a random number when there is no choice to be made
+	if (num_enabled <= 1)
+		return only;
+	
+	r = sa_random_double(state) * total;
+	for (t = 0; t < SA_NUM_MOVE_TYPES; t++) {
+		if (state->move_weights[t] > 0.0) {
+			if (r < state->move_weights[t])
+				return (sa_move_type_t)t;
+			r -= state->move_weights[t];
+		}
+	}
+	return only;
+}
+
+/**
+ * sa_step for a specific cost model.
+ */
+SA_SPECIALISED sa_bool_t sa_step_model(sa_state_t *state, int distance_limit,
+                                       double temperature, double *cost,
+                                       const sa_cost_model_t model) {
+	sa_bool_t accepted;
+	sa_move_type_t move_type;
+	
+	sa_set_rng_step(state, state->rng_step + 1);
+	move_type = sa_get_random_move_type(state);
+	
+	switch (move_type) {
+		default:
+		case SA_MOVE_VERTEX:
+			accepted = sa_move_vertex_model(state, distance_limit, temperature,
+			                                cost, model);
+			break;
+		case SA_MOVE_CHIP_SWAP:
+			accepted = sa_move_chip_swap_model(state, distance_limit, temperature,
+			                                   cost, model);
+			break;
+		case SA_MOVE_SHIFT:
+			accepted = sa_move_shift_model(state, temperature, cost, model);
+			break;
+		case SA_MOVE_CLUSTER:
+			accepted = sa_move_cluster_model(state, distance_limit, temperature,
+			                                 cost, model);
+			break;
+	}
+	
+	state->num_moves_proposed[move_type]++;
+	if (accepted)
+		state->num_moves_accepted[move_type]++;
+	
+	return accepted;
+}
+
+sa_bool_t sa_step(sa_state_t *state, int distance_limit, double temperature, double *cost) {
+	return sa_step_model(state, distance_limit, temperature, cost, state->cost_model);
+}
+
+/**
+ * Copies of sa_step_model() specialised for each cost model. These are never
+ * inlined so that the scratch space the move functions allocate with alloca()
+ * is released after every step rather than accumulating over a whole run.
+ */
+SA_NOINLINE sa_bool_t sa_step_hpwl(sa_state_t *state, int distance_limit,
+                                   double temperature, double *cost) {
+	return sa_step_model(state, distance_limit, temperature, cost,
+	                     SA_COST_MODEL_HPWL);
+}
+
+SA_NOINLINE sa_bool_t sa_step_clique(sa_state_t *state, int distance_limit,
+                                     double temperature, double *cost) {
+	return sa_step_model(state, distance_limit, temperature, cost,
+	                     SA_COST_MODEL_CLIQUE);
+}
+
+SA_NOINLINE sa_bool_t sa_step_star(sa_state_t *state, int distance_limit,
+                                   double temperature, double *cost) {
+	return sa_step_model(state, distance_limit, temperature, cost,
+	                     SA_COST_MODEL_STAR);
+}
+
+SA_NOINLINE sa_bool_t sa_step_hex_star(sa_state_t *state, int distance_limit,
+                                       double temperature, double *cost) {
+	return sa_step_model(state, distance_limit, temperature, cost,
+	                     SA_COST_MODEL_HEX_STAR);
+}
+
+SA_NOINLINE sa_bool_t sa_step_custom(sa_state_t *state, int distance_limit,
+                                     double temperature, double *cost) {
+	return sa_step_model(state, distance_limit, temperature, cost,
+	                     SA_COST_MODEL_CUSTOM);
 }
 
+/**
+ * Call the copy of sa_step_model() specialised for the given (constant) cost
+ * model. The selection is resolved at compile time once inlined.
+ */
+SA_SPECIALISED sa_bool_t sa_step_specialised(sa_state_t *state,
+                                             int distance_limit,
+                                             double temperature, double *cost,
+                                             const sa_cost_model_t model) {
+	switch (model) {
+		default:
+		case SA_COST_MODEL_HPWL:
+			return sa_step_hpwl(state, distance_limit, temperature, cost);
+		case SA_COST_MODEL_CLIQUE:
+			return sa_step_clique(state, distance_limit, temperature, cost);
+		case SA_COST_MODEL_STAR:
+			return sa_step_star(state, distance_limit, temperature, cost);
+		case SA_COST_MODEL_HEX_STAR:
+			return sa_step_hex_star(state, distance_limit, temperature, cost);
+		case SA_COST_MODEL_CUSTOM:
+			return sa_step_custom(state, distance_limit, temperature, cost);
+	}
+}
 
-sa_bool_t sa_make_room_on_chip(sa_state_t *state, int x, int y,
-                               const int *resources_required,
-                               sa_vertex_t **removed_vertices) {
+/**
+ * sa_run_steps_until for a specific cost model.
+ */
+SA_SPECIALISED sa_run_status_t sa_run_steps_model(sa_state_t *state,
+                                                  size_t num_steps,
+                                                  int distance_limit,
+                                                  double temperature,
+                                                  double time_limit,
+                                                  volatile sig_atomic_t *cancel,
+                                                  size_t *num_steps_done,
+                                                  size_t *num_accepted,
+                                                  double *cost_delta,
+                                                  double *cost_delta_sd,
+                                                  const sa_cost_model_t model) {
+	size_t i;
+	sa_run_status_t status = SA_RUN_FINISHED;
+	double deadline = (time_limit >= 0.0) ? sa_get_time() + time_limit : 0.0;
+	size_t check_interval = state->check_interval ? state->check_interval : 1;
+	size_t resync_interval = state->frozen_net_resync_interval
+	                         ? state->frozen_net_resync_interval : 1;
 	
-	// Create a local copy of the resource requirement on the stack
-	int *resources_available = alloca(sizeof(int) * state->num_resource_types);
-	memcpy(resources_available, sa_get_chip_resources_ptr(state, x, y),
-	       sizeof(int) * state->num_resource_types);
+	// Used to calculate a running standard-deviation of cost changes
+	double mean = 0.0;
+	double m2 = 0.0;
 	
-	// See if the resources already available on the chip are sufficient alone
-	sa_subtract_resources(state, resources_available, resources_required);
+	double delta;
 	
-	// Keep removing vertices until all the requred resources have been found.
-	*removed_vertices = NULL;
-	while (!sa_positive_resources(state, resources_available)) {
-		if (sa_get_chip_vertex(state, x, y) != NULL) {
-			// Remove a vertex
-			sa_vertex_t *new_chip_head = sa_get_chip_vertex(state, x, y)->next;
-			sa_get_chip_vertex(state, x, y)->next = *removed_vertices;
-			*removed_vertices = sa_get_chip_vertex(state, x, y);
-			sa_set_chip_vertex(state, x, y, new_chip_head);
-			
-			sa_add_resources(state,
-			                 resources_available,
-			                 (*removed_vertices)->vertex_resources);
-		} else {
-			// Ran out of vertices to remove! Put them all back then report a
-			// failure.
-			sa_set_chip_vertex(state, x, y, *removed_vertices);
-			*removed_vertices = NULL;
-			return sa_false;
+	*num_accepted = 0;
+	*cost_delta = 0.0;
+	
+	for (i = 0; i < SA_NUM_MOVE_TYPES; i++) {
+		state->num_moves_proposed[i] = 0;
+		state->num_moves_accepted[i] = 0;
+	}
+	
+	// Frozen nets may have changed since last recomputed (e.g. by sa_step(),
+	// whose cost changes leave them out) so include that change too
+	if (state->num_frozen_nets)
+		*cost_delta += sa_resync_frozen_nets_model(state, model);
+	
+	for (i = 0; i < num_steps; i++) {
+		double cost_change;
+		sa_bool_t accepted;
+		
+		// Check the budget every check_interval steps
+		if ((time_limit >= 0.0 || cancel) && i % check_interval == 0) {
+			if (cancel && SA_ATOMIC_LOAD(cancel)) {
+				status = SA_RUN_CANCELLED;
+				break;
+			}
+			if (time_limit >= 0.0 && sa_get_time() >= deadline) {
+				status = SA_RUN_TIMED_OUT;
+				break;
+			}
 		}
+		
+		// Each step is a real call (see sa_step_specialised())
+		accepted = sa_step_specialised(state, distance_limit, temperature,
+		                               &cost_change, model);
+		
+		if (accepted)
+			(*num_accepted)++;
+		
+		*cost_delta += cost_change;
+		
+		delta = cost_change - mean;
+		mean += delta / (i + 1.0);
+		m2 += delta * (cost_change - mean);
+		
+		// Catch up with the changes to the frozen nets' cost (which are not
+		// included in the cost changes of individual steps)
+		if (state->num_frozen_nets && (i + 1) % resync_interval == 0)
+			*cost_delta += sa_resync_frozen_nets_model(state, model);
 	}
 	
-	// Update the resource counts for the chip if a vertex was removed
-	if (*removed_vertices) {
-		sa_add_resources(state, resources_available, resources_required);
-		memcpy(sa_get_chip_resources_ptr(state, x, y), resources_available,
-		       sizeof(int) * state->num_resource_types);
+	if (state->num_frozen_nets && i % resync_interval != 0)
+		*cost_delta += sa_resync_frozen_nets_model(state, model);
+	
+	// Calculate the standard deviation of cost changes
+	*num_steps_done = i;
+	*cost_delta_sd = sqrt(m2 / (i - 1.0));
+	
+	return status;
+}
+
+void sa_run_steps(sa_state_t *state, size_t num_steps, int distance_limit, double temperature,
+                  size_t *num_accepted, double *cost_delta, double *cost_delta_sd) {
+	size_t num_steps_done;
+	sa_run_steps_until(state, num_steps, distance_limit, temperature, -1.0, NULL,
+	                   &num_steps_done, num_accepted, cost_delta, cost_delta_sd);
+}
+
+sa_run_status_t sa_run_steps_until(sa_state_t *state, size_t num_steps,
+                                   int distance_limit, double temperature,
+                                   double time_limit,
+                                   volatile sig_atomic_t *cancel,
+                                   size_t *num_steps_done, size_t *num_accepted,
+                                   double *cost_delta, double *cost_delta_sd) {
+	// The cost model is selected once here so that the whole run is executed
+	// by a copy of the kernel specialised for that model.
+	switch (state->cost_model) {
+		default:
+		case SA_COST_MODEL_HPWL:
+			return sa_run_steps_model(state, num_steps, distance_limit,
+			                          temperature, time_limit, cancel,
+			                          num_steps_done, num_accepted, cost_delta,
+			                          cost_delta_sd, SA_COST_MODEL_HPWL);
+		case SA_COST_MODEL_CLIQUE:
+			return sa_run_steps_model(state, num_steps, distance_limit,
+			                          temperature, time_limit, cancel,
+			                          num_steps_done, num_accepted, cost_delta,
+			                          cost_delta_sd, SA_COST_MODEL_CLIQUE);
+		case SA_COST_MODEL_STAR:
+			return sa_run_steps_model(state, num_steps, distance_limit,
+			                          temperature, time_limit, cancel,
+			                          num_steps_done, num_accepted, cost_delta,
+			                          cost_delta_sd, SA_COST_MODEL_STAR);
+		case SA_COST_MODEL_HEX_STAR:
+			return sa_run_steps_model(state, num_steps, distance_limit,
+			                          temperature, time_limit, cancel,
+			                          num_steps_done, num_accepted, cost_delta,
+			                          cost_delta_sd, SA_COST_MODEL_HEX_STAR);
+		case SA_COST_MODEL_CUSTOM:
+			return sa_run_steps_model(state, num_steps, distance_limit,
+			                          temperature, time_limit, cancel,
+			                          num_steps_done, num_accepted, cost_delta,
+			                          cost_delta_sd, SA_COST_MODEL_CUSTOM);
 	}
+}
+
+double sa_get_time(void) {
+#if defined(_WIN32) || defined(WIN32)
+	LARGE_INTEGER count;
+	LARGE_INTEGER frequency;
+	QueryPerformanceCounter(&count);
+	QueryPerformanceFrequency(&frequency);
+	return (double)count.QuadPart / (double)frequency.QuadPart;
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+#endif
+}
+
+sa_bool_t sa_set_trace(sa_state_t *state, size_t capacity) {
+	sa_free_array(state->trace);
+	state->trace = NULL;
+	state->trace_capacity = 0;
+	state->trace_start = 0;
+	state->trace_length = 0;
+	state->trace_dropped = 0;
+	
+	if (capacity == 0)
+		return sa_true;
+	
+	state->trace = sa_alloc_array(state, capacity * sizeof(sa_trace_entry_t));
+	if (state->trace == NULL)
+		return sa_false;
+	state->trace_capacity = capacity;
 	
 	return sa_true;
 }
 
-int compar(const void *a, const void *b) {
-	return *((int *)a) - *((int *)b);
+size_t sa_read_trace(sa_state_t *state, sa_trace_entry_t *entries,
+                     size_t max_entries) {
+	size_t i;
+	size_t num_entries = (state->trace_length < max_entries)
+	                     ? state->trace_length : max_entries;
+	
+	for (i = 0; i < num_entries; i++)
+		entries[i] = state->trace[(state->trace_start + i) % state->trace_capacity];
+	
+	if (num_entries) {
+		state->trace_start = (state->trace_start + num_entries) % state->trace_capacity;
+		state->trace_length -= num_entries;
+	}
+	
+	return num_entries;
 }
 
-void sort(sa_state_t *state, int *array, size_t length) {
-  if (state->width <= 256 && state ->height <= 256) {
-    // If dimensions are always 8 bits or less (true for all real SpiNNaker
-    // machines), we use a fast sort algorithm.
-    u1_sort(array, length);
-  } else {
-    // ...if something odd is being done, we use a bog-standard qsort.
-    qsort(array, length, sizeof(int), &compar);
-  }
+sa_bool_t sa_set_dirty_tracking(sa_state_t *state, sa_bool_t enable) {
+	sa_free_array(state->dirty_bitmap);
+	sa_free_array(state->dirty_vertices);
+	state->dirty_bitmap = NULL;
+	state->dirty_vertices = NULL;
+	state->num_dirty_vertices = 0;
+	
+	if (!enable)
+		return sa_true;
+	
+	state->dirty_bitmap = sa_alloc_array(state, ((state->num_vertices + 31) / 32) *
+	                                            sizeof(unsigned int));
+	state->dirty_vertices = sa_alloc_array(state, state->num_vertices *
+	                                              sizeof(sa_count_t));
+	if (state->dirty_bitmap == NULL || state->dirty_vertices == NULL) {
+		sa_set_dirty_tracking(state, sa_false);
+		return sa_false;
+	}
+	
+	return sa_true;
 }
 
-double sa_get_net_cost(sa_state_t *state, sa_net_t *net) {
+size_t sa_read_dirty_vertices(sa_state_t *state, sa_placement_t *placements,
+                              size_t max_placements) {
 	size_t i;
-	int *xs, *ys;
-	int last_x, last_y, max_delta_x, max_delta_y;
-	int delta_x, delta_y;
-	int bbox_width, bbox_height;
-	int min_x, max_x, min_y, max_y;
-		
-	// If 1 or 0 vertices in the net, the net can never have non-zero cost. This
-	// also saves some special-case handling below.
-	if (net->num_vertices <= 1)
-		return 0.0;
+	sa_count_t index;
 	
-	if (state->has_wrap_around_links) {
-		// Torroidal network: When wrap-around links exist, we find the minimal
-		// bounding box and return the HPWL weighted by the net weight. To do this
-		// the largest gap between any pair of vertices is found:
-		//
-		//     |    x     x             x   |
-		//                ^-------------^
-		//                    max gap
-		//
-		// The minimal bounding box then goes the other way around:
-		//
-		//     |    x     x             x   |
-		//      ----------^             ^---
-		
-		// Create a sorted array of the x and y positions
-		xs = alloca(net->num_vertices * sizeof(int));
-		ys = alloca(net->num_vertices * sizeof(int));
-		
-		for (i = 0; i < net->num_vertices; i++) {
-			xs[i] = net->vertices[i]->x;
-			ys[i] = net->vertices[i]->y;
-		}
-		
-		sort(state, xs, net->num_vertices);
-		sort(state, ys, net->num_vertices);
-		
-		// Find the largest gap in each
-		last_x = xs[net->num_vertices - 1] - (int)state->width;
-		last_y = ys[net->num_vertices - 1] - (int)state->height;
-		max_delta_x = 0;
-		max_delta_y = 0;
-		for (i = 0; i < net->num_vertices; i++) {
-			delta_x = xs[i] - last_x;
-			delta_y = ys[i] - last_y;
-			last_x = xs[i];
-			last_y = ys[i];
-			
-			if (delta_x > max_delta_x)
-				max_delta_x = delta_x;
-			if (delta_y > max_delta_y)
-				max_delta_y = delta_y;
-		}
-		
-		// From this we can work out the bounding box size and thus the HPWL.
-		bbox_width = (int)state->width - max_delta_x;
-		bbox_height = (int)state->height - max_delta_y;
-		return sqrt(net->num_vertices) * (bbox_width + bbox_height) * net->weight;
-	} else {
-		// Non-toriodal network: Compute bounding box
-		min_x = net->vertices[0]->x;
-		max_x = min_x;
-		min_y = net->vertices[0]->y;
-		max_y = min_y;
-		for (i = 1; i < net->num_vertices; i++) {
-			if (net->vertices[i]->x < min_x)
-				min_x = net->vertices[i]->x;
-			if (max_x < net->vertices[i]->x)
-				max_x = net->vertices[i]->x;
-			if (net->vertices[i]->y < min_y)
-				min_y = net->vertices[i]->y;
-			if (max_y < net->vertices[i]->y)
-				max_y = net->vertices[i]->y;
-		}
+	// Read from the end of the list so the rest of the list stays in place
+	for (i = 0; i < max_placements && state->num_dirty_vertices > 0; i++) {
+		index = state->dirty_vertices[--state->num_dirty_vertices];
+		state->dirty_bitmap[index / 32] &= ~(1u << (index % 32));
 		
-		// Compute weighted HPWL
-		return sqrt(net->num_vertices) * ((max_x - min_x) + (max_y - min_y)) * net->weight;
+		placements[i].vertex = index;
+		placements[i].x = state->vertices[index]->x;
+		placements[i].y = state->vertices[index]->y;
 	}
+	
+	return i;
 }
 
-double sa_get_swap_cost(sa_state_t *state,
-                        int ax, int ay, sa_vertex_t *va,
-                        int bx, int by, sa_vertex_t *vb) {
-	int which_verts;
+////////////////////////////////////////////////////////////////////////////////
+// Background annealing
+////////////////////////////////////////////////////////////////////////////////
+
+// Minimal portable threads, mutexes and condition variables
+#if defined(_WIN32) || defined(WIN32)
+typedef HANDLE sa_thread_t;
+typedef CRITICAL_SECTION sa_mutex_t;
+typedef CONDITION_VARIABLE sa_cond_t;
+#define sa_mutex_init(m) (InitializeCriticalSection(m), sa_true)
+#define sa_mutex_destroy(m) DeleteCriticalSection(m)
+#define sa_mutex_lock(m) EnterCriticalSection(m)
+#define sa_mutex_unlock(m) LeaveCriticalSection(m)
+#define sa_cond_init(c) (InitializeConditionVariable(c), sa_true)
+#define sa_cond_destroy(c) ((void)(c))
+#define sa_cond_wait(c, m) SleepConditionVariableCS((c), (m), INFINITE)
+#define sa_cond_broadcast(c) WakeAllConditionVariable(c)
+#else
+typedef pthread_t sa_thread_t;
+typedef pthread_mutex_t sa_mutex_t;
+typedef pthread_cond_t sa_cond_t;
+#define sa_mutex_init(m) (pthread_mutex_init((m), NULL) == 0)
+#define sa_mutex_destroy(m) pthread_mutex_destroy(m)
+#define sa_mutex_lock(m) pthread_mutex_lock(m)
+#define sa_mutex_unlock(m) pthread_mutex_unlock(m)
+#define sa_cond_init(c) (pthread_cond_init((c), NULL) == 0)
+#define sa_cond_destroy(c) pthread_cond_destroy(c)
+#define sa_cond_wait(c, m) pthread_cond_wait((c), (m))
+#define sa_cond_broadcast(c) pthread_cond_broadcast(c)
+#endif
+
+// The number of words of the published copy of an anneal's progress record
+#define SA_PROGRESS_WORDS \
+	((sizeof(sa_progress_t) + sizeof(unsigned int) - 1) / sizeof(unsigned int))
+
+struct sa_anneal {
+	sa_state_t *state;
+	sa_thread_t thread;
+	
+	// The annealing schedule
+	size_t num_steps;
+	int distance_limit;
+	double temperature;
+	double alpha;
+	double final_temperature;
+	
+	// The progress record, copied word-by-word and guarded by a sequence counter
+	// which is odd while the record is being written. The counter and words are
+	// only accessed atomically so that the record may be read without locks.
+	volatile unsigned int progress_sequence;
+	volatile unsigned int progress[SA_PROGRESS_WORDS];
+	
+	// Set (atomically, while holding the mutex) to interrupt the current run of
+	// steps whenever a snapshot or stop is requested. Read atomically by the
+	// annealing thread without the mutex (see sa_run_steps_until()).
+	volatile sig_atomic_t interrupt;
+	
+	// Guard the following fields.
+	sa_mutex_t mutex;
+	sa_cond_t cond;
+	
+	// If not NULL, the array into which a snapshot has been requested.
+	sa_placement_t *snapshot;
+	
+	sa_bool_t stop;
+	sa_bool_t finished;
+};
+
+/**
+ * Publish a new progress record (called only by the annealing thread).
+ */
+static void sa_publish_anneal_progress(sa_anneal_t *anneal,
+                                       const sa_progress_t *progress) {
+	unsigned int words[SA_PROGRESS_WORDS];
+	unsigned int sequence = SA_ATOMIC_LOAD(&anneal->progress_sequence);
 	size_t i;
-	sa_vertex_t *v;
-	double after_cost;
 	
-	// Calculate total cost of all nets before swap
-	double before_cost = 0.0;
-	for (which_verts = 0; which_verts < 2; which_verts++) {
-		sa_vertex_t *v = (which_verts == 0) ? va : vb;
-		while (v) {
-			for (i = 0; i < v->num_nets; i++) {
-				if (!v->nets[i]->counted) {
-					before_cost += sa_get_net_cost(state, v->nets[i]);
-					v->nets[i]->counted = sa_true;
-				}
-			}
-			v = v->next;
-		}
-	}
+	memset(words, 0, sizeof(words));
+	memcpy(words, progress, sizeof(sa_progress_t));
 	
-	// Swap the positions of all va and all vb. Note that since these vertices
-	// have been removed and will later be re-added to the chip, restoring the
-	// values of x and y if required.
-	v = va;
-	while (v) {
-		v->x = bx;
-		v->y = by;
-		v = v->next;
-	}
-	v = vb;
-	while (v) {
-		v->x = ax;
-		v->y = ay;
-		v = v->next;
+	SA_ATOMIC_STORE(&anneal->progress_sequence, sequence + 1);
+	for (i = 0; i < SA_PROGRESS_WORDS; i++)
+		SA_ATOMIC_STORE(&anneal->progress[i], words[i]);
+	SA_ATOMIC_STORE(&anneal->progress_sequence, sequence + 2);
+}
+
+/**
+ * Copy the position of every vertex into an array.
+ */
+static void sa_copy_placement(const sa_state_t *state,
+                              sa_placement_t *placements) {
+	size_t i;
+	for (i = 0; i < state->num_vertices; i++) {
+		placements[i].vertex = (sa_count_t)i;
+		placements[i].x = state->vertices[i]->x;
+		placements[i].y = state->vertices[i]->y;
 	}
+}
+
+/**
+ * The body of the annealing thread.
+ */
+static void sa_run_anneal(sa_anneal_t *anneal) {
+	sa_state_t *state = anneal->state;
+	sa_progress_t progress;
+	sa_run_status_t status;
+	size_t num_remaining;
+	size_t num_batch_accepted;
+	size_t num_steps_done;
+	size_t num_accepted;
+	double cost_delta;
+	double cost_delta_sd;
+	sa_bool_t stop = sa_false;
 	
-	// Calculate the cost after swap
-	after_cost = 0.0;
-	for (which_verts = 0; which_verts < 2; which_verts++) {
-		sa_vertex_t *v = (which_verts == 0) ? va : vb;
-		while (v) {
-			for (i = 0; i < v->num_nets; i++) {
-				if (v->nets[i]->counted) { // Meaning inverted in this pass
-					after_cost += sa_get_net_cost(state, v->nets[i]);
-					v->nets[i]->counted = sa_false; // Meaning inverted in this pass
+	progress.temperature = anneal->temperature;
+	progress.cost = sa_get_total_cost(state);
+	progress.accept_rate = 0.0;
+	progress.num_steps = 0;
+	progress.running = sa_true;
+	sa_publish_anneal_progress(anneal, &progress);
+	
+	while (!stop && progress.temperature > anneal->final_temperature) {
+		num_remaining = anneal->num_steps;
+		num_batch_accepted = 0;
+		while (num_remaining > 0) {
+			status = sa_run_steps_until(state, num_remaining,
+			                            anneal->distance_limit,
+			                            progress.temperature, -1.0,
+			                            &anneal->interrupt, &num_steps_done,
+			                            &num_accepted, &cost_delta,
+			                            &cost_delta_sd);
+			num_remaining -= num_steps_done;
+			num_batch_accepted += num_accepted;
+			progress.num_steps += num_steps_done;
+			progress.cost += cost_delta;
+			
+			if (status == SA_RUN_CANCELLED) {
+				// Take any snapshot requested while paused between steps
+				sa_mutex_lock(&anneal->mutex);
+				SA_ATOMIC_STORE(&anneal->interrupt, 0);
+				if (anneal->snapshot) {
+					sa_copy_placement(state, anneal->snapshot);
+					anneal->snapshot = NULL;
+					sa_cond_broadcast(&anneal->cond);
 				}
+				stop = anneal->stop;
+				sa_mutex_unlock(&anneal->mutex);
+				
+				sa_publish_anneal_progress(anneal, &progress);
+				if (stop)
+					break;
 			}
-			v = v->next;
 		}
+		
+		if (num_remaining == 0) {
+			// (num_steps is non-zero, see sa_start_anneal())
+			progress.accept_rate = (double)num_batch_accepted /
+			                       (double)anneal->num_steps;
+			progress.temperature *= anneal->alpha;
+		}
+		sa_publish_anneal_progress(anneal, &progress);
 	}
 	
-	return after_cost - before_cost;
+	progress.running = sa_false;
+	sa_publish_anneal_progress(anneal, &progress);
+	
+	// Wake anybody waiting for a snapshot which will now never be taken
+	sa_mutex_lock(&anneal->mutex);
+	anneal->finished = sa_true;
+	sa_cond_broadcast(&anneal->cond);
+	sa_mutex_unlock(&anneal->mutex);
 }
 
-sa_bool_t sa_step(sa_state_t *state, int distance_limit, double temperature, double *cost) {
+#if defined(_WIN32) || defined(WIN32)
+static DWORD WINAPI sa_anneal_thread(LPVOID anneal) {
+	sa_run_anneal((sa_anneal_t *)anneal);
+	return 0;
+}
+#else
+static void *sa_anneal_thread(void *anneal) {
+	sa_run_anneal((sa_anneal_t *)anneal);
+	return NULL;
+}
+#endif
+
+sa_anneal_t *sa_start_anneal(sa_state_t *state, size_t num_steps,
+                             int distance_limit, double temperature,
+                             double alpha, double final_temperature) {
+	sa_bool_t started;
+	sa_progress_t progress;
+	sa_anneal_t *anneal;
 	
-	// Select a random vertex to swap
-	sa_vertex_t *va = sa_get_random_movable_vertex(state);
-	sa_vertex_t *vb;
-	int ax = va->x;
-	int ay = va->y;
-	sa_bool_t swap_accepted;
+	// Without any steps per batch there is no acceptance rate to report
+	if (num_steps == 0)
+		return NULL;
 	
-	// Find a suitable chip B to place the vertex on
-	int bx, by;
-	sa_get_random_nearby_chip(state, ax, ay, distance_limit, &bx, &by);
-	
-	// Attempt to remove as many vertices from chip B as required (if any) to
-	// allow our randomly selected vertex to fit. If not possible (e.g. due to
-	// insufficient space even when you remove all vertices or due to a dead
-	// chip), just fail the step.
-	if (!sa_make_room_on_chip(state, bx, by,
-	                          va->vertex_resources,
-	                          &vb)) {
-		*cost = 0.0;
-		return sa_false;
-	}
+	anneal = calloc(1, sizeof(sa_anneal_t));
+	if (anneal == NULL)
+		return NULL;
 	
-	// Remove the initially randomly selected vertex from its chip.
-	sa_remove_vertex_from_chip(state, va);
+	anneal->state = state;
+	anneal->num_steps = num_steps;
+	anneal->distance_limit = distance_limit;
+	anneal->temperature = temperature;
+	anneal->alpha = alpha;
+	anneal->final_temperature = final_temperature;
+	anneal->interrupt = 0;
+	anneal->snapshot = NULL;
+	anneal->stop = sa_false;
+	anneal->finished = sa_false;
 	
-	// Assess whether the swap chosen is acceptable and then proceed with the
-	// final "but does it fit?" check. If the swap is not acceptable, revert and
-	// give up now. Swaps that reduce the cost are always acceptable, swaps which
-	// increase it are acceptable with a probability related to how bad the swap
-	// is and how high the temperature is.
-	*cost = sa_get_swap_cost(state, ax, ay, va, bx, by, vb);
-	swap_accepted = ((*cost) <= 0.0)
-	                 || ((double)rand() / RAND_MAX) < exp(-(*cost) / temperature);
-	
-	// Attempt to fit the vertices removed from chip B into the space left behind
-	// after removing va from chip A. If not enough space (or if the swap was not
-	// accepted, revert everything.
-	if (!swap_accepted || !sa_add_vertices_to_chip_if_fit(state, vb, ax, ay)) {
-		// The vertices didn't fit, put everything back where it came
-		sa_add_vertices_to_chip(state, vb, bx, by);
-		sa_add_vertices_to_chip(state, va, ax, ay);
-		*cost = 0.0;
-		return sa_false;
+	memset(&progress, 0, sizeof(progress));
+	progress.temperature = temperature;
+	progress.running = sa_true;
+	sa_publish_anneal_progress(anneal, &progress);
+	
+	if (!sa_mutex_init(&anneal->mutex)) {
+		free(anneal);
+		return NULL;
+	}
+	if (!sa_cond_init(&anneal->cond)) {
+		sa_mutex_destroy(&anneal->mutex);
+		free(anneal);
+		return NULL;
 	}
 	
-	// Finally put va onto vb.
-	sa_add_vertices_to_chip(state, va, bx, by);
+#if defined(_WIN32) || defined(WIN32)
+	anneal->thread = CreateThread(NULL, 0, sa_anneal_thread, anneal, 0, NULL);
+	started = anneal->thread != NULL;
+#else
+	started = pthread_create(&anneal->thread, NULL, sa_anneal_thread, anneal) == 0;
+#endif
+	if (!started) {
+		sa_cond_destroy(&anneal->cond);
+		sa_mutex_destroy(&anneal->mutex);
+		free(anneal);
+		return NULL;
+	}
 	
-	// Swap completed successfully
-	return sa_true;
+	return anneal;
 }
 
-void sa_run_steps(sa_state_t *state, size_t num_steps, int distance_limit, double temperature,
-                  size_t *num_accepted, double *cost_delta, double *cost_delta_sd) {
+void sa_get_anneal_progress(const sa_anneal_t *anneal, sa_progress_t *progress) {
+	unsigned int words[SA_PROGRESS_WORDS];
+	unsigned int sequence;
 	size_t i;
 	
-	// Used to calculate a running standard-deviation of cost changes
-	double mean = 0.0;
-	double m2 = 0.0;
+	// Retry until the record was not modified while being copied
+	do {
+		sequence = SA_ATOMIC_LOAD(&anneal->progress_sequence);
+		for (i = 0; i < SA_PROGRESS_WORDS; i++)
+			words[i] = SA_ATOMIC_LOAD(&anneal->progress[i]);
+	} while ((sequence & 1) ||
+	         sequence != SA_ATOMIC_LOAD(&anneal->progress_sequence));
 	
-	double delta;
+	memcpy(progress, words, sizeof(sa_progress_t));
+}
+
+void sa_get_anneal_snapshot(sa_anneal_t *anneal, sa_placement_t *placements) {
+	sa_mutex_lock(&anneal->mutex);
 	
-	*num_accepted = 0;
-	*cost_delta = 0.0;
+	// Wait for any other snapshot in progress to complete
+	while (anneal->snapshot && !anneal->finished)
+		sa_cond_wait(&anneal->cond, &anneal->mutex);
 	
-	for (i = 0; i < num_steps; i++) {
-		double cost_change;
-		sa_bool_t accepted = sa_step(state, distance_limit, temperature, &cost_change);
-		
-		if (accepted)
-			(*num_accepted)++;
-		
-		*cost_delta += cost_change;
-		
-		delta = cost_change - mean;
-		mean += delta / (i + 1.0);
-		m2 += delta * (cost_change - mean);
+	if (!anneal->finished) {
+		// Ask the thread to pause and take the snapshot
+		anneal->snapshot = placements;
+		SA_ATOMIC_STORE(&anneal->interrupt, 1);
+		while (anneal->snapshot == placements && !anneal->finished)
+			sa_cond_wait(&anneal->cond, &anneal->mutex);
 	}
 	
-	// Calculate the standard deviation of cost changes
-	*cost_delta_sd = sqrt(m2 / (num_steps - 1.0));
+	// Once finished, the state is no longer being modified and may be copied
+	// directly
+	if (anneal->finished) {
+		if (anneal->snapshot == placements)
+			anneal->snapshot = NULL;
+		sa_copy_placement(anneal->state, placements);
+	}
+	
+	sa_mutex_unlock(&anneal->mutex);
+}
+
+void sa_stop_anneal(sa_anneal_t *anneal) {
+	sa_mutex_lock(&anneal->mutex);
+	anneal->stop = sa_true;
+	SA_ATOMIC_STORE(&anneal->interrupt, 1);
+	sa_mutex_unlock(&anneal->mutex);
+}
+
+void sa_join_anneal(sa_anneal_t *anneal, sa_progress_t *progress) {
+#if defined(_WIN32) || defined(WIN32)
+	WaitForSingleObject(anneal->thread, INFINITE);
+	CloseHandle(anneal->thread);
+#else
+	pthread_join(anneal->thread, NULL);
+#endif
+	
+	if (progress)
+		sa_get_anneal_progress(anneal, progress);
+	
+	sa_cond_destroy(&anneal->cond);
+	sa_mutex_destroy(&anneal->mutex);
+	free(anneal);
 }
@@ -6,6 +6,8 @@
 #ifndef SA_H
 #define SA_H
 
+#include <signal.h>
+
 ////////////////////////////////////////////////////////////////////////////////
 // Bools, for Windows support...
 ////////////////////////////////////////////////////////////////////////////////
@@ -20,30 +22,313 @@ static const sa_bool_t sa_false = 0;
 
 typedef struct sa_net sa_net_t;
 typedef struct sa_vertex sa_vertex_t;
+typedef struct sa_state sa_state_t;
+
+// When SA_COMPACT is defined, vertices and nets use a compact representation
+// intended for very large netlists: coordinates are 16-bit, counts and
+// indices are 32-bit and nets and vertices refer to each other by their
+// (32-bit) index in state->nets and state->vertices rather than by pointer,
+// halving the memory used by every pin. Systems are then limited to 32767x32767
+// chips and fewer than 2^32 - 1 vertices and nets.
+//
+// Regardless of the representation, the members of nets and vertices should be
+// accessed using the macros below. sa_vertex_ref_t and sa_net_ref_t are the
+// types of the elements of net->vertices[] and vertex->nets[] respectively and
+// SA_NO_REF marks an element which has not yet been set.
+#if defined(SA_COMPACT)
+typedef short sa_coord_t;
+typedef unsigned int sa_count_t;
+typedef unsigned int sa_vertex_ref_t;
+typedef unsigned int sa_net_ref_t;
+#define SA_NO_REF ((unsigned int)-1)
+#define SA_NET_VERTEX(state, net, i) ((state)->vertices[(net)->vertices[i]])
+#define SA_VERTEX_NET(state, vertex, i) ((state)->nets[(vertex)->nets[i]])
+#define SA_VERTEX_REF(vertex) ((vertex)->index)
+#define SA_NET_REF(net) ((net)->index)
+#else
+typedef int sa_coord_t;
+typedef size_t sa_count_t;
+typedef sa_vertex_t *sa_vertex_ref_t;
+typedef sa_net_t *sa_net_ref_t;
+#define SA_NO_REF NULL
+#define SA_NET_VERTEX(state, net, i) ((net)->vertices[i])
+#define SA_VERTEX_NET(state, vertex, i) ((vertex)->nets[i])
+#define SA_VERTEX_REF(vertex) (vertex)
+#define SA_NET_REF(net) (net)
+#endif
+
+// The models which may be used to estimate the cost of a net (see
+// sa_get_net_cost()).
+typedef enum sa_cost_model {
+	// Half-perimeter wire length of the net's bounding box on a square grid,
+	// scaled by the square root of the number of vertices in the net.
+	SA_COST_MODEL_HPWL = 0,
+	
+	// The sum of the (square grid) distances between every pair of vertices in
+	// the net divided by one less than the number of vertices in the net.
+	SA_COST_MODEL_CLIQUE = 1,
+	
+	// The sum of the (square grid) distances from the first vertex in the net
+	// (which should be its source) to every other vertex.
+	SA_COST_MODEL_STAR = 2,
+	
+	// As SA_COST_MODEL_STAR but using the length of the shortest path through
+	// the hexagonal network.
+	SA_COST_MODEL_HEX_STAR = 3,
+	
+	// Use the function state->custom_net_cost.
+	SA_COST_MODEL_CUSTOM = 4
+} sa_cost_model_t;
+
+// The six links of each chip in the hexagonal network.
+typedef enum sa_link {
+	SA_LINK_EAST = 0,
+	SA_LINK_NORTH_EAST = 1,
+	SA_LINK_NORTH = 2,
+	SA_LINK_WEST = 3,
+	SA_LINK_SOUTH_WEST = 4,
+	SA_LINK_SOUTH = 5
+} sa_link_t;
+
+#define SA_NUM_LINKS 6
+
+// The ways in which sa_step() may select the vertex to move.
+typedef enum sa_vertex_selection {
+	// Every movable vertex is equally likely to be chosen.
+	SA_VERTEX_SELECTION_UNIFORM = 0,
+	
+	// Vertices are chosen with a probability proportional to the total cost of
+	// the nets they belong to (see sa_prepare()). Every vertex is given a small
+	// minimum weight (see sa_state_t.vertex_weight_floor) so that vertices
+	// whose nets currently cost nothing may still be moved.
+	SA_VERTEX_SELECTION_COST_WEIGHTED = 1
+} sa_vertex_selection_t;
+
+// The random number generators which may be used by the algorithm.
+typedef enum sa_rng {
+	// The C library's rand() function, seeded as usual using srand().
+	SA_RNG_RAND = 0,
+	
+	// A counter-based generator (Philox4x32-10, see sa_philox()) keyed by
+	// state->rng_seed. The numbers drawn during a step depend only on the seed,
+	// state->rng_stream and the index of the step so that the draws of any step
+	// can be regenerated independently and separate streams (e.g. one per
+	// thread) share no generator state.
+	SA_RNG_PHILOX = 1
+} sa_rng_t;
+
+// Flags which may be combined to give the policy used to allocate the large
+// arrays held by an sa_state_t (see sa_new_with_policy()). The flags only have
+// an effect under Linux; elsewhere, and whenever the requested kind of memory
+// is unavailable, ordinary memory is used.
+typedef enum sa_alloc_policy {
+	// Allocate arrays using calloc().
+	SA_ALLOC_DEFAULT = 0,
+	
+	// Back large arrays with explicit huge pages when any have been reserved
+	// (e.g. via /proc/sys/vm/nr_hugepages) and transparent huge pages
+	// otherwise, reducing TLB misses during random accesses.
+	SA_ALLOC_HUGE_PAGES = 1,
+	
+	// Interleave the pages of large arrays across all NUMA nodes so that
+	// threads running on every node see the same average access latency.
+	SA_ALLOC_NUMA_INTERLEAVE = 2
+} sa_alloc_policy_t;
+
+// The ways in which sa_run_steps_until() may finish.
+typedef enum sa_run_status {
+	// All of the requested steps were performed.
+	SA_RUN_FINISHED = 0,
+	
+	// The time limit was reached first.
+	SA_RUN_TIMED_OUT = 1,
+	
+	// The cancellation flag was set first.
+	SA_RUN_CANCELLED = 2
+} sa_run_status_t;
+
+// The progress of a background anneal (see sa_start_anneal()).
+typedef struct sa_progress {
+	// The temperature of the current (or, once finished, last) batch of steps.
+	double temperature;
+	
+	// The total cost of the placement, tracked incrementally.
+	double cost;
+	
+	// The fraction of steps accepted in the last complete batch.
+	double accept_rate;
+	
+	// The total number of steps performed.
+	unsigned long long num_steps;
+	
+	// True until the anneal has finished (or stopped).
+	sa_bool_t running;
+} sa_progress_t;
+
+// An anneal running on a background thread (see sa_start_anneal()).
+typedef struct sa_anneal sa_anneal_t;
+
+// Epoch-stamped visit marks used to evaluate moves without modifying the state
+// (see sa_get_swap_cost_pure()). Each evaluation takes fresh stamps so the
+// arrays only need clearing when the epoch wraps around.
+typedef struct sa_visit {
+	unsigned int epoch;
+	
+	// The stamp last given to each net and vertex, indexed by their index
+	// fields. Arrays [num_nets] and [num_vertices].
+	unsigned int *net_stamps;
+	unsigned int *vertex_stamps;
+} sa_visit_t;
+
+// A record of a vertex moved by an accepted move (see sa_set_trace()).
+typedef struct sa_trace_entry {
+	// The step which made the move (i.e. state->rng_step at the time).
+	unsigned long long step;
+	
+	// The change in cost caused by the move. A move of several vertices is
+	// recorded as one entry per vertex with the change given in the first entry
+	// and 0.0 in the others so that the changes of all entries sum to the total
+	// change in cost.
+	double delta;
+	
+	// The index of the vertex moved (see sa_prepare()).
+	sa_count_t vertex;
+	
+	// The chip the vertex moved from and the chip it moved to.
+	sa_coord_t from_x;
+	sa_coord_t from_y;
+	sa_coord_t to_x;
+	sa_coord_t to_y;
+} sa_trace_entry_t;
+
+// The position of a vertex as returned by sa_read_dirty_vertices().
+typedef struct sa_placement {
+	// The index of the vertex (see sa_prepare()).
+	sa_count_t vertex;
+	
+	// The chip the vertex is placed on.
+	sa_coord_t x;
+	sa_coord_t y;
+} sa_placement_t;
+
+// The types of move which may be proposed by sa_step().
+typedef enum sa_move_type {
+	// Move a random vertex to a nearby chip, evicting vertices from that chip
+	// to the vertex's original chip as required.
+	SA_MOVE_VERTEX = 0,
+	
+	// Swap all of the movable vertices on the chip of a random vertex with all
+	// of those on a nearby chip.
+	SA_MOVE_CHIP_SWAP = 1,
+	
+	// Move a random vertex to an adjacent chip which has room for it without
+	// evicting any vertices.
+	SA_MOVE_SHIFT = 2,
+	
+	// Move a random vertex, along with all other vertices on its chip which
+	// share a net with it, to a nearby chip, evicting vertices from that chip
+	// as required.
+	SA_MOVE_CLUSTER = 3
+} sa_move_type_t;
+
+#define SA_NUM_MOVE_TYPES 4
+
+// A user-supplied net cost function for use with SA_COST_MODEL_CUSTOM. Will be
+// passed the state->custom_net_cost_data pointer as its final argument.
+typedef double (*sa_net_cost_fn_t)(sa_state_t *state, sa_net_t *net, void *data);
+
+// A histogram of the positions of a net's vertices along one axis of the
+// system (see sa_net_histogram_t).
+typedef struct sa_axis_histogram {
+	// The number of the net's vertices in each column (or row). An array
+	// [width] (or [height]).
+	int *counts;
+	
+	// Without wrap-around links: the lowest and highest occupied column.
+	int min;
+	int max;
+	
+	// A max-tree over the columns with num_leaves (a power of two) leaves, the
+	// leaf of column c being gaps[num_leaves + c] and the children of node i
+	// being nodes 2i and 2i+1. The leaf of each occupied column holds the
+	// distance to the next occupied column (cyclically, with wrap-around links,
+	// and otherwise just 1) while other leaves are zero. Each node holds the
+	// larger of its children so gaps[1] is the largest gap between consecutive
+	// occupied columns. An array [2 * num_leaves].
+	int *gaps;
+	int num_leaves;
+} sa_axis_histogram_t;
+
+// Per-column and per-row vertex counts for a high-fanout net. These allow the
+// bounding box of the net to be maintained incrementally as its vertices move
+// rather than being recomputed from every vertex position (see sa_prepare()).
+typedef struct sa_net_histogram {
+	sa_axis_histogram_t x;
+	sa_axis_histogram_t y;
+} sa_net_histogram_t;
 
 // Information associated with an individual net
 struct sa_net {
 	double weight;
 	
 	// The number of vertices in the net (and thus the length of the array below)
-	size_t num_vertices;
+	sa_count_t num_vertices;
 	
 	// Has this net been counted when computing net weight? (Used by
 	// sa_get_swap_cost).
 	sa_bool_t counted;
 	
-	// The set of vertices which belong to this net
-	sa_vertex_t *vertices[];
+	// If not NULL, the histogram of vertex positions used to compute this net's
+	// cost. Created by sa_prepare() for nets with at least
+	// state->net_histogram_min_fanout vertices.
+	sa_net_histogram_t *histogram;
+	
+	// The number of vertices at the end of the array below which are not
+	// movable. Set by sa_prepare() which moves every non-movable vertex other
+	// than the first (the source) to the end of the array. When equal to
+	// num_vertices, no vertex of the net can move and the net's cost is included
+	// in state->fixed_net_cost instead.
+	sa_count_t num_fixed_vertices;
+	
+	// If not NULL, the distinct X coordinates followed by the distinct Y
+	// coordinates, each in ascending order, of the last num_fixed_vertices
+	// vertices of the net. Created by sa_prepare() for nets without a histogram
+	// when the HPWL cost model is in use so that only the remaining vertices
+	// need be visited to compute the net's cost.
+	int *fixed_coords;
+	sa_count_t num_fixed_xs;
+	sa_count_t num_fixed_ys;
+	
+	// Is this net frozen? Set by sa_prepare() for nets with at least
+	// state->frozen_net_min_fanout vertices. Frozen nets are left out of the
+	// cost changes computed by sa_step() and sa_get_swap_cost() so that the
+	// work done by a step does not grow with the fanout of the nets involved.
+	// Instead, sa_run_steps() recomputes their cost periodically.
+	sa_bool_t frozen;
+	
+	// The cost of this net when last computed. Only maintained when
+	// cost-weighted vertex selection is in use.
+	double cost;
+	
+	// The index of this net in state->nets (set by sa_prepare() and, with
+	// SA_COMPACT, by sa_add_vertex_to_net()).
+	sa_count_t index;
+	
+	// The set of vertices which belong to this net (see SA_NET_VERTEX())
+	sa_vertex_ref_t vertices[];
 };
 
 
 // The state of a particular vertex
 struct sa_vertex {
-	// The coordinates of the chip this vertex is placed on
-	int x;
-	int y;
+	// The coordinates of the chip this vertex is placed on (both -1 until the
+	// vertex is first added to a chip)
+	sa_coord_t x;
+	sa_coord_t y;
 	
-	// A pointer to the array of resources this vertex consumes...
+	// A pointer to the array of resources this vertex consumes. This may be
+	// shared by vertices of the same class (see
+	// sa_new_vertex_with_resources()).
 	int *vertex_resources;
 	
 	// Pointer to the next vertex on the same chip as this one (or NULL if no
@@ -51,15 +336,19 @@ struct sa_vertex {
 	// lists.
 	sa_vertex_t *next;
 	
-	size_t num_nets;
+	sa_count_t num_nets;
+	
+	// The index of this vertex in state->vertices (set by sa_prepare() and,
+	// with SA_COMPACT, by sa_add_vertex_to_net()).
+	sa_count_t index;
 	
-	// The array of nets this vertex is a member of
-	sa_net_t *nets[];
+	// The array of nets this vertex is a member of (see SA_VERTEX_NET())
+	sa_net_ref_t nets[];
 };
 
 
 // The state of the whole algorithm
-typedef struct sa_state {
+struct sa_state {
 	// The dimensions of the system under simulation
 	size_t width;
 	size_t height;
@@ -89,7 +378,170 @@ typedef struct sa_state {
 	size_t num_movable_vertices;
 	sa_vertex_t **vertices;
 	
-} sa_state_t;
+	// The model used to compute the cost of each net. Defaults to
+	// SA_COST_MODEL_HPWL.
+	sa_cost_model_t cost_model;
+	
+	// When cost_model is SA_COST_MODEL_CUSTOM, the function used to compute the
+	// cost of a net along with a user-defined pointer to pass to it.
+	sa_net_cost_fn_t custom_net_cost;
+	void *custom_net_cost_data;
+	
+	// Nets with at least this many vertices are given a position histogram by
+	// sa_prepare() when the HPWL cost model is in use.
+	size_t net_histogram_min_fanout;
+	
+	// Have any net histograms been created by sa_prepare()?
+	sa_bool_t has_net_histograms;
+	
+	// Nets with at least this many vertices (and at least one movable vertex)
+	// are frozen by sa_prepare() (see net->frozen). Zero, the default, freezes
+	// no nets.
+	size_t frozen_net_min_fanout;
+	
+	// sa_run_steps() recomputes the cost of the frozen nets when it starts,
+	// every frozen_net_resync_interval steps and before returning, and includes
+	// any change (including changes made by sa_step() since they were last
+	// recomputed) in the cost change it reports. Defaults to 1024.
+	size_t frozen_net_resync_interval;
+	
+	// The indices of the frozen nets, built by sa_prepare(), and their total
+	// cost when last recomputed. An array [num_frozen_nets].
+	size_t num_frozen_nets;
+	sa_count_t *frozen_nets;
+	double frozen_net_cost;
+	
+	// If not NULL, a table built by sa_prepare() for the star cost models giving
+	// the distance between two chips for every displacement (dx, dy) between
+	// them. An array [2*height - 1][2*width - 1] where the element for a
+	// displacement of (0, 0) is at [height - 1][width - 1].
+	int *distance_table;
+	
+	// If greater than zero, a link congestion term is added to the cost. Each
+	// net is assumed to be routed from its first vertex (its source) to every
+	// other vertex along a shortest path through the hexagonal network, each
+	// route adding the net's weight to the usage of every link it uses. Every
+	// link whose usage exceeds link_capacity then adds congestion_weight times
+	// the square of the excess to the cost. Defaults to zero (disabled).
+	double congestion_weight;
+	double link_capacity;
+	
+	// If not NULL, the estimated usage of every link, built by sa_prepare() when
+	// congestion_weight is greater than zero and updated whenever a vertex
+	// moves. An array [height][width][SA_NUM_LINKS].
+	double *link_usage;
+	
+	// The congestion term of the cost, updated along with link_usage.
+	double congestion_cost;
+	
+	// The total cost of the nets none of whose vertices are movable, computed by
+	// sa_prepare() unless the custom cost model is in use. These nets are
+	// skipped by sa_get_total_cost() which adds this constant instead.
+	double fixed_net_cost;
+	
+	// The relative probability of sa_step() proposing each type of move,
+	// indexed by sa_move_type_t. Defaults to only proposing SA_MOVE_VERTEX.
+	double move_weights[SA_NUM_MOVE_TYPES];
+	
+	// The number of moves of each type proposed and accepted by sa_step() since
+	// the start of the last call to sa_run_steps(), indexed by sa_move_type_t.
+	size_t num_moves_proposed[SA_NUM_MOVE_TYPES];
+	size_t num_moves_accepted[SA_NUM_MOVE_TYPES];
+	
+	// How sa_step() selects the vertex to move. Defaults to
+	// SA_VERTEX_SELECTION_UNIFORM.
+	sa_vertex_selection_t vertex_selection;
+	
+	// If not NULL, a Fenwick tree built by sa_prepare() when vertex_selection
+	// is SA_VERTEX_SELECTION_COST_WEIGHTED holding the weight of every movable
+	// vertex (the sum of the costs of its nets plus vertex_weight_floor). An
+	// array [num_movable_vertices + 1]. The weights are updated whenever a move
+	// is accepted.
+	double *vertex_weights;
+	
+	// The sum of all weights in vertex_weights.
+	double vertex_weights_total;
+	
+	// The constant added to the weight of every vertex in vertex_weights, fixed
+	// when the tree is built: a fraction of the mean vertex weight at that time
+	// (or 1.0 if every vertex then had zero weight).
+	double vertex_weight_floor;
+	
+	// If not NULL, tables built by sa_prepare() which allow
+	// sa_get_random_nearby_chip() to pick only live chips (those without
+	// negative resources). live_chip_counts is an array [height + 1][width + 1]
+	// giving the number of live chips below and to the left of each chip
+	// (exclusive) and live_chip_columns is an array [height][width] listing the
+	// X coordinates of the live chips in each row.
+	int *live_chip_counts;
+	int *live_chip_columns;
+	
+	// If not NULL, the resources available on each chip when it holds no
+	// movable vertices, built by sa_prepare(). Used by sa_make_room_on_chip() to
+	// reject impossible requests without removing any vertices. An array
+	// [height][width][num_resource_types].
+	int *chip_capacities;
+	
+	// If not NULL, visit marks allocated by sa_prepare() (unless the custom
+	// cost model is in use) which allow sa_step() to evaluate moves without
+	// modifying the state when neither net histograms nor congestion are in
+	// use.
+	sa_visit_t *visit;
+	
+	// The random number generator used by the algorithm. Defaults to
+	// SA_RNG_RAND.
+	sa_rng_t rng;
+	
+	// The seed and stream ID used by SA_RNG_PHILOX. Both default to zero.
+	unsigned long long rng_seed;
+	unsigned int rng_stream;
+	
+	// The index of the current step, advanced by sa_step() before it draws any
+	// random numbers (see sa_set_rng_step()). The n-th number drawn during a
+	// step is word n % 4 of the Philox block for the counter {n / 4,
+	// rng_stream, rng_step (low and high words)}. Defaults to zero.
+	unsigned long long rng_step;
+	
+	// The number of Philox blocks generated during the current step, the last
+	// block and the number of its words which have been used.
+	unsigned int rng_block;
+	unsigned int rng_buffer[4];
+	unsigned int rng_buffer_used;
+	
+	// The policy used to allocate the large arrays of this state (see
+	// sa_new_with_policy()).
+	sa_alloc_policy_t alloc_policy;
+	
+	// The number of threads used by sa_get_total_cost() when the library is
+	// built with OpenMP. Zero (the default) uses OpenMP's default number of
+	// threads.
+	size_t num_threads;
+	
+	// The number of steps sa_run_steps_until() performs between checks of its
+	// time limit and cancellation flag. Defaults to 256.
+	size_t check_interval;
+	
+	// If not NULL, a ring buffer [trace_capacity] recording the vertices moved
+	// by accepted moves, allocated by sa_set_trace(). trace_start is the index
+	// of the oldest entry and trace_length the number of entries held.
+	sa_trace_entry_t *trace;
+	size_t trace_capacity;
+	size_t trace_start;
+	size_t trace_length;
+	
+	// The number of entries overwritten before being read by sa_read_trace().
+	size_t trace_dropped;
+	
+	// If not NULL, the set of vertices which have moved since they were last
+	// read by sa_read_dirty_vertices(), allocated by sa_set_dirty_tracking().
+	// dirty_bitmap is a bitmap [(num_vertices + 31) / 32] of the vertices in the
+	// set and dirty_vertices an array [num_vertices] listing the indices of the
+	// num_dirty_vertices vertices in the set.
+	unsigned int *dirty_bitmap;
+	sa_count_t *dirty_vertices;
+	size_t num_dirty_vertices;
+	
+};
 
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -109,6 +561,8 @@ typedef struct sa_state {
  * the following steps to completely initialise it:
  *  - state->has_wrap_around_links should be set to true or false depending on
  *    whether the system is configured as a torus (true) or not (false).
+ *  - state->cost_model may be set to select a cost model other than the
+ *    default (SA_COST_MODEL_HPWL).
  *  - the state->chip_resources array should be initialised (see
  *    sa_set_chip_resources) to give the resources available on all chips.
  *    Dead chips should be given negative resource quantities.
@@ -124,7 +578,11 @@ typedef struct sa_state {
  *    vertices.
  *  - sa_add_vertex_to_chip() should be used to specifiy the initial positions
  *    of every movable and non-movable vertex. The initial placement should be
- *    valid (i.e. not over-allocate resources).
+ *    valid (i.e. not over-allocate resources). Alternatively, once the
+ *    non-movable vertices have been added, sa_place_initial() may be used to
+ *    place all movable vertices.
+ *  - Optionally, sa_prepare() may then be called to build the auxiliary
+ *    datastructures used to accelerate the algorithm.
  *
  * @param width The width of the hexagonal network network in chips.
  * @param height The height of the hexagonal network network in chips.
@@ -138,6 +596,19 @@ typedef struct sa_state {
 sa_state_t *sa_new(size_t width, size_t height, size_t num_resource_types,
                    size_t num_vertices, size_t num_nets);
 
+/**
+ * As sa_new() but allows the memory used by the large arrays in the state
+ * (both those allocated here and those built by sa_prepare()) to be allocated
+ * according to a given policy. Arrays smaller than a huge page are always
+ * allocated normally.
+ *
+ * @param policy A combination of sa_alloc_policy_t flags.
+ */
+sa_state_t *sa_new_with_policy(size_t width, size_t height,
+                               size_t num_resource_types,
+                               size_t num_vertices, size_t num_nets,
+                               sa_alloc_policy_t policy);
+
 /**
  * Free all memory associated with a SA algorithm run (including all nets and
  * vertices).
@@ -149,7 +620,8 @@ void sa_free(sa_state_t *state);
  *
  * After calling this function the following initialisation steps are required:
  *  - A pointer to the new vertex should be added to state->vertices[] (see
- *    sa_new()).
+ *    sa_new()). With SA_COMPACT, this must be done before the vertex is added
+ *    to any net.
  *  - All resources consumed by the vertex must be specified in
  *    vertex->vertex_resources[]. These values must not be changed once the
  *    vertex has been added to a chip.
@@ -167,6 +639,26 @@ void sa_free(sa_state_t *state);
  */
 sa_vertex_t *sa_new_vertex(const sa_state_t *state, size_t num_nets);
 
+/**
+ * As sa_new_vertex() but rather than being given its own resource array, the
+ * vertex uses the supplied array. Vertices which consume the same resources
+ * (e.g. those of the same type) may share a single array (a resource class),
+ * saving memory when there are many vertices.
+ *
+ * @param state The SA algorithm state associated with the vertex.
+ * @param num_nets The exact number of unique nets that this vertex is
+ *                 connected to.
+ * @param resources An array [num_resource_types] giving the resources consumed
+ *                  by the vertex. Must not be changed or freed while the
+ *                  vertex exists.
+ *
+ * @returns A pointer to a new sa_vertex_t or NULL if memory allocation failed.
+ *          Must be freed by sa_free() (which internally uses
+ *          sa_free_vertex()).
+ */
+sa_vertex_t *sa_new_vertex_with_resources(const sa_state_t *state,
+                                          size_t num_nets, int *resources);
+
 /**
  * For internal use only. Free all memory associated with a vertex.
  */
@@ -177,6 +669,7 @@ void sa_free_vertex(sa_vertex_t *vertex);
  *
  * After calling this function the following initialisation steps are required:
  *  - A pointer to the new net should be added to state->nets[] (see sa_new()).
+ *    With SA_COMPACT, this must be done before any vertex is added to the net.
  *  - The net's weight should be set in net->weight to a positive double.
  *  - All vertices the net connects must be specified using
  *    sa_add_vertex_to_net(). Note: Source vertices must be added to the net
@@ -209,6 +702,84 @@ void sa_free_net(sa_net_t *net);
  */
 void sa_add_vertex_to_chip(sa_state_t *state, sa_vertex_t *vertex, int x, int y, sa_bool_t movable);
 
+/**
+ * Build the auxiliary datastructures used to accelerate the algorithm. Calling
+ * this function is optional.
+ *
+ * Must be called after the state has been completely initialised (see
+ * sa_new()). Once called, vertex positions must only be changed using the
+ * functions in this library (and not by writing to vertex->x and vertex->y
+ * directly) and state->has_wrap_around_links and state->cost_model must not be
+ * changed. The function may be called again to rebuild the datastructures.
+ *
+ * The following datastructures are built:
+ *  - An index of the live chips in the system (see state->live_chip_counts)
+ *    which allows only live chips to be proposed as move targets. Chips must
+ *    not be killed or revived once this has been built.
+ *  - The capacity of every chip when holding no movable vertices (see
+ *    state->chip_capacities). Non-movable vertices must not be added or removed
+ *    once this has been built.
+ *  - When using the HPWL cost model, a position histogram (see
+ *    sa_net_histogram_t) for every net with at least
+ *    state->net_histogram_min_fanout vertices. This makes the cost of such nets
+ *    independent of their fanout.
+ *  - Unless state->num_movable_vertices is zero, the non-movable vertices of
+ *    every net (other than its first) are moved to the end of the net (see
+ *    net->num_fixed_vertices). When using the HPWL cost model the coordinates
+ *    of these vertices are recorded (see net->fixed_coords) so that they need
+ *    not be visited again. The non-movable vertices must therefore be placed
+ *    beforehand.
+ *  - Likewise, the total cost of the nets with no movable vertices (see
+ *    state->fixed_net_cost). The weights of these nets and the cost model must
+ *    not be changed once this has been computed.
+ *  - When state->frozen_net_min_fanout is non-zero, the list of nets frozen
+ *    because of their fanout (see state->frozen_nets).
+ *  - When using a star cost model, a table of the distances between every
+ *    pair of chips (see state->distance_table) so that net costs are computed
+ *    using table lookups alone.
+ *  - When state->congestion_weight is greater than zero, the link usage map
+ *    (see state->link_usage).
+ *  - When state->vertex_selection is SA_VERTEX_SELECTION_COST_WEIGHTED, the
+ *    tree of vertex weights used to select vertices to move (see
+ *    state->vertex_weights). Until this is built, vertices are selected
+ *    uniformly.
+ *
+ * @param state The SA algorithm state to prepare.
+ *
+ * @returns True on success or false if memory allocation failed. On failure
+ *          the state remains usable but unaccelerated.
+ */
+sa_bool_t sa_prepare(sa_state_t *state);
+
+// Marks a net removed by sa_merge_nets() in its net_map.
+#define SA_NET_REMOVED ((size_t)-1)
+
+/**
+ * Simplify the netlist by merging nets which connect the same vertices and
+ * removing nets which can never have a cost.
+ *
+ * Nets with the same source (first vertex) and the same set of other vertices
+ * are merged into the first of them, whose weight becomes the sum of their
+ * weights. Since the cost of a net under every built-in cost model (and its
+ * contribution to link congestion) is proportional to its weight, the total
+ * cost is unchanged. Nets with fewer than two vertices are removed. The merged
+ * and removed nets are freed, the remaining nets are packed (in their original
+ * order) at the start of state->nets and renumbered, state->num_nets is
+ * reduced and the nets of every vertex are updated to match.
+ *
+ * This should be called once all vertices and nets have been added and
+ * before sa_prepare() (any data structures it built are freed).
+ *
+ * @param state The SA algorithm state to simplify.
+ * @param net_map If not NULL, an array [state->num_nets] (the number of nets
+ *                before merging) which is set to the new index of the net each
+ *                original net was merged into or SA_NET_REMOVED.
+ *
+ * @returns True on success or false if memory allocation failed in which case
+ *          the state is unchanged.
+ */
+sa_bool_t sa_merge_nets(sa_state_t *state, size_t *net_map);
+
 /**
  * Add the specified vertex to a net, updating the datastructures of both.
  *
@@ -358,20 +929,30 @@ sa_bool_t sa_make_room_on_chip(sa_state_t *state, int x, int y,
 ////////////////////////////////////////////////////////////////////////////////
 
 /**
- * Select a movable vertex at random with uniform probability.
+ * Select a movable vertex at random with uniform probability or, if the vertex
+ * weights have been built (see state->vertex_selection), with probability
+ * proportional to the vertex's weight.
  *
- * The rand() function is used to generate random numbers and may be seeded as
- * usual.
+ * Random numbers are drawn from the generator selected by state->rng.
  *
  * @param state The SA algorithm state from which to pick a movable vertex.
  * @returns A pointer to a movable vertex.
  */
-sa_vertex_t *sa_get_random_movable_vertex(const sa_state_t *state);
+sa_vertex_t *sa_get_random_movable_vertex(sa_state_t *state);
 
 /**
  * Select another chip randomly which is within the specified range of the
  * specified chip.
  *
+ * If sa_prepare() has been called, only live chips are selected (unless there
+ * are no other live chips in range). Selection takes O(1) time in expectation
+ * when most chips in range are live and, at worst, time logarithmic in the
+ * distance limit.
+ *
+ * sa_prepare() must be called (after all chip resources have been set) for
+ * dead chips to be avoided: on an unprepared state any chip in range, live or
+ * dead, may be returned.
+ *
  * @param state The SA algorithm state describing the chips to chose from
  * @param x The X coordinate of the chip near which another will be chosen.
  * @param y The Y coordinate of the chip near which another will be chosen.
@@ -381,10 +962,91 @@ sa_vertex_t *sa_get_random_movable_vertex(const sa_state_t *state);
  * @param x_out Pointer to be set to the X coordinate of the selected chip.
  * @param y_out Pointer to be set to the Y coordinate of the selected chip.
  */
-void sa_get_random_nearby_chip(const sa_state_t *state, int x, int y,
+void sa_get_random_nearby_chip(sa_state_t *state, int x, int y,
                                int distance_limit,
                                int *x_out, int *y_out);
 
+/**
+ * Compute one block of the Philox4x32-10 counter-based random number
+ * generator used by SA_RNG_PHILOX.
+ *
+ * The output is a pseudo-random function of the counter and key alone, making
+ * it straight-forward to regenerate the numbers drawn by any step of the
+ * algorithm (see state->rng_step).
+ *
+ * @param counter The four 32-bit words of the counter.
+ * @param key The two 32-bit words of the key.
+ * @param out Set to the four 32-bit words of random output.
+ */
+void sa_philox(const unsigned int counter[4], const unsigned int key[2],
+               unsigned int out[4]);
+
+/**
+ * Set the index of the current step of the SA_RNG_PHILOX generator.
+ *
+ * The following random numbers are drawn from the start of the given step's
+ * sequence, for example to replay the step. The next call to sa_step() will
+ * use step index step + 1.
+ *
+ * @param state The SA algorithm state whose generator is to be set.
+ * @param step The new step index.
+ */
+void sa_set_rng_step(sa_state_t *state, unsigned long long step);
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Initial placement
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Produce an initial placement for all movable vertices.
+ *
+ * Vertices are ordered by a breadth-first traversal of the netlist so that
+ * connected vertices are adjacent in the ordering and then packed, in that
+ * order, onto the live chips in the order they are visited by a Hilbert curve.
+ * The resulting placement is valid and has good locality, allowing annealing
+ * to begin at a lower temperature than it would from an arbitrary placement.
+ *
+ * This function may be used in place of calling sa_add_vertex_to_chip() for the
+ * movable vertices when initialising the state (see sa_new()): all other
+ * initialisation steps, including adding the non-movable vertices to their
+ * chips, must be completed first. If used, sa_prepare() should be called
+ * afterwards.
+ *
+ * @param state The SA algorithm state whose movable vertices are to be placed.
+ *
+ * @returns True if all movable vertices were placed. False if the vertices
+ *          could not all be fitted onto the available chips or if memory
+ *          allocation failed, in which case no vertices are placed.
+ */
+sa_bool_t sa_place_initial(sa_state_t *state);
+
+/**
+ * Produce an initial placement for all movable vertices by analytic (quadratic)
+ * placement.
+ *
+ * The squared wire length of the nets (each modelled as a clique or, for large
+ * nets, a star) is minimised by solving a sparse linear system with the
+ * conjugate gradient method. Non-movable vertices act as anchors and every
+ * vertex is also weakly pulled towards the centre of the system. Wrap-around
+ * links are ignored. The resulting positions are spread out in proportion to
+ * the number of live chips in each row and column and each vertex is then
+ * placed on the nearest chip with room for it.
+ *
+ * The same preconditions apply as for sa_place_initial(). The placement
+ * produced is typically good enough that annealing need only be performed at
+ * low temperatures.
+ *
+ * @param state The SA algorithm state whose movable vertices are to be placed.
+ * @param max_iterations The maximum number of conjugate gradient iterations
+ *                       to perform (for each axis).
+ *
+ * @returns True if all movable vertices were placed. False if the vertices
+ *          could not all be fitted onto the available chips or if memory
+ *          allocation failed, in which case no vertices are placed.
+ */
+sa_bool_t sa_place_quadratic(sa_state_t *state, size_t max_iterations);
+
 
 ////////////////////////////////////////////////////////////////////////////////
 // Simulated annealing algorithm functions
@@ -393,10 +1055,49 @@ void sa_get_random_nearby_chip(const sa_state_t *state, int x, int y,
 /**
  * Compute the current cost of the specified net.
  *
- * Cost is estimated using a simple HPWL heuristic on a square grid...
+ * Cost is estimated using the model selected by state->cost_model. By default
+ * this is a simple HPWL heuristic on a square grid...
+ *
+ * If the net has a position histogram (see sa_prepare()), its bounding box is
+ * taken from the histogram and so the cost is computed without visiting every
+ * vertex in the net. Likewise, the non-movable vertices of a prepared net are
+ * not visited when using the HPWL model.
  */
 double sa_get_net_cost(sa_state_t *state, sa_net_t *net);
 
+/**
+ * Compute the sum of the costs of every net in the system plus the congestion
+ * cost (see sa_get_congestion_cost()).
+ *
+ * The net costs are summed using compensated summation in fixed-size chunks
+ * which are evaluated in parallel when the library is built with OpenMP (see
+ * state->num_threads). The result does not depend on the number of threads.
+ */
+double sa_get_total_cost(sa_state_t *state);
+
+/**
+ * As sa_get_total_cost() but also records the cost of every net.
+ *
+ * @param state The SA algorithm state.
+ * @param net_costs If not NULL, an array [num_nets] which is set to the cost of
+ *                  each net in state->nets.
+ */
+double sa_get_total_cost_per_net(sa_state_t *state, double *net_costs);
+
+/**
+ * Compute the link congestion term of the cost (see state->congestion_weight).
+ * Zero if the link usage map has not been built by sa_prepare().
+ *
+ * As a side effect, state->congestion_cost is recomputed from scratch.
+ */
+double sa_get_congestion_cost(sa_state_t *state);
+
+/**
+ * Get the estimated usage of a link. Only valid when the link usage map has
+ * been built by sa_prepare() (see state->congestion_weight).
+ */
+double sa_get_link_usage(const sa_state_t *state, size_t x, size_t y, sa_link_t link);
+
 /**
  * Compute the change in cost which would result from swapping the location of
  * the vertices va and vb.
@@ -416,6 +1117,10 @@ double sa_get_net_cost(sa_state_t *state, sa_net_t *net);
  * @param by The Y position of the chip vertices vb were removed from.
  * @param vb A linked list of vertices which have been removed from a chip.
  *
+ * If the link usage map has been built (see state->congestion_weight) it is
+ * also updated as a side-effect and the change in the congestion cost is
+ * included in the result.
+ *
  * @returns The change in cost which would result from performing the proposed
  *          swap. -ve is better.
  */
@@ -423,10 +1128,64 @@ double sa_get_swap_cost(sa_state_t *state,
                         int ax, int ay, sa_vertex_t *va,
                         int bx, int by, sa_vertex_t *vb);
 
+/**
+ * Allocate the visit marks used by sa_get_swap_cost_pure(), sized for the nets
+ * and vertices of the given state.
+ *
+ * @returns A pointer to a new sa_visit_t or NULL if memory allocation failed.
+ *          Must be freed by sa_free_visit().
+ */
+sa_visit_t *sa_new_visit(const sa_state_t *state);
+
+/**
+ * Free an sa_visit_t allocated by sa_new_visit(). Does nothing if passed
+ * NULL.
+ */
+void sa_free_visit(sa_visit_t *visit);
+
+/**
+ * Compute the change in cost which would result from moving the vertices va
+ * from chip A to chip B and the vertices vb from chip B to chip A without
+ * modifying the state in any way.
+ *
+ * Unlike sa_get_swap_cost(), the vertices need not have been removed from
+ * their chips and their positions are not changed: the cost of each affected
+ * net is computed from the hypothetical positions of its vertices. Nets
+ * shared by several of the moved vertices are counted once using the
+ * caller-owned visit marks rather than net->counted. Any number of threads may
+ * therefore evaluate moves against the same state concurrently, provided each
+ * uses its own sa_visit_t and the state is not modified meanwhile.
+ *
+ * The vertices and nets must have been numbered by sa_prepare(). Net
+ * histograms are not used, the custom cost model is not supported and the
+ * congestion term is not included.
+ *
+ * @param state The SA algorithm state associated with the vertices.
+ * @param visit Visit marks from sa_new_visit() for this state.
+ * @param ax The X position of chip A.
+ * @param ay The Y position of chip A.
+ * @param va An array of the num_va vertices on chip A to move to chip B.
+ * @param bx The X position of chip B.
+ * @param by The Y position of chip B.
+ * @param vb An array of the num_vb vertices on chip B to move to chip A.
+ *
+ * @returns The change in cost which would result from performing the proposed
+ *          swap. -ve is better.
+ */
+double sa_get_swap_cost_pure(const sa_state_t *state, sa_visit_t *visit,
+                             int ax, int ay, sa_vertex_t *const *va, size_t num_va,
+                             int bx, int by, sa_vertex_t *const *vb, size_t num_vb);
+
 /**
  * Attempt a single random swap operation and accept it according to the rules
  * of the SA.
  *
+ * The type of move attempted is chosen randomly according to
+ * state->move_weights and the state->num_moves_proposed and
+ * state->num_moves_accepted counters are incremented accordingly.
+ *
+ * No chip's vertex list or resources are modified unless the move is accepted.
+ *
  * @param state The SA algorithm state to run within.
  * @param distance_limit The maximum rectangular-radius a swap may be made over.
  * @param temperature The current annealing temperature.
@@ -443,17 +1202,248 @@ sa_bool_t sa_step(sa_state_t *state, int distance_limit, double temperature, dou
  * Run a predetermined number of random swaps at a given temperature and
  * distance limit and return statistics about the run.
  *
+ * The cost model is selected once at the start of the run and the steps are
+ * executed by a version of the algorithm specialised for that model.
+ *
+ * The number of moves of each type proposed and accepted during the run are
+ * reported in state->num_moves_proposed and state->num_moves_accepted.
+ *
  * @param state The SA algorithm state to run within.
  * @param num_steps The number of steps to attempt.
  * @param distance_limit The maximum rectangular-radius a swap may be made over.
  * @param temperature The current annealing temperature.
  * @param num_accepted Returns the number of swaps of the num_steps made which
  *        were accepted.
- * @param cost_delta Returns the overall change in cost after the run.
+ * @param cost_delta Returns the overall change in cost after the run
+ *                   (including that of any frozen nets, see net->frozen, and
+ *                   any change to their cost left unreported by earlier calls
+ *                   to sa_step()).
  * @param cost_delta_sd Returns the standard deviation of cost changes during
  *                      the run.
  */
 void sa_run_steps(sa_state_t *state, size_t num_steps, int distance_limit, double temperature,
                   size_t *num_accepted, double *cost_delta, double *cost_delta_sd);
 
+/**
+ * As sa_run_steps() but stopping early if a time limit is reached or if a
+ * cancellation flag is set.
+ *
+ * The time limit and flag are checked before the first step and then every
+ * state->check_interval steps so a run may overshoot its time limit by the
+ * time taken to perform that many steps.
+ *
+ * @param state The SA algorithm state to run within.
+ * @param num_steps The maximum number of steps to attempt.
+ * @param distance_limit The maximum rectangular-radius a swap may be made over.
+ * @param temperature The current annealing temperature.
+ * @param time_limit The maximum time to run for in seconds (as measured by
+ *                   sa_get_time()) or a negative number for no limit.
+ * @param cancel If not NULL, a flag which stops the run when set to a
+ *               non-zero value, e.g. by another thread or a signal handler.
+ * @param num_steps_done Returns the number of steps actually performed.
+ * @param num_accepted Returns the number of swaps made which were accepted.
+ * @param cost_delta Returns the overall change in cost after the run.
+ * @param cost_delta_sd Returns the standard deviation of cost changes during
+ *                      the run.
+ *
+ * @returns Whether the run finished, timed out or was cancelled.
+ */
+sa_run_status_t sa_run_steps_until(sa_state_t *state, size_t num_steps,
+                                   int distance_limit, double temperature,
+                                   double time_limit,
+                                   volatile sig_atomic_t *cancel,
+                                   size_t *num_steps_done, size_t *num_accepted,
+                                   double *cost_delta, double *cost_delta_sd);
+
+/**
+ * Get the time, in seconds, from the monotonic clock used to enforce the time
+ * limits of sa_run_steps_until(). The clock's epoch is unspecified.
+ */
+double sa_get_time(void);
+
+/**
+ * Anneal a placement using a multilevel scheme.
+ *
+ * The netlist is repeatedly coarsened by merging pairs of strongly connected
+ * movable vertices into single vertices with the combined resources of the
+ * pair. The coarsest netlist is annealed, its placement projected onto the
+ * level below and that level's placement refined by further annealing, and so
+ * on until the original netlist has been refined. This allows clusters of
+ * vertices to travel long distances in few steps.
+ *
+ * Coarsening stops early if a level cannot be usefully coarsened. The
+ * coarsest level is annealed for num_steps steps, cooling linearly from
+ * temperature to refine_temperature. Each other level is refined with
+ * num_steps steps at refine_temperature.
+ *
+ * The state must be completely initialised (see sa_new()) with a valid
+ * placement. The coarse levels inherit the cost model, move and vertex
+ * selection settings of the state.
+ *
+ * @param state The SA algorithm state whose placement is to be annealed.
+ * @param num_levels The maximum number of levels, including the original
+ *                   netlist. A value of one anneals only the original netlist.
+ * @param num_steps The number of steps to perform at each level.
+ * @param distance_limit The maximum distance any vertex may move (see
+ *                       sa_step()).
+ * @param temperature The temperature at which the coarsest level starts.
+ * @param refine_temperature The temperature at which levels are refined.
+ *
+ * @returns True on success or false if memory allocation failed in which case
+ *          the placement remains valid but may not have been fully annealed.
+ */
+sa_bool_t sa_run_multilevel(sa_state_t *state, size_t num_levels,
+                            size_t num_steps, int distance_limit,
+                            double temperature, double refine_temperature);
+
+/**
+ * Enable, resize or disable the trace of accepted moves.
+ *
+ * Once enabled, every vertex moved by a move accepted by sa_step() (and hence
+ * sa_run_steps()) is recorded as an sa_trace_entry_t in a ring buffer. When
+ * the buffer is full the oldest entry is overwritten and state->trace_dropped
+ * is incremented. Any entries already recorded are discarded.
+ *
+ * The vertices must have been numbered by sa_prepare(). Moves made by other
+ * functions (e.g. sa_run_multilevel() when projecting coarse placements) are
+ * not recorded.
+ *
+ * @param state The SA algorithm state to trace.
+ * @param capacity The number of entries the trace can hold or zero to disable
+ *                 the trace.
+ *
+ * @returns True on success or false if memory allocation failed in which case
+ *          the trace is disabled.
+ */
+sa_bool_t sa_set_trace(sa_state_t *state, size_t capacity);
+
+/**
+ * Read and remove the oldest entries from the trace of accepted moves.
+ *
+ * @param state The SA algorithm state whose trace is to be read.
+ * @param entries An array of at least max_entries entries into which the
+ *                entries are copied, oldest first.
+ * @param max_entries The maximum number of entries to read.
+ *
+ * @returns The number of entries read.
+ */
+size_t sa_read_trace(sa_state_t *state, sa_trace_entry_t *entries,
+                     size_t max_entries);
+
+/**
+ * Enable or disable tracking of the vertices which have moved.
+ *
+ * Once enabled, any vertex whose position is changed by sa_add_vertex_to_chip()
+ * (and hence by sa_step(), sa_run_steps() and the placement functions) or
+ * which is placed by sa_add_vertices_to_chip_if_fit() is added to a set of
+ * dirty vertices which may be read, and cleared, using
+ * sa_read_dirty_vertices(). The set is initially empty.
+ *
+ * The vertices must have been numbered by sa_prepare().
+ *
+ * @param state The SA algorithm state to track.
+ * @param enable True to enable tracking, false to disable it.
+ *
+ * @returns True on success or false if memory allocation failed in which case
+ *          tracking is disabled.
+ */
+sa_bool_t sa_set_dirty_tracking(sa_state_t *state, sa_bool_t enable);
+
+/**
+ * Read the positions of the vertices which have moved since they were last
+ * read, removing them from the set of dirty vertices.
+ *
+ * Only the dirty vertices are visited, so the cost is proportional to the
+ * number of vertices moved rather than the size of the problem. Vertices are
+ * returned in no particular order.
+ *
+ * @param state The SA algorithm state (see sa_set_dirty_tracking()).
+ * @param placements An array of at least max_placements elements into which
+ *                   the index and current position of each vertex read are
+ *                   written.
+ * @param max_placements The maximum number of vertices to read. Any remaining
+ *                       vertices stay in the set.
+ *
+ * @returns The number of vertices read.
+ */
+size_t sa_read_dirty_vertices(sa_state_t *state, sa_placement_t *placements,
+                              size_t max_placements);
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Background annealing
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Start annealing a placement on a new background thread.
+ *
+ * The thread runs batches of num_steps steps (see sa_run_steps()), starting at
+ * the given temperature and multiplying it by alpha after each batch, until the
+ * temperature falls to final_temperature or below or sa_stop_anneal() is
+ * called. Its progress may be polled using sa_get_anneal_progress() and the
+ * placement sampled using sa_get_anneal_snapshot().
+ *
+ * The state must be completely initialised (see sa_new()) with a valid
+ * placement. It must not be accessed by any other means until
+ * sa_join_anneal() has returned.
+ *
+ * Under Windows, background annealing requires Windows Vista or later.
+ *
+ * @param state The SA algorithm state whose placement is to be annealed.
+ * @param num_steps The number of steps in each batch (at least one).
+ * @param distance_limit The maximum distance any vertex may move (see
+ *                       sa_step()).
+ * @param temperature The temperature of the first batch.
+ * @param alpha The factor by which the temperature is multiplied after each
+ *              batch (less than one).
+ * @param final_temperature The temperature at which annealing stops.
+ *
+ * @returns A handle to the running anneal or NULL if num_steps is zero or
+ *          memory allocation or thread creation failed.
+ */
+sa_anneal_t *sa_start_anneal(sa_state_t *state, size_t num_steps,
+                             int distance_limit, double temperature,
+                             double alpha, double final_temperature);
+
+/**
+ * Get the progress of a background anneal.
+ *
+ * This function does not block: the progress record is published by the
+ * annealing thread after every batch (and snapshot) using a sequence counter
+ * and read without taking any locks.
+ *
+ * @param anneal The anneal to query.
+ * @param progress Set to a consistent copy of the progress record.
+ */
+void sa_get_anneal_progress(const sa_anneal_t *anneal, sa_progress_t *progress);
+
+/**
+ * Get a consistent snapshot of the placement of a background anneal.
+ *
+ * The annealing thread pauses between steps (within state->check_interval
+ * steps) to copy the position of every vertex and then resumes.
+ *
+ * @param anneal The anneal to query.
+ * @param placements An array [num_vertices] into which the index and position
+ *                   of every vertex is written, in index order.
+ */
+void sa_get_anneal_snapshot(sa_anneal_t *anneal, sa_placement_t *placements);
+
+/**
+ * Ask a background anneal to stop early. Does not wait for it to stop (see
+ * sa_join_anneal()).
+ *
+ * @param anneal The anneal to stop.
+ */
+void sa_stop_anneal(sa_anneal_t *anneal);
+
+/**
+ * Wait for a background anneal to finish and free it. The state may then be
+ * used again.
+ *
+ * @param anneal The anneal to join.
+ * @param progress If not NULL, set to the final progress record.
+ */
+void sa_join_anneal(sa_anneal_t *anneal, sa_progress_t *progress);
+
 #endif
@@ -6,6 +6,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdbool.h>
 
 #include <math.h>
@@ -163,6 +164,196 @@ START_TEST (test_get_net_cost)
 }
 END_TEST
 
+static double custom_net_cost(sa_state_t *state, sa_net_t *net, void *data) {
+	(void)state;
+	return net->weight * *((double *)data);
+}
+
+/**
+ * Check the alternative cost models compute the expected costs.
+ */
+START_TEST (test_get_net_cost_models)
+{
+	sa_state_t *s = sa_new(20, 10, nr, 4, 1);
+	ck_assert(s);
+	
+	sa_net_t *n = sa_new_net(s, 4);
+	ck_assert(n);
+	s->nets[0] = n;
+	n->weight = 2.0;
+	
+	sa_vertex_t *v0 = sa_new_vertex(s, 1); ck_assert(v0); s->vertices[0] = v0;
+	sa_vertex_t *v1 = sa_new_vertex(s, 1); ck_assert(v1); s->vertices[1] = v1;
+	sa_vertex_t *v2 = sa_new_vertex(s, 1); ck_assert(v2); s->vertices[2] = v2;
+	sa_vertex_t *v3 = sa_new_vertex(s, 1); ck_assert(v3); s->vertices[3] = v3;
+	sa_add_vertex_to_net(s, n, v0);
+	sa_add_vertex_to_net(s, n, v1);
+	sa_add_vertex_to_net(s, n, v2);
+	sa_add_vertex_to_net(s, n, v3);
+	
+	// Same positions as test_get_net_cost. v0 is the source of the net.
+	v0->x = 2;  v0->y = 0;
+	v1->x = 15; v1->y = 7;
+	v2->x = 3;  v2->y = 1;
+	v3->x = 19; v3->y = 8;
+	
+	// Star: Manhattan distances from v0 of 20, 2 and 25 without wrap-around
+	// and 10, 2 and 5 with.
+	s->cost_model = SA_COST_MODEL_STAR;
+	s->has_wrap_around_links = false;
+	ck_assert(sa_get_net_cost(s, n) == 47.0 * 2.0);
+	s->has_wrap_around_links = true;
+	ck_assert(sa_get_net_cost(s, n) == 17.0 * 2.0);
+	
+	// Hexagonal star: v1 and v3 can make use of diagonal links giving distances
+	// of 13, 1 and 17 without wrap-around and 7, 1 and 3 with.
+	s->cost_model = SA_COST_MODEL_HEX_STAR;
+	s->has_wrap_around_links = false;
+	ck_assert(sa_get_net_cost(s, n) == 31.0 * 2.0);
+	s->has_wrap_around_links = true;
+	ck_assert(sa_get_net_cost(s, n) == 11.0 * 2.0);
+	
+	// Clique: pairwise distances sum to 63 + 30 without wrap-around and 27 + 14
+	// with.
+	s->cost_model = SA_COST_MODEL_CLIQUE;
+	s->has_wrap_around_links = false;
+	ck_assert(fabs(sa_get_net_cost(s, n) - (93.0 / 3.0 * 2.0)) < 0.001);
+	s->has_wrap_around_links = true;
+	ck_assert(fabs(sa_get_net_cost(s, n) - (41.0 / 3.0 * 2.0)) < 0.001);
+	
+	// Custom
+	double custom_value = 42.0;
+	s->cost_model = SA_COST_MODEL_CUSTOM;
+	s->custom_net_cost = custom_net_cost;
+	s->custom_net_cost_data = &custom_value;
+	ck_assert(sa_get_net_cost(s, n) == 84.0);
+	ck_assert(sa_get_total_cost(s) == 84.0);
+	
+	// The total cost is just the cost of the only net
+	s->cost_model = SA_COST_MODEL_HPWL;
+	ck_assert(sa_get_total_cost(s) == sa_get_net_cost(s, n));
+	
+	sa_free(s);
+}
+END_TEST
+
+/**
+ * Check that the total cost of a problem with many nets is the accurately
+ * computed sum of the individual net costs and that these can be recorded.
+ */
+START_TEST (test_get_total_cost_per_net)
+{
+	// 3000 two-vertex nets (several summation chunks) between 50 vertices
+	const size_t num_vertices = 50;
+	const size_t num_nets = 3000;
+	sa_state_t *s = sa_new(10, 10, 1, num_vertices, num_nets);
+	ck_assert(s);
+	for (size_t i = 0; i < num_vertices; i++) {
+		sa_vertex_t *v = sa_new_vertex(s, 2 * num_nets / num_vertices);
+		ck_assert(v);
+		s->vertices[i] = v;
+		v->x = i % 10;
+		v->y = i / 10;
+	}
+	for (size_t i = 0; i < num_nets; i++) {
+		sa_net_t *n = sa_new_net(s, 2);
+		ck_assert(n);
+		s->nets[i] = n;
+		n->weight = 1.0 + (1e-9 * i);
+		sa_add_vertex_to_net(s, n, s->vertices[i % num_vertices]);
+		sa_add_vertex_to_net(s, n, s->vertices[((i / num_vertices) + i + 1)
+		                                       % num_vertices]);
+	}
+	
+	double custom_value = 0.1;
+	s->custom_net_cost = custom_net_cost;
+	s->custom_net_cost_data = &custom_value;
+	
+	double *net_costs = malloc(num_nets * sizeof(double));
+	ck_assert(net_costs);
+	for (sa_cost_model_t model = SA_COST_MODEL_HPWL;
+	     model <= SA_COST_MODEL_CUSTOM; model++) {
+		s->cost_model = model;
+		
+		for (size_t i = 0; i < num_nets; i++)
+			net_costs[i] = -1.0;
+		s->num_threads = 1;
+		double total = sa_get_total_cost_per_net(s, net_costs);
+		
+		long double expected = 0.0;
+		for (size_t i = 0; i < num_nets; i++) {
+			ck_assert(net_costs[i] == sa_get_net_cost(s, s->nets[i]));
+			expected += net_costs[i];
+		}
+		ck_assert(expected > 0.0);
+		ck_assert(fabsl(total - expected) <= 1e-12 * expected);
+		
+		// The same result is produced regardless of the number of threads
+		s->num_threads = 4;
+		ck_assert(sa_get_total_cost(s) == total);
+		s->num_threads = 0;
+		ck_assert(sa_get_total_cost(s) == total);
+	}
+	
+	free(net_costs);
+	sa_free(s);
+}
+END_TEST
+
+/**
+ * Check the distance tables built by sa_prepare give the same costs as the
+ * star cost models compute without them.
+ */
+START_TEST (test_distance_table)
+{
+	sa_state_t *s = sa_new(7, 5, nr, 2, 1);
+	ck_assert(s);
+	
+	sa_net_t *n = sa_new_net(s, 2);
+	ck_assert(n);
+	s->nets[0] = n;
+	n->weight = 1.0;
+	
+	sa_vertex_t *v0 = sa_new_vertex(s, 1); ck_assert(v0); s->vertices[0] = v0;
+	sa_vertex_t *v1 = sa_new_vertex(s, 1); ck_assert(v1); s->vertices[1] = v1;
+	sa_add_vertex_to_net(s, n, v0);
+	sa_add_vertex_to_net(s, n, v1);
+	
+	sa_cost_model_t models[] = {SA_COST_MODEL_STAR, SA_COST_MODEL_HEX_STAR};
+	for (int m = 0; m < 2; m++) {
+		for (int wrap = 0; wrap < 2; wrap++) {
+			s->cost_model = models[m];
+			s->has_wrap_around_links = wrap;
+			ck_assert(sa_prepare(s));
+			ck_assert(s->distance_table);
+			
+			// Try every pair of positions
+			for (int i = 0; i < 7 * 5 * 7 * 5; i++) {
+				v0->x = i % 7;
+				v0->y = (i / 7) % 5;
+				v1->x = (i / 35) % 7;
+				v1->y = (i / 245) % 5;
+				
+				double table_cost = sa_get_net_cost(s, n);
+				int *distance_table = s->distance_table;
+				s->distance_table = NULL;
+				double expected_cost = sa_get_net_cost(s, n);
+				s->distance_table = distance_table;
+				ck_assert_msg(table_cost == expected_cost,
+				              "%f == %f", table_cost, expected_cost);
+			}
+		}
+	}
+	
+	// Other cost models don't use a table
+	s->cost_model = SA_COST_MODEL_HPWL;
+	ck_assert(sa_prepare(s));
+	ck_assert(!s->distance_table);
+	
+	sa_free(s);
+}
+END_TEST
+
 /**
  * Check the sa_get_swap_cost function does as it says on the tin...
  */
@@ -214,6 +405,118 @@ START_TEST (test_get_swap_cost)
 }
 END_TEST
 
+/**
+ * Check that sa_get_swap_cost_pure agrees with sa_get_swap_cost for every
+ * supported cost model without modifying the state.
+ */
+START_TEST (test_get_swap_cost_pure)
+{
+	// 30 vertices on a 6x5 system connected by random nets of 2-6 vertices
+	// plus one net of 20 vertices (which is given a histogram).
+	const size_t num_vertices = 30;
+	const size_t num_nets = 25;
+	size_t net_vertices[25][20];
+	size_t net_lengths[25];
+	size_t degrees[30] = {0};
+	srand(42);
+	for (size_t n = 0; n < num_nets; n++) {
+		net_lengths[n] = (n == 0) ? 20 : 2 + (rand() % 5);
+		for (size_t i = 0; i < net_lengths[n]; i++) {
+			bool duplicate;
+			do {
+				net_vertices[n][i] = rand() % num_vertices;
+				duplicate = false;
+				for (size_t j = 0; j < i; j++)
+					duplicate |= net_vertices[n][j] == net_vertices[n][i];
+			} while (duplicate);
+			degrees[net_vertices[n][i]]++;
+		}
+	}
+	
+	sa_state_t *s = sa_new(6, 5, 1, num_vertices, num_nets);
+	ck_assert(s);
+	s->num_movable_vertices = num_vertices;
+	s->net_histogram_min_fanout = 20;
+	for (size_t x = 0; x < 6; x++)
+		for (size_t y = 0; y < 5; y++)
+			sa_set_chip_resources(s, x, y, 0, 100);
+	for (size_t i = 0; i < num_vertices; i++) {
+		s->vertices[i] = sa_new_vertex(s, degrees[i]);
+		ck_assert(s->vertices[i]);
+		s->vertices[i]->index = i;
+		s->vertices[i]->vertex_resources[0] = 1;
+		sa_add_vertex_to_chip(s, s->vertices[i], rand() % 6, rand() % 5, true);
+	}
+	for (size_t n = 0; n < num_nets; n++) {
+		s->nets[n] = sa_new_net(s, net_lengths[n]);
+		ck_assert(s->nets[n]);
+		s->nets[n]->index = n;
+		s->nets[n]->weight = 0.5 + n;
+		for (size_t i = 0; i < net_lengths[n]; i++)
+			sa_add_vertex_to_net(s, s->nets[n], s->vertices[net_vertices[n][i]]);
+	}
+	
+	sa_visit_t *visit = sa_new_visit(s);
+	ck_assert(visit);
+	
+	for (int wrap = 0; wrap < 2; wrap++) {
+		for (sa_cost_model_t model = SA_COST_MODEL_HPWL;
+		     model <= SA_COST_MODEL_HEX_STAR; model++) {
+			s->has_wrap_around_links = wrap;
+			s->cost_model = model;
+			ck_assert(sa_prepare(s));
+			ck_assert(s->has_net_histograms == (model == SA_COST_MODEL_HPWL));
+			
+			for (int trial = 0; trial < 50; trial++) {
+				// Swap a random vertex with everything on another chip
+				sa_vertex_t *va = s->vertices[rand() % num_vertices];
+				int ax = va->x;
+				int ay = va->y;
+				int bx, by;
+				do {
+					bx = rand() % 6;
+					by = rand() % 5;
+				} while (bx == ax && by == ay);
+				sa_vertex_t *vb[30];
+				size_t num_vb = 0;
+				for (sa_vertex_t *v = sa_get_chip_vertex(s, bx, by); v; v = v->next)
+					vb[num_vb++] = v;
+				
+				double total_before = sa_get_total_cost(s);
+				double pure = sa_get_swap_cost_pure(s, visit, ax, ay, &va, 1,
+				                                    bx, by, vb, num_vb);
+				ck_assert(sa_get_total_cost(s) == total_before);
+				ck_assert(va->x == ax && va->y == ay);
+				
+				// Compare with the mutating version, then put everything back
+				sa_remove_vertex_from_chip(s, va);
+				for (size_t i = 0; i < num_vb; i++)
+					sa_remove_vertex_from_chip(s, vb[i]);
+				for (size_t i = 0; i + 1 < num_vb; i++)
+					vb[i]->next = vb[i + 1];
+				double cost = sa_get_swap_cost(s, ax, ay, va, bx, by,
+				                               num_vb ? vb[0] : NULL);
+				ck_assert_msg(fabs(cost - pure) < 1e-6, "%f == %f", cost, pure);
+				for (size_t i = 0; i < num_vb; i++) {
+					vb[i]->next = NULL;
+					sa_add_vertex_to_chip(s, vb[i], bx, by, true);
+				}
+				sa_add_vertex_to_chip(s, va, ax, ay, true);
+				
+				// Alternately, also accept the move so later trials differ
+				if (trial % 2) {
+					sa_remove_vertex_from_chip(s, va);
+					sa_add_vertex_to_chip(s, va, bx, by, true);
+				}
+			}
+		}
+	}
+	
+	sa_free_visit(visit);
+	sa_free(s);
+}
+END_TEST
+
 /**
  * Check the sa_step function fails when no chip can fit the vertex selected.
  */
@@ -458,6 +761,1457 @@ START_TEST (test_run_steps)
 }
 END_TEST
 
+// Data for cancelling_net_cost
+typedef struct cancelling_net_cost_data {
+	size_t num_calls;
+	size_t cancel_after;
+	volatile sig_atomic_t *cancel;
+} cancelling_net_cost_data_t;
+
+/**
+ * A custom net cost function which sets a cancellation flag once it has been
+ * called a given number of times.
+ */
+static double cancelling_net_cost(sa_state_t *state, sa_net_t *net, void *data) {
+	cancelling_net_cost_data_t *d = data;
+	(void)state;
+	(void)net;
+	if (++d->num_calls == d->cancel_after)
+		*d->cancel = 1;
+	return 1.0;
+}
+
+/**
+ * Check that sa_run_steps_until stops when the time limit is reached or the
+ * cancellation flag is set.
+ */
+START_TEST (test_run_steps_until)
+{
+	// The same pair of vertices as test_run_steps
+	sa_state_t *s = sa_new(4, 4, 1, 2, 1);
+	ck_assert(s);
+	s->num_movable_vertices = 2;
+	s->has_wrap_around_links = false;
+	for (size_t x = 0; x < 4; x++)
+		for (size_t y = 0; y < 4; y++)
+			sa_set_chip_resources(s, x, y, 0, 1);
+	
+	sa_vertex_t *v0 = sa_new_vertex(s, 1); ck_assert(v0); s->vertices[0] = v0;
+	sa_vertex_t *v1 = sa_new_vertex(s, 1); ck_assert(v1); s->vertices[1] = v1;
+	v0->vertex_resources[0] = 1;
+	v1->vertex_resources[0] = 1;
+	sa_add_vertex_to_chip(s, v0, 0, 0, true);
+	sa_add_vertex_to_chip(s, v1, 3, 3, true);
+	
+	sa_net_t *n = sa_new_net(s, 2);
+	ck_assert(n);
+	s->nets[0] = n;
+	n->weight = 1.0;
+	sa_add_vertex_to_net(s, n, v0);
+	sa_add_vertex_to_net(s, n, v1);
+	
+	size_t num_steps_done;
+	size_t num_accepted;
+	double cost_delta;
+	double cost_delta_sd;
+	volatile sig_atomic_t cancel = 0;
+	
+	// Without limits, all steps are performed
+	ck_assert(sa_run_steps_until(s, 1000, 4, 1e50, -1.0, NULL, &num_steps_done,
+	                             &num_accepted, &cost_delta, &cost_delta_sd)
+	          == SA_RUN_FINISHED);
+	ck_assert(num_steps_done == 1000);
+	ck_assert(num_accepted > 750);
+	ck_assert(sa_run_steps_until(s, 1000, 4, 1e50, 1000.0, &cancel,
+	                             &num_steps_done, &num_accepted, &cost_delta,
+	                             &cost_delta_sd) == SA_RUN_FINISHED);
+	ck_assert(num_steps_done == 1000);
+	
+	// A time limit which has already expired stops the run immediately
+	ck_assert(sa_run_steps_until(s, 1000, 4, 1e50, 0.0, NULL, &num_steps_done,
+	                             &num_accepted, &cost_delta, &cost_delta_sd)
+	          == SA_RUN_TIMED_OUT);
+	ck_assert(num_steps_done == 0);
+	ck_assert(num_accepted == 0);
+	ck_assert(cost_delta == 0.0);
+	
+	// As does a flag which has already been set
+	cancel = 1;
+	ck_assert(sa_run_steps_until(s, 1000, 4, 1e50, -1.0, &cancel,
+	                             &num_steps_done, &num_accepted, &cost_delta,
+	                             &cost_delta_sd) == SA_RUN_CANCELLED);
+	ck_assert(num_steps_done == 0);
+	
+	// Setting the flag during step 25 (each of which evaluates the net cost
+	// twice) stops the run at the next check
+	cancelling_net_cost_data_t data = {0, 50, &cancel};
+	cancel = 0;
+	s->cost_model = SA_COST_MODEL_CUSTOM;
+	s->custom_net_cost = cancelling_net_cost;
+	s->custom_net_cost_data = &data;
+	s->check_interval = 10;
+	ck_assert(sa_run_steps_until(s, 1000, 4, 1e50, -1.0, &cancel,
+	                             &num_steps_done, &num_accepted, &cost_delta,
+	                             &cost_delta_sd) == SA_RUN_CANCELLED);
+	ck_assert(num_steps_done == 30);
+	
+	// A short time limit is respected
+	cancel = 0;
+	data.cancel_after = 0;
+	double start = sa_get_time();
+	ck_assert(sa_run_steps_until(s, (size_t)-1, 4, 1e50, 0.05, &cancel,
+	                             &num_steps_done, &num_accepted, &cost_delta,
+	                             &cost_delta_sd) == SA_RUN_TIMED_OUT);
+	ck_assert(sa_get_time() - start >= 0.05);
+	ck_assert(sa_get_time() - start < 5.0);
+	ck_assert(num_steps_done > 0);
+	ck_assert(num_steps_done % 10 == 0);
+	
+	sa_free(s);
+}
+END_TEST
+
+/**
+ * Check that the costs of nets with position histograms remain correct as
+ * their vertices are moved around by sa_step.
+ */
+START_TEST (test_net_histograms)
+{
+	// In this example we have a single net connecting 40 movable vertices
+	// randomly spread over a 9x7 system where each chip has room for 3 vertices.
+	// After each step the histogram-derived cost is checked against the cost
+	// computed from the vertex positions. This is repeated with and without
+	// wrap-around links and with a net of just 3 vertices (which often all
+	// share a row or column).
+	for (int test = 0; test < 4; test++) {
+		int wrap = test % 2;
+		size_t nv = (test < 2) ? 40 : 3;
+		sa_state_t *s = sa_new(9, 7, 1, nv, 1);
+		ck_assert(s);
+		s->num_movable_vertices = nv;
+		s->has_wrap_around_links = wrap;
+		s->net_histogram_min_fanout = nv;
+		for (size_t x = 0; x < 9; x++)
+			for (size_t y = 0; y < 7; y++)
+				sa_set_chip_resources(s, x, y, 0, 3);
+		
+		sa_net_t *n = sa_new_net(s, nv);
+		ck_assert(n);
+		s->nets[0] = n;
+		n->weight = 1.5;
+		
+		for (size_t i = 0; i < nv; i++) {
+			sa_vertex_t *v = sa_new_vertex(s, 1);
+			ck_assert(v);
+			s->vertices[i] = v;
+			v->vertex_resources[0] = 1;
+			sa_add_vertex_to_chip(s, v, i % 9, (i / 9) % 7, true);
+			sa_add_vertex_to_net(s, n, v);
+		}
+		
+		ck_assert(sa_prepare(s));
+		ck_assert(s->has_net_histograms);
+		ck_assert(n->histogram);
+		
+		for (size_t i = 0; i < 2000; i++) {
+			double cost;
+			sa_step(s, 3, (i < 1000) ? 1e50 : 1.0, &cost);
+			
+			double histogram_cost = sa_get_net_cost(s, n);
+			sa_net_histogram_t *histogram = n->histogram;
+			n->histogram = NULL;
+			double expected_cost = sa_get_net_cost(s, n);
+			n->histogram = histogram;
+			ck_assert_msg(histogram_cost == expected_cost,
+			              "%f == %f", histogram_cost, expected_cost);
+		}
+		
+		sa_free(s);
+	}
+}
+END_TEST
+/**
+ * Check that preparing a state with non-movable vertices leaves the cost of
+ * every net unchanged while the nets which cannot move are folded into
+ * state->fixed_net_cost.
+ */
+START_TEST (test_fixed_vertices)
+{
+	// In this example 20 movable and 10 non-movable vertices are connected by
+	// 12 nets in a 6x5 system where each chip has room for 4 vertices. Nets 0-9
+	// each connect two movable and two non-movable vertices (with odd nets
+	// sourced by a non-movable vertex) while nets 10 and 11 connect only
+	// non-movable vertices. This is repeated with and without wrap-around links
+	// and using the HPWL and star cost models.
+	for (int config = 0; config < 4; config++) {
+		size_t pins[12][5];
+		size_t num_pins[12];
+		for (size_t i = 0; i < 10; i++) {
+			num_pins[i] = 4;
+			pins[i][0] = (i % 2) ? 20 + i : i;
+			pins[i][1] = (i + 7) % 20;
+			pins[i][2] = 20 + ((i + 3) % 10);
+			pins[i][3] = (i % 2) ? i : 20 + i;
+		}
+		num_pins[10] = 3;
+		num_pins[11] = 5;
+		for (size_t i = 0; i < 5; i++) {
+			pins[10][i] = 20 + i;
+			pins[11][i] = 25 + i;
+		}
+		
+		size_t num_nets[30] = {0};
+		for (size_t i = 0; i < 12; i++)
+			for (size_t j = 0; j < num_pins[i]; j++)
+				num_nets[pins[i][j]]++;
+		
+		sa_state_t *s = sa_new(6, 5, 1, 30, 12);
+		ck_assert(s);
+		s->num_movable_vertices = 20;
+		s->has_wrap_around_links = config & 1;
+		s->cost_model = (config & 2) ? SA_COST_MODEL_STAR : SA_COST_MODEL_HPWL;
+		for (size_t x = 0; x < 6; x++)
+			for (size_t y = 0; y < 5; y++)
+				sa_set_chip_resources(s, x, y, 0, 4);
+		
+		for (size_t i = 0; i < 30; i++) {
+			sa_vertex_t *v = sa_new_vertex(s, num_nets[i]);
+			ck_assert(v);
+			s->vertices[i] = v;
+			v->vertex_resources[0] = 1;
+			if (i < 20)
+				sa_add_vertex_to_chip(s, v, i % 6, (i / 6) % 5, true);
+			else
+				sa_add_vertex_to_chip(s, v, (i * 5) % 6, (i * 3) % 5, false);
+		}
+		
+		for (size_t i = 0; i < 12; i++) {
+			sa_net_t *n = sa_new_net(s, num_pins[i]);
+			ck_assert(n);
+			s->nets[i] = n;
+			n->weight = 1.0 + i;
+			for (size_t j = 0; j < num_pins[i]; j++)
+				sa_add_vertex_to_net(s, n, s->vertices[pins[i][j]]);
+		}
+		
+		double expected[12];
+		double expected_total = sa_get_total_cost_per_net(s, expected);
+		
+		ck_assert(sa_prepare(s));
+		
+		// The sources are unchanged and the costs are the same
+		for (size_t i = 0; i < 12; i++) {
+			ck_assert(s->nets[i]->vertices[0] == SA_VERTEX_REF(s->vertices[pins[i][0]]));
+			ck_assert_msg(fabs(sa_get_net_cost(s, s->nets[i]) - expected[i]) < 1e-9,
+			              "%f == %f", sa_get_net_cost(s, s->nets[i]), expected[i]);
+		}
+		ck_assert(s->nets[0]->num_fixed_vertices == 2);
+		ck_assert(s->nets[1]->num_fixed_vertices == 1); // Source stays first
+		ck_assert(s->nets[10]->num_fixed_vertices == 3);
+		ck_assert(s->nets[11]->num_fixed_vertices == 5);
+		ck_assert(fabs(s->fixed_net_cost - (expected[10] + expected[11])) < 1e-9);
+		ck_assert(fabs(sa_get_total_cost(s) - expected_total) < 1e-9);
+		
+		// As vertices move, the costs still match those computed from every
+		// vertex position
+		double cost = expected_total;
+		for (size_t step = 0; step < 1000; step++) {
+			double delta;
+			if (sa_step(s, 3, (step < 500) ? 1e50 : 1.0, &delta))
+				cost += delta;
+			
+			for (size_t i = 0; i < 12; i++) {
+				sa_net_t *n = s->nets[i];
+				double summarised_cost = sa_get_net_cost(s, n);
+				int *fixed_coords = n->fixed_coords;
+				n->fixed_coords = NULL;
+				double expected_cost = sa_get_net_cost(s, n);
+				n->fixed_coords = fixed_coords;
+				ck_assert_msg(summarised_cost == expected_cost,
+				              "%f == %f", summarised_cost, expected_cost);
+			}
+		}
+		ck_assert_msg(fabs(cost - sa_get_total_cost(s)) < 0.001,
+		              "%f == %f", cost, sa_get_total_cost(s));
+		
+		sa_free(s);
+	}
+}
+END_TEST
+
+/**
+ * Check that frozen nets are left out of the cost change of each step but are
+ * caught up with by sa_run_steps().
+ */
+START_TEST (test_frozen_nets)
+{
+	// A chain of 30 movable vertices in a 6x5 system where each chip has room
+	// for 2 vertices, along with a single net connecting all of them which is
+	// frozen.
+	sa_cost_model_t models[] = {SA_COST_MODEL_HPWL, SA_COST_MODEL_CLIQUE,
+	                            SA_COST_MODEL_STAR};
+	for (int m = 0; m < 3; m++) {
+		sa_state_t *s = sa_new(6, 5, 1, 30, 30);
+		ck_assert(s);
+		s->num_movable_vertices = 30;
+		s->cost_model = models[m];
+		s->frozen_net_min_fanout = 10;
+		s->frozen_net_resync_interval = 7;
+		s->vertex_selection = SA_VERTEX_SELECTION_COST_WEIGHTED;
+		for (size_t x = 0; x < 6; x++)
+			for (size_t y = 0; y < 5; y++)
+				sa_set_chip_resources(s, x, y, 0, 2);
+		for (size_t i = 0; i < 30; i++) {
+			sa_vertex_t *v = sa_new_vertex(s, (i == 0 || i == 29) ? 2 : 3);
+			ck_assert(v);
+			s->vertices[i] = v;
+			v->index = i;
+			v->vertex_resources[0] = 1;
+			sa_add_vertex_to_chip(s, v, (i * 7) % 6, (i / 6) % 5, true);
+		}
+		sa_net_t *giant = sa_new_net(s, 30);
+		ck_assert(giant);
+		s->nets[0] = giant;
+		giant->index = 0;
+		giant->weight = 0.25;
+		for (size_t i = 1; i < 30; i++) {
+			sa_net_t *n = sa_new_net(s, 2);
+			ck_assert(n);
+			s->nets[i] = n;
+			n->index = i;
+			n->weight = 1.0;
+			sa_add_vertex_to_net(s, n, s->vertices[i - 1]);
+			sa_add_vertex_to_net(s, n, s->vertices[i]);
+		}
+		for (size_t i = 0; i < 30; i++)
+			sa_add_vertex_to_net(s, giant, s->vertices[i]);
+		
+		ck_assert(sa_prepare(s));
+		ck_assert(giant->frozen);
+		ck_assert(!s->nets[1]->frozen);
+		ck_assert(s->num_frozen_nets == 1);
+		ck_assert(s->frozen_net_cost == sa_get_net_cost(s, giant));
+		
+		// The change reported by each step only includes the unfrozen nets
+		for (int step = 0; step < 200; step++) {
+			double before = sa_get_total_cost(s) - sa_get_net_cost(s, giant);
+			double delta;
+			sa_step(s, 3, 1e50, &delta);
+			double after = sa_get_total_cost(s) - sa_get_net_cost(s, giant);
+			ck_assert_msg(fabs((after - before) - delta) < 1e-9,
+			              "%f == %f", after - before, delta);
+		}
+		
+		// The frozen net's cost is caught up by sa_run_steps(), including any
+		// changes made by sa_step() since it was last recomputed, so a cost
+		// tracked using the changes reported by both remains exact.
+		ck_assert(sa_prepare(s));
+		double cost = sa_get_total_cost(s);
+		for (int run = 0; run < 5; run++) {
+			for (int step = 0; step < 10; step++) {
+				double delta;
+				sa_step(s, 3, 1e50, &delta);
+				cost += delta;
+			}
+			
+			size_t num_accepted;
+			double cost_delta, cost_delta_sd;
+			sa_run_steps(s, 100, 3, 1.0, &num_accepted, &cost_delta, &cost_delta_sd);
+			cost += cost_delta;
+			ck_assert_msg(fabs(sa_get_total_cost(s) - cost) < 1e-6,
+			              "%f == %f", sa_get_total_cost(s), cost);
+			ck_assert(fabs(s->frozen_net_cost - sa_get_net_cost(s, giant)) < 1e-9);
+		}
+		
+		sa_free(s);
+	}
+}
+END_TEST
+
+/**
+ * Check the link usage map is built and maintained correctly.
+ */
+START_TEST (test_link_congestion)
+{
+	// A 2-vertex net from 0,0 to 2,1 in a 4x3 system should be routed via the
+	// north-east link of 0,0 and then east link of 1,1.
+	sa_state_t *s = sa_new(4, 3, 1, 2, 1);
+	ck_assert(s);
+	s->num_movable_vertices = 2;
+	s->congestion_weight = 2.0;
+	s->link_capacity = 0.5;
+	for (size_t x = 0; x < 4; x++)
+		for (size_t y = 0; y < 3; y++)
+			sa_set_chip_resources(s, x, y, 0, 1);
+	
+	sa_vertex_t *v0 = sa_new_vertex(s, 1); ck_assert(v0); s->vertices[0] = v0;
+	sa_vertex_t *v1 = sa_new_vertex(s, 1); ck_assert(v1); s->vertices[1] = v1;
+	v0->vertex_resources[0] = 1;
+	v1->vertex_resources[0] = 1;
+	sa_add_vertex_to_chip(s, v0, 0, 0, true);
+	sa_add_vertex_to_chip(s, v1, 2, 1, true);
+	
+	sa_net_t *n = sa_new_net(s, 2);
+	ck_assert(n);
+	s->nets[0] = n;
+	n->weight = 1.0;
+	sa_add_vertex_to_net(s, n, v0);
+	sa_add_vertex_to_net(s, n, v1);
+	
+	ck_assert(sa_prepare(s));
+	ck_assert(s->link_usage);
+	for (size_t x = 0; x < 4; x++) {
+		for (size_t y = 0; y < 3; y++) {
+			for (int l = 0; l < SA_NUM_LINKS; l++) {
+				bool used = (x == 0 && y == 0 && l == SA_LINK_NORTH_EAST) ||
+				            (x == 1 && y == 1 && l == SA_LINK_EAST);
+				ck_assert(sa_get_link_usage(s, x, y, l) == (used ? 1.0 : 0.0));
+			}
+		}
+	}
+	
+	// Two overused links each with an excess of 0.5
+	ck_assert(sa_get_congestion_cost(s) == 2.0 * 2.0 * 0.25);
+	ck_assert(sa_get_total_cost(s) == sa_get_net_cost(s, n) + 1.0);
+	
+	// Moving the source re-routes the net: now 1 hop west (with wrap-around)
+	// from 3,1.
+	s->has_wrap_around_links = true;
+	ck_assert(sa_prepare(s));
+	sa_remove_vertex_from_chip(s, v0);
+	sa_add_vertex_to_chip(s, v0, 3, 1, true);
+	ck_assert(sa_get_link_usage(s, 0, 0, SA_LINK_NORTH_EAST) == 0.0);
+	ck_assert(sa_get_link_usage(s, 1, 1, SA_LINK_EAST) == 0.0);
+	ck_assert(sa_get_link_usage(s, 3, 1, SA_LINK_WEST) == 1.0);
+	ck_assert(s->congestion_cost == 2.0 * 0.25);
+	
+	sa_free(s);
+	
+	// Check the incrementally maintained map matches one built from scratch
+	// after lots of random steps
+	s = sa_new(6, 5, 1, 20, 10);
+	ck_assert(s);
+	s->num_movable_vertices = 20;
+	s->has_wrap_around_links = true;
+	s->congestion_weight = 1.0;
+	s->link_capacity = 1.0;
+	for (size_t x = 0; x < 6; x++)
+		for (size_t y = 0; y < 5; y++)
+			sa_set_chip_resources(s, x, y, 0, 1);
+	for (size_t i = 0; i < 20; i++) {
+		sa_vertex_t *v = sa_new_vertex(s, 3);
+		ck_assert(v);
+		s->vertices[i] = v;
+		v->vertex_resources[0] = 1;
+		sa_add_vertex_to_chip(s, v, i % 6, i / 6, true);
+	}
+	for (size_t i = 0; i < 10; i++) {
+		sa_net_t *n = sa_new_net(s, 6);
+		ck_assert(n);
+		s->nets[i] = n;
+		n->weight = 1.0 + i;
+		for (size_t j = 0; j < 6; j++)
+			sa_add_vertex_to_net(s, n, s->vertices[(i * 6 + j) % 20]);
+	}
+	ck_assert(sa_prepare(s));
+	
+	double cost = sa_get_total_cost(s);
+	for (size_t i = 0; i < 1000; i++) {
+		double delta;
+		sa_step(s, 2, 10.0, &delta);
+		cost += delta;
+	}
+	
+	double *usage = calloc(6 * 5 * SA_NUM_LINKS, sizeof(double));
+	ck_assert(usage);
+	memcpy(usage, s->link_usage, 6 * 5 * SA_NUM_LINKS * sizeof(double));
+	ck_assert(sa_prepare(s));
+	for (size_t i = 0; i < 6 * 5 * SA_NUM_LINKS; i++)
+		ck_assert(fabs(usage[i] - s->link_usage[i]) < 0.001);
+	ck_assert_msg(fabs(cost - sa_get_total_cost(s)) < 0.001,
+	              "%f == %f", cost, sa_get_total_cost(s));
+	free(usage);
+	
+	sa_free(s);
+}
+END_TEST
+/**
+ * Check that every movable vertex is on the chip its coordinates say it is and
+ * that the resources free on every chip are consistent with the vertices
+ * placed on it.
+ */
+static void check_placement_consistent(sa_state_t *s, int capacity) {
+	for (size_t x = 0; x < s->width; x++) {
+		for (size_t y = 0; y < s->height; y++) {
+			int used = 0;
+			for (sa_vertex_t *v = sa_get_chip_vertex(s, x, y); v; v = v->next) {
+				ck_assert(v->x == (int)x);
+				ck_assert(v->y == (int)y);
+				used += v->vertex_resources[0];
+			}
+			ck_assert(sa_get_chip_resources(s, x, y, 0) == capacity - used);
+		}
+	}
+}
+
+/**
+ * Check that each of the move types leaves the placement in a consistent state
+ * and that move statistics are recorded.
+ */
+START_TEST (test_move_types)
+{
+	// A 5x4 system where each chip has room for 3 units of resource and 12
+	// vertices of 1 or 2 units connected in a ring of nets.
+	sa_state_t *s = sa_new(5, 4, 1, 12, 12);
+	ck_assert(s);
+	s->num_movable_vertices = 12;
+	for (size_t x = 0; x < 5; x++)
+		for (size_t y = 0; y < 4; y++)
+			sa_set_chip_resources(s, x, y, 0, 3);
+	for (size_t i = 0; i < 12; i++) {
+		sa_vertex_t *v = sa_new_vertex(s, 2);
+		ck_assert(v);
+		s->vertices[i] = v;
+		v->vertex_resources[0] = 1 + (i % 2);
+		sa_add_vertex_to_chip(s, v, i % 5, (i / 5) % 4, true);
+	}
+	for (size_t i = 0; i < 12; i++) {
+		sa_net_t *n = sa_new_net(s, 2);
+		ck_assert(n);
+		s->nets[i] = n;
+		n->weight = 1.0;
+		sa_add_vertex_to_net(s, n, s->vertices[i]);
+		sa_add_vertex_to_net(s, n, s->vertices[(i + 1) % 12]);
+	}
+	check_placement_consistent(s, 3);
+	
+	for (int wrap = 0; wrap < 2; wrap++) {
+		s->has_wrap_around_links = wrap;
+		
+		// Each move type on its own
+		for (int t = 0; t < SA_NUM_MOVE_TYPES; t++) {
+			for (int i = 0; i < SA_NUM_MOVE_TYPES; i++)
+				s->move_weights[i] = (i == t) ? 1.0 : 0.0;
+			
+			double cost_before = sa_get_total_cost(s);
+			size_t num_accepted;
+			double cost_delta;
+			double cost_delta_sd;
+			sa_run_steps(s, 500, 3, 2.0, &num_accepted, &cost_delta, &cost_delta_sd);
+			check_placement_consistent(s, 3);
+			ck_assert(fabs(sa_get_total_cost(s) - (cost_before + cost_delta)) < 0.001);
+			
+			ck_assert(num_accepted > 0);
+			for (int i = 0; i < SA_NUM_MOVE_TYPES; i++) {
+				ck_assert(s->num_moves_proposed[i] == ((i == t) ? 500 : 0));
+				ck_assert(s->num_moves_accepted[i] == ((i == t) ? num_accepted : 0));
+			}
+		}
+		
+		// All move types together
+		for (int i = 0; i < SA_NUM_MOVE_TYPES; i++)
+			s->move_weights[i] = 1.0;
+		size_t num_accepted;
+		double cost_delta;
+		double cost_delta_sd;
+		sa_run_steps(s, 1000, 3, 2.0, &num_accepted, &cost_delta, &cost_delta_sd);
+		check_placement_consistent(s, 3);
+		size_t total_proposed = 0;
+		size_t total_accepted = 0;
+		for (int i = 0; i < SA_NUM_MOVE_TYPES; i++) {
+			ck_assert(s->num_moves_proposed[i] > 0);
+			total_proposed += s->num_moves_proposed[i];
+			total_accepted += s->num_moves_accepted[i];
+		}
+		ck_assert(total_proposed == 1000);
+		ck_assert(total_accepted == num_accepted);
+	}
+	
+	sa_free(s);
+}
+END_TEST
+
+/**
+ * Check that rejected moves leave the chips' vertex lists, resources and the
+ * vertex positions untouched, both when moves are evaluated without modifying
+ * the state and when net histograms force vertices to be moved temporarily.
+ */
+START_TEST (test_rejected_moves_unmodified)
+{
+	// The same ring of 12 vertices as test_move_types
+	sa_state_t *s = sa_new(5, 4, 1, 12, 12);
+	ck_assert(s);
+	s->num_movable_vertices = 12;
+	for (size_t x = 0; x < 5; x++)
+		for (size_t y = 0; y < 4; y++)
+			sa_set_chip_resources(s, x, y, 0, 3);
+	for (size_t i = 0; i < 12; i++) {
+		sa_vertex_t *v = sa_new_vertex(s, 2);
+		ck_assert(v);
+		s->vertices[i] = v;
+		v->vertex_resources[0] = 1 + (i % 2);
+		sa_add_vertex_to_chip(s, v, i % 5, (i / 5) % 4, true);
+	}
+	for (size_t i = 0; i < 12; i++) {
+		sa_net_t *n = sa_new_net(s, 2);
+		ck_assert(n);
+		s->nets[i] = n;
+		n->weight = 1.0;
+		sa_add_vertex_to_net(s, n, s->vertices[i]);
+		sa_add_vertex_to_net(s, n, s->vertices[(i + 1) % 12]);
+	}
+	for (int i = 0; i < SA_NUM_MOVE_TYPES; i++)
+		s->move_weights[i] = 1.0;
+	
+	for (int histograms = 0; histograms < 2; histograms++) {
+		s->net_histogram_min_fanout = histograms ? 2 : 128;
+		ck_assert(sa_prepare(s));
+		ck_assert(s->visit);
+		ck_assert(s->has_net_histograms == histograms);
+		
+		size_t num_rejected = 0;
+		double cost = sa_get_total_cost(s);
+		for (int step = 0; step < 1000; step++) {
+			sa_vertex_t *heads[5 * 4];
+			int resources[5 * 4];
+			sa_vertex_t *nexts[12];
+			int xs[12], ys[12];
+			for (size_t i = 0; i < 5 * 4; i++) {
+				heads[i] = sa_get_chip_vertex(s, i % 5, i / 5);
+				resources[i] = sa_get_chip_resources(s, i % 5, i / 5, 0);
+			}
+			for (size_t i = 0; i < 12; i++) {
+				nexts[i] = s->vertices[i]->next;
+				xs[i] = s->vertices[i]->x;
+				ys[i] = s->vertices[i]->y;
+			}
+			
+			double delta;
+			if (sa_step(s, 3, 0.5, &delta)) {
+				cost += delta;
+				continue;
+			}
+			
+			num_rejected++;
+			ck_assert(delta == 0.0);
+			for (size_t i = 0; i < 5 * 4; i++) {
+				ck_assert(heads[i] == sa_get_chip_vertex(s, i % 5, i / 5));
+				ck_assert(resources[i] == sa_get_chip_resources(s, i % 5, i / 5, 0));
+			}
+			for (size_t i = 0; i < 12; i++) {
+				ck_assert(nexts[i] == s->vertices[i]->next);
+				ck_assert(xs[i] == s->vertices[i]->x);
+				ck_assert(ys[i] == s->vertices[i]->y);
+			}
+		}
+		
+		ck_assert(num_rejected > 0);
+		check_placement_consistent(s, 3);
+		ck_assert_msg(fabs(cost - sa_get_total_cost(s)) < 0.001,
+		              "%f == %f", cost, sa_get_total_cost(s));
+	}
+	
+	sa_free(s);
+}
+END_TEST
+
+/**
+ * Check that the trace of accepted moves can be replayed to reproduce the
+ * final placement and cost and that the oldest entries are dropped when full.
+ */
+START_TEST (test_trace)
+{
+	// The same ring of 12 vertices as test_move_types
+	sa_state_t *s = sa_new(5, 4, 1, 12, 12);
+	ck_assert(s);
+	s->num_movable_vertices = 12;
+	for (size_t x = 0; x < 5; x++)
+		for (size_t y = 0; y < 4; y++)
+			sa_set_chip_resources(s, x, y, 0, 3);
+	for (size_t i = 0; i < 12; i++) {
+		sa_vertex_t *v = sa_new_vertex(s, 2);
+		ck_assert(v);
+		s->vertices[i] = v;
+		v->vertex_resources[0] = 1 + (i % 2);
+		sa_add_vertex_to_chip(s, v, i % 5, (i / 5) % 4, true);
+	}
+	for (size_t i = 0; i < 12; i++) {
+		sa_net_t *n = sa_new_net(s, 2);
+		ck_assert(n);
+		s->nets[i] = n;
+		n->weight = 1.0;
+		sa_add_vertex_to_net(s, n, s->vertices[i]);
+		sa_add_vertex_to_net(s, n, s->vertices[(i + 1) % 12]);
+	}
+	for (int i = 0; i < SA_NUM_MOVE_TYPES; i++)
+		s->move_weights[i] = 1.0;
+	ck_assert(sa_prepare(s));
+	
+	int xs[12], ys[12];
+	for (size_t i = 0; i < 12; i++) {
+		xs[i] = s->vertices[i]->x;
+		ys[i] = s->vertices[i]->y;
+	}
+	double cost_before = sa_get_total_cost(s);
+	unsigned long long step_before = s->rng_step;
+	
+	ck_assert(sa_set_trace(s, 10000));
+	size_t num_accepted;
+	double cost_delta;
+	double cost_delta_sd;
+	sa_run_steps(s, 500, 3, 2.0, &num_accepted, &cost_delta, &cost_delta_sd);
+	ck_assert(num_accepted > 0);
+	ck_assert(s->trace_length >= num_accepted);
+	ck_assert(s->trace_dropped == 0);
+	
+	// Read in two parts and replay the moves
+	sa_trace_entry_t entries[10000];
+	size_t num_entries = sa_read_trace(s, entries, 10);
+	ck_assert(num_entries == 10);
+	num_entries += sa_read_trace(s, entries + 10, 10000);
+	ck_assert(s->trace_length == 0);
+	ck_assert(sa_read_trace(s, entries, 10000) == 0);
+	
+	double delta = 0.0;
+	size_t num_moves = 0;
+	for (size_t i = 0; i < num_entries; i++) {
+		sa_trace_entry_t *e = &entries[i];
+		ck_assert(e->step > step_before && e->step <= s->rng_step);
+		if (i > 0) {
+			ck_assert(e->step >= entries[i - 1].step);
+			num_moves += e->step != entries[i - 1].step;
+		} else {
+			num_moves++;
+		}
+		ck_assert(e->vertex < 12);
+		ck_assert(xs[e->vertex] == e->from_x && ys[e->vertex] == e->from_y);
+		xs[e->vertex] = e->to_x;
+		ys[e->vertex] = e->to_y;
+		delta += e->delta;
+	}
+	ck_assert(num_moves == num_accepted);
+	for (size_t i = 0; i < 12; i++) {
+		ck_assert(xs[i] == s->vertices[i]->x);
+		ck_assert(ys[i] == s->vertices[i]->y);
+	}
+	ck_assert(fabs(delta - cost_delta) < 0.001);
+	ck_assert(fabs(cost_before + delta - sa_get_total_cost(s)) < 0.001);
+	
+	// With a small trace the oldest entries are dropped
+	ck_assert(sa_set_trace(s, 3));
+	size_t num_recorded = 0;
+	while (s->trace_dropped == 0) {
+		double step_delta;
+		sa_step(s, 3, 2.0, &step_delta);
+		ck_assert(s->trace_length <= 3);
+		ck_assert(s->trace_length + s->trace_dropped >= num_recorded);
+		num_recorded = s->trace_length + s->trace_dropped;
+	}
+	ck_assert(s->trace_length == 3);
+	ck_assert(sa_read_trace(s, entries, 2) == 2);
+	ck_assert(sa_read_trace(s, entries, 2) == 1);
+	
+	// Disabling the trace stops recording
+	ck_assert(sa_set_trace(s, 0));
+	sa_run_steps(s, 100, 3, 2.0, &num_accepted, &cost_delta, &cost_delta_sd);
+	ck_assert(s->trace == NULL);
+	ck_assert(s->trace_length == 0);
+	
+	sa_free(s);
+}
+END_TEST
+
+/**
+ * Check that exactly the vertices which have moved are read back by
+ * sa_read_dirty_vertices().
+ */
+START_TEST (test_dirty_vertices)
+{
+	// The same ring of 12 vertices as test_move_types
+	sa_state_t *s = sa_new(5, 4, 1, 12, 12);
+	ck_assert(s);
+	s->num_movable_vertices = 12;
+	for (size_t x = 0; x < 5; x++)
+		for (size_t y = 0; y < 4; y++)
+			sa_set_chip_resources(s, x, y, 0, 3);
+	for (size_t i = 0; i < 12; i++) {
+		sa_vertex_t *v = sa_new_vertex(s, 2);
+		ck_assert(v);
+		s->vertices[i] = v;
+		v->vertex_resources[0] = 1 + (i % 2);
+		sa_add_vertex_to_chip(s, v, i % 5, (i / 5) % 4, true);
+	}
+	for (size_t i = 0; i < 12; i++) {
+		sa_net_t *n = sa_new_net(s, 2);
+		ck_assert(n);
+		s->nets[i] = n;
+		n->weight = 1.0;
+		sa_add_vertex_to_net(s, n, s->vertices[i]);
+		sa_add_vertex_to_net(s, n, s->vertices[(i + 1) % 12]);
+	}
+	for (int i = 0; i < SA_NUM_MOVE_TYPES; i++)
+		s->move_weights[i] = 1.0;
+	
+	sa_placement_t placements[12];
+	ck_assert(sa_prepare(s));
+	ck_assert(sa_set_dirty_tracking(s, true));
+	ck_assert(sa_read_dirty_vertices(s, placements, 12) == 0);
+	
+	// Both with and without moves being evaluated in-place
+	for (int histograms = 0; histograms < 2; histograms++) {
+		s->net_histogram_min_fanout = histograms ? 2 : 128;
+		ck_assert(sa_prepare(s));
+		
+		for (int batch = 0; batch < 20; batch++) {
+			int xs[12], ys[12];
+			for (size_t i = 0; i < 12; i++) {
+				xs[i] = s->vertices[i]->x;
+				ys[i] = s->vertices[i]->y;
+			}
+			
+			size_t num_accepted;
+			double cost_delta;
+			double cost_delta_sd;
+			sa_run_steps(s, 1 + batch, 3, 1.0, &num_accepted, &cost_delta,
+			             &cost_delta_sd);
+			
+			// Read in two parts
+			size_t num_read = sa_read_dirty_vertices(s, placements, 2);
+			ck_assert(num_read <= 2);
+			num_read += sa_read_dirty_vertices(s, placements + num_read, 12);
+			ck_assert(sa_read_dirty_vertices(s, placements, 12) == 0);
+			ck_assert(num_accepted > 0 || num_read == 0);
+			
+			bool seen[12] = {false};
+			for (size_t i = 0; i < num_read; i++) {
+				size_t v = placements[i].vertex;
+				ck_assert(v < 12);
+				ck_assert(!seen[v]);
+				seen[v] = true;
+				ck_assert(placements[i].x == s->vertices[v]->x);
+				ck_assert(placements[i].y == s->vertices[v]->y);
+			}
+			for (size_t i = 0; i < 12; i++)
+				if (xs[i] != s->vertices[i]->x || ys[i] != s->vertices[i]->y)
+					ck_assert(seen[i]);
+		}
+	}
+	
+	// Vertices moved together by sa_add_vertices_to_chip_if_fit() are marked
+	// dirty only if they fit and only if their position changed. Vertex 0 is
+	// moved back to its own chip along with a vertex from elsewhere.
+	for (size_t x = 0; x < 5; x++)
+		for (size_t y = 0; y < 4; y++)
+			while (sa_get_chip_vertex(s, x, y))
+				sa_remove_vertex_from_chip(s, sa_get_chip_vertex(s, x, y));
+	int x0 = s->vertices[0]->x;
+	int y0 = s->vertices[0]->y;
+	size_t other = 1;
+	while (s->vertices[other]->x == x0 && s->vertices[other]->y == y0)
+		other += 2;
+	ck_assert(other < 12);
+	s->vertices[0]->next = s->vertices[other];
+	s->vertices[other]->next = NULL;
+	ck_assert(sa_add_vertices_to_chip_if_fit(s, s->vertices[0], x0, y0));
+	ck_assert(sa_read_dirty_vertices(s, placements, 12) == 1);
+	ck_assert(placements[0].vertex == other);
+	ck_assert(placements[0].x == x0);
+	ck_assert(placements[0].y == y0);
+	
+	// Vertices which don't fit are left alone
+	int x2 = s->vertices[2]->x;
+	int y2 = s->vertices[2]->y;
+	s->vertices[2]->next = s->vertices[4];
+	s->vertices[4]->next = NULL;
+	ck_assert(!sa_add_vertices_to_chip_if_fit(s, s->vertices[2], x0, y0));
+	ck_assert(sa_read_dirty_vertices(s, placements, 12) == 0);
+	ck_assert(s->vertices[2]->x == x2);
+	ck_assert(s->vertices[2]->y == y2);
+	
+	ck_assert(sa_set_dirty_tracking(s, false));
+	ck_assert(s->dirty_bitmap == NULL);
+	
+	sa_free(s);
+}
+END_TEST
+
+/**
+ * Check that a background anneal reports its progress, produces consistent
+ * snapshots and may be stopped early.
+ */
+START_TEST (test_background_anneal)
+{
+	// The same ring of 12 vertices as test_move_types
+	sa_state_t *s = sa_new(5, 4, 1, 12, 12);
+	ck_assert(s);
+	s->num_movable_vertices = 12;
+	for (size_t x = 0; x < 5; x++)
+		for (size_t y = 0; y < 4; y++)
+			sa_set_chip_resources(s, x, y, 0, 3);
+	for (size_t i = 0; i < 12; i++) {
+		sa_vertex_t *v = sa_new_vertex(s, 2);
+		ck_assert(v);
+		s->vertices[i] = v;
+		v->vertex_resources[0] = 1 + (i % 2);
+		sa_add_vertex_to_chip(s, v, i % 5, (i / 5) % 4, true);
+	}
+	for (size_t i = 0; i < 12; i++) {
+		sa_net_t *n = sa_new_net(s, 2);
+		ck_assert(n);
+		s->nets[i] = n;
+		n->weight = 1.0;
+		sa_add_vertex_to_net(s, n, s->vertices[i]);
+		sa_add_vertex_to_net(s, n, s->vertices[(i + 1) % 12]);
+	}
+	for (int i = 0; i < SA_NUM_MOVE_TYPES; i++)
+		s->move_weights[i] = 1.0;
+	s->check_interval = 16;
+	ck_assert(sa_prepare(s));
+	
+	// Run to completion (50 batches) taking snapshots along the way
+	sa_anneal_t *anneal = sa_start_anneal(s, 1000, 3, 10.0, 0.9, 10.0 * pow(0.9, 49.5));
+	ck_assert(anneal);
+	sa_progress_t progress;
+	unsigned long long last_num_steps = 0;
+	sa_placement_t placements[12];
+	do {
+		sa_get_anneal_progress(anneal, &progress);
+		ck_assert(progress.num_steps >= last_num_steps);
+		ck_assert(progress.num_steps <= 50 * 1000);
+		ck_assert(progress.accept_rate >= 0.0 && progress.accept_rate <= 1.0);
+		last_num_steps = progress.num_steps;
+		
+		// Every snapshot must be a valid placement
+		sa_get_anneal_snapshot(anneal, placements);
+		int used[5][4] = {{0}};
+		for (size_t i = 0; i < 12; i++) {
+			ck_assert(placements[i].vertex == i);
+			ck_assert(placements[i].x >= 0 && placements[i].x < 5);
+			ck_assert(placements[i].y >= 0 && placements[i].y < 4);
+			used[placements[i].x][placements[i].y] += 1 + (i % 2);
+		}
+		for (size_t x = 0; x < 5; x++)
+			for (size_t y = 0; y < 4; y++)
+				ck_assert(used[x][y] <= 3);
+	} while (progress.running);
+	sa_join_anneal(anneal, &progress);
+	ck_assert(!progress.running);
+	ck_assert(progress.num_steps == 50 * 1000);
+	ck_assert(fabs(progress.cost - sa_get_total_cost(s)) < 0.001);
+	ck_assert(fabs(progress.temperature - 10.0 * pow(0.9, 50)) < 1e-9);
+	check_placement_consistent(s, 3);
+	
+	// A never-ending anneal may be stopped
+	anneal = sa_start_anneal(s, 1000, 3, 10.0, 1.0, 0.0);
+	ck_assert(anneal);
+	do {
+		sa_get_anneal_progress(anneal, &progress);
+	} while (progress.num_steps < 5000);
+	sa_stop_anneal(anneal);
+	sa_join_anneal(anneal, &progress);
+	ck_assert(!progress.running);
+	ck_assert(progress.num_steps >= 5000);
+	ck_assert(fabs(progress.cost - sa_get_total_cost(s)) < 0.001);
+	check_placement_consistent(s, 3);
+	
+	// Snapshots may still be taken once finished
+	anneal = sa_start_anneal(s, 1000, 3, 1.0, 0.5, 1.0);
+	ck_assert(anneal);
+	do {
+		sa_get_anneal_progress(anneal, &progress);
+	} while (progress.running);
+	sa_get_anneal_snapshot(anneal, placements);
+	for (size_t i = 0; i < 12; i++) {
+		ck_assert(placements[i].x == s->vertices[i]->x);
+		ck_assert(placements[i].y == s->vertices[i]->y);
+	}
+	sa_join_anneal(anneal, NULL);
+	
+	// Batches must contain at least one step
+	ck_assert(sa_start_anneal(s, 0, 3, 1.0, 0.5, 0.1) == NULL);
+	
+	sa_free(s);
+}
+END_TEST
+
+
+/**
+ * Check that cost-weighted vertex selection only picks vertices in costly nets
+ * and that the vertex weights are maintained as moves are accepted.
+ */
+START_TEST (test_vertex_selection)
+{
+	// A 5x4 system with the same ring of 12 vertices as test_move_types.
+	sa_state_t *s = sa_new(5, 4, 1, 12, 12);
+	ck_assert(s);
+	s->num_movable_vertices = 12;
+	for (size_t x = 0; x < 5; x++)
+		for (size_t y = 0; y < 4; y++)
+			sa_set_chip_resources(s, x, y, 0, 3);
+	for (size_t i = 0; i < 12; i++) {
+		sa_vertex_t *v = sa_new_vertex(s, 2);
+		ck_assert(v);
+		s->vertices[i] = v;
+		v->vertex_resources[0] = 1;
+	}
+	for (size_t i = 0; i < 12; i++) {
+		sa_net_t *n = sa_new_net(s, 2);
+		ck_assert(n);
+		s->nets[i] = n;
+		n->weight = 1.0;
+		sa_add_vertex_to_net(s, n, s->vertices[i]);
+		sa_add_vertex_to_net(s, n, s->vertices[(i + 1) % 12]);
+	}
+	
+	// Place vertices 0-2 together on (0, 0), 3-5 on (1, 0) and so on. Only nets
+	// 2, 5, 8 and 11 then have a non-zero cost.
+	for (size_t i = 0; i < 12; i++)
+		sa_add_vertex_to_chip(s, s->vertices[i], i / 3, 0, true);
+	
+	// Until prepared, selection remains uniform
+	s->vertex_selection = SA_VERTEX_SELECTION_COST_WEIGHTED;
+	ck_assert(s->vertex_weights == NULL);
+	
+	ck_assert(sa_prepare(s));
+	ck_assert(s->vertex_weights);
+	double total_net_cost = 0.0;
+	for (size_t i = 0; i < 12; i++)
+		total_net_cost += sa_get_net_cost(s, s->nets[i]);
+	ck_assert(total_net_cost > 0.0);
+	
+	// Every vertex is given a floor weight of a tenth of the mean
+	double floor_weight = 0.1 * (2.0 * total_net_cost / 12.0);
+	ck_assert(fabs(s->vertex_weight_floor - floor_weight) < 0.001);
+	ck_assert(fabs(s->vertex_weights_total -
+	               ((2.0 * total_net_cost) + (12.0 * floor_weight))) < 0.001);
+	
+	// Vertices 1, 4, 7 and 10 are in no costly nets and so are selected rarely
+	// (but not never)
+	int counts[12] = {0};
+	for (int i = 0; i < 8000; i++)
+		counts[sa_get_random_movable_vertex(s)->index]++;
+	for (size_t i = 0; i < 12; i++) {
+		if (i % 3 == 1)
+			ck_assert(counts[i] > 0 && counts[i] < 250);
+		else
+			ck_assert(counts[i] > 500);
+	}
+	
+	// Anneal and check the incrementally maintained weights match those built
+	// from scratch.
+	for (int i = 0; i < SA_NUM_MOVE_TYPES; i++)
+		s->move_weights[i] = 1.0;
+	size_t num_accepted;
+	double cost_delta;
+	double cost_delta_sd;
+	sa_run_steps(s, 1000, 3, 2.0, &num_accepted, &cost_delta, &cost_delta_sd);
+	ck_assert(num_accepted > 0);
+	
+	for (size_t i = 0; i < 12; i++)
+		ck_assert(fabs(s->nets[i]->cost - sa_get_net_cost(s, s->nets[i])) < 0.001);
+	
+	// The floor weight is recomputed when the tree is rebuilt so compare the
+	// weights without it (tree node i covers (i & (~i + 1)) vertices).
+	double weights[13];
+	double total = s->vertex_weights_total - (12.0 * s->vertex_weight_floor);
+	for (size_t i = 1; i < 13; i++)
+		weights[i] = s->vertex_weights[i] -
+		             ((i & (~i + 1)) * s->vertex_weight_floor);
+	ck_assert(sa_prepare(s));
+	ck_assert(fabs(s->vertex_weights_total - (12.0 * s->vertex_weight_floor) -
+	               total) < 0.001);
+	for (size_t i = 1; i < 13; i++)
+		ck_assert(fabs(s->vertex_weights[i] -
+		               ((i & (~i + 1)) * s->vertex_weight_floor) - weights[i]) < 0.001);
+	
+	// A state where every net has zero cost still selects every vertex
+	for (size_t i = 0; i < 12; i++)
+		s->nets[i]->weight = 0.0;
+	ck_assert(sa_prepare(s));
+	ck_assert(s->vertex_weight_floor == 1.0);
+	ck_assert(fabs(s->vertex_weights_total - 12.0) < 0.001);
+	memset(counts, 0, sizeof(counts));
+	for (int i = 0; i < 1200; i++)
+		counts[sa_get_random_movable_vertex(s)->index]++;
+	for (size_t i = 0; i < 12; i++)
+		ck_assert(counts[i] > 0);
+	
+	sa_free(s);
+}
+END_TEST
+
+
+/**
+ * Check the Philox generator against the known-answer tests of its reference
+ * implementation.
+ */
+START_TEST (test_philox)
+{
+	const unsigned int zero[4] = {0, 0, 0, 0};
+	const unsigned int ones[4] = {0xFFFFFFFFu, 0xFFFFFFFFu,
+	                              0xFFFFFFFFu, 0xFFFFFFFFu};
+	const unsigned int pi_counter[4] = {0x243F6A88u, 0x85A308D3u,
+	                                    0x13198A2Eu, 0x03707344u};
+	const unsigned int pi_key[2] = {0xA4093822u, 0x299F31D0u};
+	unsigned int out[4];
+	
+	sa_philox(zero, zero, out);
+	ck_assert(out[0] == 0x6627E8D5u);
+	ck_assert(out[1] == 0xE169C58Du);
+	ck_assert(out[2] == 0xBC57AC4Cu);
+	ck_assert(out[3] == 0x9B00DBD8u);
+	
+	sa_philox(ones, ones, out);
+	ck_assert(out[0] == 0x408F276Du);
+	ck_assert(out[1] == 0x41C83B0Eu);
+	ck_assert(out[2] == 0xA20BC7C6u);
+	ck_assert(out[3] == 0x6D5451FDu);
+	
+	sa_philox(pi_counter, pi_key, out);
+	ck_assert(out[0] == 0xD16CFE09u);
+	ck_assert(out[1] == 0x94FDCCEBu);
+	ck_assert(out[2] == 0x5001E420u);
+	ck_assert(out[3] == 0x24126EA1u);
+}
+END_TEST
+
+
+/**
+ * Create a 5x4 system with a ring of 12 vertices (as in test_move_types) which
+ * uses the Philox generator with the given stream.
+ */
+static sa_state_t *new_philox_ring(unsigned int stream) {
+	sa_state_t *s = sa_new(5, 4, 1, 12, 12);
+	ck_assert(s);
+	s->num_movable_vertices = 12;
+	for (size_t x = 0; x < 5; x++)
+		for (size_t y = 0; y < 4; y++)
+			sa_set_chip_resources(s, x, y, 0, 3);
+	for (size_t i = 0; i < 12; i++) {
+		sa_vertex_t *v = sa_new_vertex(s, 2);
+		ck_assert(v);
+		s->vertices[i] = v;
+		v->vertex_resources[0] = 1 + (i % 2);
+		sa_add_vertex_to_chip(s, v, i % 5, (i / 5) % 4, true);
+	}
+	for (size_t i = 0; i < 12; i++) {
+		sa_net_t *n = sa_new_net(s, 2);
+		ck_assert(n);
+		s->nets[i] = n;
+		n->weight = 1.0;
+		sa_add_vertex_to_net(s, n, s->vertices[i]);
+		sa_add_vertex_to_net(s, n, s->vertices[(i + 1) % 12]);
+	}
+	for (int i = 0; i < SA_NUM_MOVE_TYPES; i++)
+		s->move_weights[i] = 1.0;
+	s->rng = SA_RNG_PHILOX;
+	s->rng_seed = 0x123456789ull;
+	s->rng_stream = stream;
+	return s;
+}
+
+/**
+ * Check that annealing with the Philox generator depends only on its seed,
+ * stream and step index and not on rand().
+ */
+START_TEST (test_rng_philox)
+{
+	sa_state_t *a = new_philox_ring(0);
+	sa_state_t *b = new_philox_ring(0);
+	sa_state_t *c = new_philox_ring(1);
+	size_t num_accepted_a, num_accepted_b, num_accepted_c;
+	double cost_delta;
+	double cost_delta_sd;
+	
+	srand(1);
+	sa_run_steps(a, 500, 3, 2.0, &num_accepted_a, &cost_delta, &cost_delta_sd);
+	srand(2);
+	sa_run_steps(b, 250, 3, 2.0, &num_accepted_b, &cost_delta, &cost_delta_sd);
+	rand();
+	sa_run_steps(b, 250, 3, 2.0, &num_accepted_b, &cost_delta, &cost_delta_sd);
+	sa_run_steps(c, 500, 3, 2.0, &num_accepted_c, &cost_delta, &cost_delta_sd);
+	
+	// Every step advances the counter
+	ck_assert(a->rng_step == 500);
+	ck_assert(b->rng_step == 500);
+	
+	// Identical streams give identical placements regardless of rand()
+	bool same_as_c = true;
+	for (size_t i = 0; i < 12; i++) {
+		ck_assert(a->vertices[i]->x == b->vertices[i]->x);
+		ck_assert(a->vertices[i]->y == b->vertices[i]->y);
+		same_as_c &= a->vertices[i]->x == c->vertices[i]->x &&
+		             a->vertices[i]->y == c->vertices[i]->y;
+	}
+	
+	// A different stream takes a different path
+	ck_assert(!same_as_c);
+	
+	// Returning to a step draws the same numbers again
+	sa_vertex_t *drawn[20];
+	sa_set_rng_step(a, 41);
+	for (int i = 0; i < 20; i++)
+		drawn[i] = sa_get_random_movable_vertex(a);
+	sa_set_rng_step(a, 42);
+	bool same_as_42 = true;
+	for (int i = 0; i < 20; i++)
+		same_as_42 &= drawn[i] == sa_get_random_movable_vertex(a);
+	ck_assert(!same_as_42);
+	sa_set_rng_step(a, 41);
+	for (int i = 0; i < 20; i++)
+		ck_assert(drawn[i] == sa_get_random_movable_vertex(a));
+	
+	sa_free(a);
+	sa_free(b);
+	sa_free(c);
+}
+END_TEST
+
+
+/**
+ * Check that sa_place_initial produces a valid placement which keeps connected
+ * vertices close together.
+ */
+START_TEST (test_place_initial)
+{
+	// A 4x4 system where each chip has room for 2 units of resource except
+	// chip (1, 1) which is dead. A non-movable vertex sits on (0, 0) and 20
+	// movable vertices of 1 or 2 units are connected in a ring whose order is
+	// scrambled with respect to the vertex indices.
+	sa_state_t *s = sa_new(4, 4, 1, 21, 20);
+	ck_assert(s);
+	s->num_movable_vertices = 20;
+	for (size_t x = 0; x < 4; x++)
+		for (size_t y = 0; y < 4; y++)
+			sa_set_chip_resources(s, x, y, 0, (x == 1 && y == 1) ? -1 : 2);
+	for (size_t i = 0; i < 21; i++) {
+		sa_vertex_t *v = sa_new_vertex(s, 2);
+		ck_assert(v);
+		s->vertices[i] = v;
+		v->vertex_resources[0] = 1 + (i % 3 == 0);
+	}
+	s->vertices[20]->vertex_resources[0] = 1;
+	sa_add_vertex_to_chip(s, s->vertices[20], 0, 0, false);
+	for (size_t i = 0; i < 20; i++) {
+		sa_net_t *n = sa_new_net(s, 2);
+		ck_assert(n);
+		s->nets[i] = n;
+		n->weight = 1.0;
+		sa_add_vertex_to_net(s, n, s->vertices[(i * 7) % 20]);
+		sa_add_vertex_to_net(s, n, s->vertices[((i + 1) * 7) % 20]);
+	}
+	
+	ck_assert(sa_place_initial(s));
+	
+	// Every movable vertex must be on exactly one live chip without any chip
+	// being over-allocated.
+	size_t num_placed = 0;
+	for (size_t x = 0; x < 4; x++) {
+		for (size_t y = 0; y < 4; y++) {
+			int used = (x == 0 && y == 0) ? 1 : 0;
+			for (sa_vertex_t *v = sa_get_chip_vertex(s, x, y); v; v = v->next) {
+				ck_assert(v->x == (int)x);
+				ck_assert(v->y == (int)y);
+				used += v->vertex_resources[0];
+				num_placed++;
+			}
+			if (x == 1 && y == 1) {
+				ck_assert(used == 0);
+			} else {
+				ck_assert(sa_get_chip_resources(s, x, y, 0) >= 0);
+				ck_assert(sa_get_chip_resources(s, x, y, 0) == 2 - used);
+			}
+		}
+	}
+	ck_assert(num_placed == 20);
+	
+	// Consecutive vertices around the ring should be placed close together
+	for (size_t i = 0; i < 20; i++) {
+		sa_vertex_t *va = SA_NET_VERTEX(s, s->nets[i], 0);
+		sa_vertex_t *vb = SA_NET_VERTEX(s, s->nets[i], 1);
+		ck_assert(abs(va->x - vb->x) + abs(va->y - vb->y) <= 3);
+	}
+	
+	// If a vertex can't fit anywhere, nothing is placed
+	for (size_t i = 0; i < 20; i++)
+		sa_remove_vertex_from_chip(s, s->vertices[i]);
+	s->vertices[5]->vertex_resources[0] = 3;
+	ck_assert(!sa_place_initial(s));
+	for (size_t x = 0; x < 4; x++) {
+		for (size_t y = 0; y < 4; y++) {
+			ck_assert(sa_get_chip_vertex(s, x, y) == NULL);
+			if (x == 0 && y == 0)
+				ck_assert(sa_get_chip_resources(s, x, y, 0) == 1);
+			else if (x != 1 || y != 1)
+				ck_assert(sa_get_chip_resources(s, x, y, 0) == 2);
+		}
+	}
+	
+	sa_free(s);
+}
+END_TEST
+
+
+/**
+ * Check that sa_place_quadratic produces a valid placement which follows the
+ * pull of the non-movable vertices.
+ */
+START_TEST (test_place_quadratic)
+{
+	// An 8x8 system where each chip has room for one vertex. A chain of 20
+	// movable vertices runs between non-movable vertices on opposite corners.
+	// An additional large (star-modelled) net joins the first half of the chain.
+	sa_state_t *s = sa_new(8, 8, 1, 22, 22);
+	ck_assert(s);
+	s->num_movable_vertices = 20;
+	for (size_t x = 0; x < 8; x++)
+		for (size_t y = 0; y < 8; y++)
+			sa_set_chip_resources(s, x, y, 0, 1);
+	for (size_t i = 0; i < 22; i++) {
+		sa_vertex_t *v = sa_new_vertex(s, 3);
+		ck_assert(v);
+		s->vertices[i] = v;
+		v->vertex_resources[0] = 1;
+	}
+	sa_add_vertex_to_chip(s, s->vertices[20], 0, 0, false);
+	sa_add_vertex_to_chip(s, s->vertices[21], 7, 7, false);
+	
+	// The chain: 20 - 0 - 1 - ... - 19 - 21
+	for (size_t i = 0; i < 21; i++) {
+		sa_net_t *n = sa_new_net(s, 2);
+		ck_assert(n);
+		s->nets[i] = n;
+		n->weight = 1.0;
+		sa_add_vertex_to_net(s, n, s->vertices[(i == 0) ? 20 : i - 1]);
+		sa_add_vertex_to_net(s, n, s->vertices[(i == 20) ? 21 : i]);
+	}
+	sa_net_t *n = sa_new_net(s, 10);
+	ck_assert(n);
+	s->nets[21] = n;
+	n->weight = 0.1;
+	for (size_t i = 0; i < 10; i++)
+		sa_add_vertex_to_net(s, n, s->vertices[i]);
+	
+	ck_assert(sa_place_quadratic(s, 100));
+	
+	// Every movable vertex must be on its own chip
+	size_t num_placed = 0;
+	for (size_t x = 0; x < 8; x++) {
+		for (size_t y = 0; y < 8; y++) {
+			int used = ((x == 0 && y == 0) || (x == 7 && y == 7)) ? 1 : 0;
+			for (sa_vertex_t *v = sa_get_chip_vertex(s, x, y); v; v = v->next) {
+				ck_assert(v->x == (int)x);
+				ck_assert(v->y == (int)y);
+				used++;
+				num_placed++;
+			}
+			ck_assert(used <= 1);
+			ck_assert(sa_get_chip_resources(s, x, y, 0) == 1 - used);
+		}
+	}
+	ck_assert(num_placed == 20);
+	
+	// The chain should run evenly from one corner to the other
+	for (size_t i = 0; i < 20; i++)
+		ck_assert(fabs((s->vertices[i]->x + s->vertices[i]->y) - (14.0 * (i + 1) / 21.0)) <= 3.0);
+	
+	// If there isn't enough room, nothing is placed
+	for (size_t i = 0; i < 20; i++)
+		sa_remove_vertex_from_chip(s, s->vertices[i]);
+	for (size_t x = 0; x < 8; x++)
+		for (size_t y = 2; y < 8; y++)
+			sa_set_chip_resources(s, x, y, 0, -1);
+	ck_assert(!sa_place_quadratic(s, 100));
+	for (size_t x = 0; x < 8; x++) {
+		for (size_t y = 0; y < 2; y++) {
+			ck_assert(sa_get_chip_vertex(s, x, y) == NULL);
+			ck_assert(sa_get_chip_resources(s, x, y, 0) == ((x == 0 && y == 0) ? 0 : 1));
+		}
+	}
+	
+	sa_free(s);
+}
+END_TEST
+
+
+/**
+ * Check that sa_run_multilevel improves a scrambled placement while keeping it
+ * valid.
+ */
+START_TEST (test_run_multilevel)
+{
+	// An 8x8 system where each chip has room for 2 units of resource and an
+	// 8x8 mesh of 64 vertices of 1 unit, each connected to its right and upper
+	// neighbours, initially scrambled over the system. A non-movable vertex
+	// sits on (0, 0).
+	sa_state_t *s = sa_new(8, 8, 1, 65, 113);
+	ck_assert(s);
+	s->num_movable_vertices = 64;
+	s->has_wrap_around_links = false;
+	for (size_t x = 0; x < 8; x++)
+		for (size_t y = 0; y < 8; y++)
+			sa_set_chip_resources(s, x, y, 0, 2);
+	for (size_t i = 0; i < 65; i++) {
+		size_t x = i % 8;
+		size_t y = i / 8;
+		sa_vertex_t *v = sa_new_vertex(s, (i < 64)
+		                                  ? (x > 0) + (x < 7) + (y > 0) + (y < 7) + (i == 0)
+		                                  : 1);
+		ck_assert(v);
+		s->vertices[i] = v;
+		v->vertex_resources[0] = 1;
+	}
+	sa_add_vertex_to_chip(s, s->vertices[64], 0, 0, false);
+	for (size_t i = 0; i < 64; i++) {
+		size_t chip = (i * 37) % 64;
+		sa_add_vertex_to_chip(s, s->vertices[i], chip % 8, chip / 8, true);
+	}
+	size_t num_nets = 0;
+	for (size_t i = 0; i < 64; i++) {
+		for (size_t d = 0; d < 2; d++) {
+			size_t j = (d == 0) ? i + 1 : i + 8;
+			if ((d == 0 && i % 8 == 7) || j >= 64)
+				continue;
+			sa_net_t *n = sa_new_net(s, 2);
+			ck_assert(n);
+			s->nets[num_nets++] = n;
+			n->weight = 1.0;
+			sa_add_vertex_to_net(s, n, s->vertices[i]);
+			sa_add_vertex_to_net(s, n, s->vertices[j]);
+		}
+	}
+	sa_net_t *n = sa_new_net(s, 2);
+	ck_assert(n);
+	s->nets[num_nets++] = n;
+	n->weight = 1.0;
+	sa_add_vertex_to_net(s, n, s->vertices[64]);
+	sa_add_vertex_to_net(s, n, s->vertices[0]);
+	ck_assert(num_nets == 113);
+	
+	double initial_cost = sa_get_total_cost(s);
+	ck_assert(sa_run_multilevel(s, 4, 2000, 3, 1.0, 0.01));
+	
+	// The placement must remain valid
+	size_t num_placed = 0;
+	for (size_t x = 0; x < 8; x++) {
+		for (size_t y = 0; y < 8; y++) {
+			int used = (x == 0 && y == 0) ? 1 : 0;
+			for (sa_vertex_t *v = sa_get_chip_vertex(s, x, y); v; v = v->next) {
+				ck_assert(v->x == (int)x);
+				ck_assert(v->y == (int)y);
+				used++;
+				num_placed++;
+			}
+			ck_assert(sa_get_chip_resources(s, x, y, 0) == 2 - used);
+		}
+	}
+	ck_assert(num_placed == 64);
+	
+	ck_assert(sa_get_total_cost(s) < initial_cost / 2.0);
+	
+	sa_free(s);
+}
+END_TEST
 
 
 Suite *
@@ -470,11 +2224,31 @@ make_sa_algorithm_suite(void)
 	tcase_add_checked_fixture(tc_core, setup, teardown);
 	tcase_add_test(tc_core, test_get_net_cost_one_vertex);
 	tcase_add_test(tc_core, test_get_net_cost);
+	tcase_add_test(tc_core, test_get_net_cost_models);
+	tcase_add_test(tc_core, test_get_total_cost_per_net);
+	tcase_add_test(tc_core, test_distance_table);
 	tcase_add_test(tc_core, test_get_swap_cost);
+	tcase_add_test(tc_core, test_get_swap_cost_pure);
 	tcase_add_test(tc_core, test_step_no_free_chips);
 	tcase_add_test(tc_core, test_step_not_enough_space_on_original_chip);
 	tcase_add_test(tc_core, test_step_bad_cost);
 	tcase_add_test(tc_core, test_run_steps);
+	tcase_add_test(tc_core, test_run_steps_until);
+	tcase_add_test(tc_core, test_net_histograms);
+	tcase_add_test(tc_core, test_fixed_vertices);
+	tcase_add_test(tc_core, test_frozen_nets);
+	tcase_add_test(tc_core, test_link_congestion);
+	tcase_add_test(tc_core, test_move_types);
+	tcase_add_test(tc_core, test_rejected_moves_unmodified);
+	tcase_add_test(tc_core, test_trace);
+	tcase_add_test(tc_core, test_dirty_vertices);
+	tcase_add_test(tc_core, test_background_anneal);
+	tcase_add_test(tc_core, test_vertex_selection);
+	tcase_add_test(tc_core, test_philox);
+	tcase_add_test(tc_core, test_rng_philox);
+	tcase_add_test(tc_core, test_place_initial);
+	tcase_add_test(tc_core, test_place_quadratic);
+	tcase_add_test(tc_core, test_run_multilevel);
 	
 	// Add each test case to the suite
 	suite_add_tcase(s, tc_core);
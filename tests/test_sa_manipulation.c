@@ -456,6 +456,106 @@ START_TEST (test_get_random_nearby_chip)
 }
 END_TEST
 
+/**
+ * Check that once prepared, sa_get_random_nearby_chip only picks live chips.
+ */
+START_TEST (test_get_random_nearby_live_chip)
+{
+	size_t w = 8;
+	size_t h = 4;
+	sa_state_t *s = sa_new(w, h, 1, 1, 0);
+	ck_assert(s);
+	s->num_movable_vertices = 1;
+	s->vertices[0] = sa_new_vertex(s, 0);
+	ck_assert(s->vertices[0]);
+	s->vertices[0]->vertex_resources[0] = 0;
+	
+	// Kill every third chip
+	bool live[w][h];
+	for (size_t x = 0; x < w; x++) {
+		for (size_t y = 0; y < h; y++) {
+			live[x][y] = (x + y) % 3 != 0;
+			sa_set_chip_resources(s, x, y, 0, live[x][y] ? 1 : -1);
+		}
+	}
+	sa_add_vertex_to_chip(s, s->vertices[0], 1, 1, true);
+	
+	// Is x within the distance limit of ox on an axis of the given size?
+	bool _in_range(int x, int ox, int distance_limit, int size) {
+		int d = abs(x - ox);
+		if (s->has_wrap_around_links && size - d < d)
+			d = size - d;
+		return d <= distance_limit;
+	}
+	
+	// Sample many chips and check exactly the live chips in range are hit
+	void _check_samples(int ox, int oy, int distance_limit) {
+		size_t hits[w][h];
+		for (size_t x = 0; x < w; x++)
+			for (size_t y = 0; y < h; y++)
+				hits[x][y] = 0;
+		
+		for (size_t i = 0; i < 2000; i++) {
+			int x = -1;
+			int y = -1;
+			sa_get_random_nearby_chip(s, ox, oy, distance_limit, &x, &y);
+			ck_assert(x >= 0);
+			ck_assert(x < w);
+			ck_assert(y >= 0);
+			ck_assert(y < h);
+			hits[x][y]++;
+		}
+		
+		size_t num_expected = 0;
+		for (size_t x = 0; x < w; x++)
+			for (size_t y = 0; y < h; y++) {
+				bool expected = live[x][y] &&
+				                _in_range(x, ox, distance_limit, w) &&
+				                _in_range(y, oy, distance_limit, h) &&
+				                (x != ox || y != oy);
+				ck_assert_msg(!!hits[x][y] == expected,
+				              "%d hits unexpectedly on %d,%d\n", hits[x][y], x, y);
+				num_expected += expected;
+			}
+		
+		// The live chips should be hit roughly uniformly
+		size_t mean = 2000 / num_expected;
+		for (size_t x = 0; x < w; x++)
+			for (size_t y = 0; y < h; y++)
+				if (hits[x][y])
+					ck_assert_msg(hits[x][y] > mean / 2 && hits[x][y] < (mean * 3) / 2,
+					              "%d hits on %d,%d, expected around %d\n",
+					              hits[x][y], x, y, mean);
+	}
+	
+	for (int wrap = 0; wrap < 2; wrap++) {
+		s->has_wrap_around_links = wrap;
+		ck_assert(sa_prepare(s));
+		ck_assert(s->live_chip_counts);
+		
+		_check_samples(4, 2, 1);
+		_check_samples(0, 0, 1);
+		_check_samples(7, 3, 1);
+		_check_samples(1, 1, 2);
+		_check_samples(6, 0, 3);
+		_check_samples(4, 3, 4);
+		_check_samples(3, 0, 8);
+	}
+	
+	// With no other live chips in range, a chip is still picked
+	for (size_t x = 0; x < w; x++)
+		for (size_t y = 0; y < h; y++)
+			if (x != 1 || y != 1)
+				sa_set_chip_resources(s, x, y, 0, -1);
+	ck_assert(sa_prepare(s));
+	int x, y;
+	sa_get_random_nearby_chip(s, 1, 1, 1, &x, &y);
+	ck_assert(x != 1 || y != 1);
+	
+	sa_free(s);
+}
+END_TEST
+
 /**
  * Check the sa_make_room_on_chip function does as it says on the tin...
  */
@@ -628,6 +728,57 @@ START_TEST (test_make_room_on_chip)
 }
 END_TEST
 
+/**
+ * Check that once prepared, sa_make_room_on_chip rejects requests which no
+ * number of vertices could satisfy without disturbing the chip.
+ */
+START_TEST (test_make_room_on_chip_capacity)
+{
+	s->num_movable_vertices = 2;
+	for (size_t x = 0; x < w; x++)
+		for (size_t y = 0; y < h; y++)
+			for (size_t r = 0; r < nr; r++)
+				sa_set_chip_resources(s, x, y, r, 3);
+	for (size_t i = 0; i < nv; i++) {
+		s->vertices[i] = sa_new_vertex(s, 0);
+		ck_assert(s->vertices[i]);
+		for (size_t r = 0; r < nr; r++)
+			s->vertices[i]->vertex_resources[r] = 1;
+		sa_add_vertex_to_chip(s, s->vertices[i], i / 3, 0, i < 2);
+	}
+	for (size_t i = 0; i < nn; i++) {
+		s->nets[i] = sa_new_net(s, 0);
+		ck_assert(s->nets[i]);
+	}
+	
+	// Chip (0, 0) has no resources free, a capacity of two units of each resource
+	// and two movable vertices
+	ck_assert(sa_prepare(s));
+	sa_vertex_t *va = sa_get_chip_vertex(s, 0, 0);
+	sa_vertex_t *vb = va->next;
+	
+	// More than the chip's capacity: the chip is left exactly as it was
+	int too_much[] = {0, 3};
+	sa_vertex_t *removed_vertices = va;
+	ck_assert(!sa_make_room_on_chip(s, 0, 0, too_much, &removed_vertices));
+	ck_assert(removed_vertices == NULL);
+	ck_assert(sa_get_chip_vertex(s, 0, 0) == va);
+	ck_assert(va->next == vb);
+	ck_assert(vb->next == NULL);
+	ck_assert(sa_get_chip_resources(s, 0, 0, 0) == 0);
+	ck_assert(sa_get_chip_resources(s, 0, 0, 1) == 0);
+	
+	// Exactly the capacity requires both vertices to be removed
+	int all[] = {2, 2};
+	ck_assert(sa_make_room_on_chip(s, 0, 0, all, &removed_vertices));
+	ck_assert(sa_get_chip_vertex(s, 0, 0) == NULL);
+	ck_assert(removed_vertices == vb);
+	ck_assert(vb->next == va);
+	ck_assert(sa_get_chip_resources(s, 0, 0, 0) == 2);
+	ck_assert(sa_get_chip_resources(s, 0, 0, 1) == 2);
+}
+END_TEST
+
 
 Suite *
 make_sa_manipulation_suite(void)
@@ -645,7 +796,9 @@ make_sa_manipulation_suite(void)
 	tcase_add_test(tc_core, test_remove_vertices_from_chip);
 	tcase_add_test(tc_core, test_get_random_movable_vertex);
 	tcase_add_test(tc_core, test_get_random_nearby_chip);
+	tcase_add_test(tc_core, test_get_random_nearby_live_chip);
 	tcase_add_test(tc_core, test_make_room_on_chip);
+	tcase_add_test(tc_core, test_make_room_on_chip_capacity);
 	
 	// Add each test case to the suite
 	suite_add_tcase(s, tc_core);
@@ -7,6 +7,8 @@
 #include <stdlib.h>
 #include <stdbool.h>
 
+#include <math.h>
+
 #include "tests.h"
 
 #include "sa.h"
@@ -52,7 +54,12 @@ START_TEST (test_constructors)
 		sa_vertex_t *v = sa_new_vertex(s, i + 1);
 		ck_assert(v);
 		ck_assert(v->num_nets == i + 1);
+		
+		// The vertex is not on any chip yet
+		ck_assert(v->x == -1);
+		ck_assert(v->y == -1);
 		s->vertices[i] = v;
+		v->index = i;
 		
 		// The right amount of memory for resources should be allocated (Valgrind
 		// will complain otherwise...)
@@ -109,6 +116,7 @@ START_TEST (test_constructors)
 		sa_net_t *n = sa_new_net(s, nv - i);
 		ck_assert(n);
 		s->nets[i] = n;
+		n->index = i;
 		
 		ck_assert(n->num_vertices == nv - i);
 		n->weight = i + 1.0;
@@ -121,7 +129,7 @@ START_TEST (test_constructors)
 		for (size_t j = 0; j < nv; j++) {
 			bool seen = false;
 			for (size_t k = 0; k < n->num_vertices; k++) {
-				if (s->vertices[j] == n->vertices[k]) {
+				if (s->vertices[j] == SA_NET_VERTEX(s, n, k)) {
 					ck_assert(!seen);
 					seen = true;
 				}
@@ -141,7 +149,7 @@ START_TEST (test_constructors)
 		for (size_t j = 0; j < nn; j++) {
 			bool seen = false;
 			for (size_t k = 0; k < v->num_nets; k++) {
-				if (s->nets[j] == v->nets[k]) {
+				if (s->nets[j] == SA_VERTEX_NET(s, v, k)) {
 					ck_assert(!seen);
 					seen = true;
 				}
@@ -158,6 +166,140 @@ START_TEST (test_constructors)
 }
 END_TEST
 
+/**
+ * Check that states may be allocated using every allocation policy (falling
+ * back on ordinary memory where huge pages or NUMA are unavailable).
+ */
+START_TEST (test_alloc_policies)
+{
+	// Large enough for the arrays to occupy several huge pages
+	size_t w = 1000;
+	size_t h = 1000;
+	size_t nv = 300000;
+	
+	for (int policy = 0; policy < 4; policy++) {
+		sa_state_t *s = sa_new_with_policy(w, h, 1, nv, 1,
+		                                   (sa_alloc_policy_t)policy);
+		ck_assert(s);
+		ck_assert(s->alloc_policy == (sa_alloc_policy_t)policy);
+		
+		for (size_t i = 0; i < w * h; i++) {
+			ck_assert(s->chip_resources[i] == -1);
+			ck_assert(!s->chip_vertices[i]);
+		}
+		for (size_t i = 0; i < nv; i++)
+			ck_assert(!s->vertices[i]);
+		ck_assert(!s->nets[0]);
+		
+		sa_free(s);
+	}
+}
+END_TEST
+
+/**
+ * Check that vertices may share a resource array.
+ */
+START_TEST (test_resource_classes)
+{
+	sa_state_t *s = sa_new(2, 1, 2, 3, 0);
+	ck_assert(s);
+	s->num_movable_vertices = 3;
+	sa_set_chip_resources(s, 0, 0, 0, 10);
+	sa_set_chip_resources(s, 0, 0, 1, 10);
+	
+	int small[2] = {1, 2};
+	int large[2] = {3, 4};
+	s->vertices[0] = sa_new_vertex_with_resources(s, 0, small);
+	s->vertices[1] = sa_new_vertex_with_resources(s, 0, large);
+	s->vertices[2] = sa_new_vertex_with_resources(s, 0, small);
+	for (size_t i = 0; i < 3; i++) {
+		ck_assert(s->vertices[i]);
+		sa_add_vertex_to_chip(s, s->vertices[i], 0, 0, true);
+	}
+	ck_assert(s->vertices[0]->vertex_resources == small);
+	ck_assert(s->vertices[1]->vertex_resources == large);
+	ck_assert(s->vertices[2]->vertex_resources == small);
+	ck_assert(sa_get_chip_resources(s, 0, 0, 0) == 10 - 5);
+	ck_assert(sa_get_chip_resources(s, 0, 0, 1) == 10 - 8);
+	
+	// Freeing the state must not free the shared arrays
+	sa_free(s);
+	ck_assert(small[0] == 1 && small[1] == 2);
+}
+END_TEST
+
+/**
+ * Check that nets with the same vertices are merged and trivial nets removed.
+ */
+START_TEST (test_merge_nets)
+{
+	// Nets 1 and 4 duplicate net 0 (in a different order), net 2 has the same
+	// vertices but a different source, net 7 duplicates net 5 and nets 3 and 6
+	// have too few vertices to have a cost.
+	size_t pins[8][3] = {{0, 1, 2}, {0, 2, 1}, {1, 0, 2}, {3},
+	                     {0, 1, 2}, {4, 5}, {0}, {4, 5}};
+	size_t num_pins[8] = {3, 3, 3, 1, 3, 2, 0, 2};
+	double weights[8] = {1.0, 2.0, 1.0, 1.0, 0.5, 1.0, 1.0, 3.0};
+	size_t num_nets[6] = {4, 4, 4, 1, 2, 2};
+	
+	sa_state_t *s = sa_new(3, 2, 1, 6, 8);
+	ck_assert(s);
+	s->num_movable_vertices = 6;
+	for (size_t i = 0; i < 6; i++) {
+		sa_set_chip_resources(s, i % 3, i / 3, 0, 1);
+		s->vertices[i] = sa_new_vertex(s, num_nets[i]);
+		ck_assert(s->vertices[i]);
+		s->vertices[i]->index = i;
+		s->vertices[i]->vertex_resources[0] = 1;
+		sa_add_vertex_to_chip(s, s->vertices[i], (5 - i) % 3, (5 - i) / 3, true);
+	}
+	for (size_t i = 0; i < 8; i++) {
+		s->nets[i] = sa_new_net(s, num_pins[i]);
+		ck_assert(s->nets[i]);
+		s->nets[i]->index = i;
+		s->nets[i]->weight = weights[i];
+		for (size_t j = 0; j < num_pins[i]; j++)
+			sa_add_vertex_to_net(s, s->nets[i], s->vertices[pins[i][j]]);
+	}
+	sa_net_t *net0 = s->nets[0];
+	sa_net_t *net2 = s->nets[2];
+	sa_net_t *net5 = s->nets[5];
+	
+	double cost = sa_get_total_cost(s);
+	
+	size_t net_map[8];
+	ck_assert(sa_merge_nets(s, net_map));
+	size_t expected_map[8] = {0, 0, 1, SA_NET_REMOVED, 0, 2, SA_NET_REMOVED, 2};
+	for (size_t i = 0; i < 8; i++)
+		ck_assert(net_map[i] == expected_map[i]);
+	
+	// The first of each set of nets remains, renumbered and with the sum of
+	// the weights
+	ck_assert(s->num_nets == 3);
+	ck_assert(s->nets[0] == net0 && net0->index == 0 && net0->weight == 3.5);
+	ck_assert(s->nets[1] == net2 && net2->index == 1 && net2->weight == 1.0);
+	ck_assert(s->nets[2] == net5 && net5->index == 2 && net5->weight == 4.0);
+	
+	// Each vertex lists each of its remaining nets once
+	for (size_t i = 0; i < 3; i++) {
+		ck_assert(s->vertices[i]->num_nets == 2);
+		ck_assert(SA_VERTEX_NET(s, s->vertices[i], 0) == net0);
+		ck_assert(SA_VERTEX_NET(s, s->vertices[i], 1) == net2);
+	}
+	ck_assert(s->vertices[3]->num_nets == 0);
+	for (size_t i = 4; i < 6; i++) {
+		ck_assert(s->vertices[i]->num_nets == 1);
+		ck_assert(SA_VERTEX_NET(s, s->vertices[i], 0) == net5);
+	}
+	
+	// The cost is unchanged
+	ck_assert_msg(fabs(sa_get_total_cost(s) - cost) < 1e-9,
+	              "%f == %f", sa_get_total_cost(s), cost);
+	
+	sa_free(s);
+}
+END_TEST
+
 
 Suite *
 make_sa_state_suite(void)
@@ -167,6 +309,9 @@ make_sa_state_suite(void)
 	// Add tests to the test case
 	TCase *tc_core = tcase_create("Core");
 	tcase_add_test(tc_core, test_constructors);
+	tcase_add_test(tc_core, test_alloc_policies);
+	tcase_add_test(tc_core, test_resource_classes);
+	tcase_add_test(tc_core, test_merge_nets);
 	
 	// Add each test case to the suite
 	suite_add_tcase(s, tc_core);